@@ -136,6 +136,13 @@ namespace graphchi {
         return ss.str();
     }
     
+    /**
+     * Bitmap of the deleted edges of a block, see shards/tombstones.hpp.
+     */
+    static std::string filename_block_tombstones(std::string blockfilename) {
+        return blockfilename + ".deleted";
+    }
+    
     
     static std::string filename_shard_adj(std::string basefilename, int p, int nshards) {
         std::stringstream ss;
@@ -145,6 +152,13 @@ namespace graphchi {
         return ss.str();
     }
     
+    /**
+     * Sparse index of a shard's adjacency file, see shards/shardindex.hpp.
+     */
+    static std::string filename_shard_index(std::string adjfilename) {
+        return adjfilename + ".index";
+    }
+    
     /**
      * Configuration file name
      */
@@ -317,6 +331,7 @@ namespace graphchi {
                     
                     break;
                 }
+                remove(filename_block_tombstones(block_filename).c_str()); // Ok if did not exist
 #ifdef DYNAMICEDATA
                 delete_block_uncompressed_sizefile(block_filename);
 #endif
@@ -0,0 +1,214 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Compact (CSR) representation of the edges of a window of vertices in the
+ * memory shard: all in-edges of the vertices, and their out-edges to the
+ * shard's interval. An alternative to the graphchi_edge objects of graphchi_vertex,
+ * which store a pointer to the value of each edge. Here the neighbor ids of each vertex
+ * are in a contiguous vid_t array. The out-edges of a vertex are consecutive in the
+ * edge data of the shard, so their values are a span starting from the first
+ * out-edge and no per-edge reference is stored. In-edges are scattered over
+ * the shard and store a 32-bit index to the edge data. If the shard has
+ * deleted edges (SUPPORT_DELETIONS), the out-edges store an index too.
+ *
+ * Memory per edge is 4 bytes for out-edges and 8 bytes for in-edges,
+ * compared to sizeof(graphchi_edge<ET>) (12 bytes on 64-bit machines).
+ * If the shard loads only the adjacency, there are no edge values and
+ * in-edges take 4 bytes.
+ *
+ * Filled by memory_shard::load_csr().
+ */
+
+#ifndef DEF_GRAPHCHI_CSR_VERTEX
+#define DEF_GRAPHCHI_CSR_VERTEX
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "graphchi_types.hpp"
+
+namespace graphchi {
+
+    /**
+     * Edge values of a shard, stored in blocks. Edge with index i is
+     * the i'th value in the shard's edge data file.
+     */
+    template <typename ET>
+    struct edge_value_blocks {
+        char ** blocks;
+        size_t edges_per_block;
+
+        edge_value_blocks() : blocks(NULL), edges_per_block(0) {}
+        edge_value_blocks(char ** blocks, size_t blocksize) : blocks(blocks), edges_per_block(blocksize / sizeof(ET)) {}
+
+        inline ET & operator[](size_t idx) const {
+            return ((ET *) blocks[idx / edges_per_block])[idx % edges_per_block];
+        }
+    };
+
+    /**
+     * Values of consecutive edges: first, first + stride, ...
+     * or of the edges listed in idx, if not NULL.
+     */
+    template <typename ET>
+    struct edge_value_span {
+        edge_value_blocks<ET> values;
+        size_t first;
+        size_t stride;
+        int n;
+        const uint32_t * idx;
+
+        edge_value_span(edge_value_blocks<ET> values, size_t first, int n, size_t stride = 1) :
+            values(values), first(first), stride(stride), n(n), idx(NULL) {}
+
+        edge_value_span(edge_value_blocks<ET> values, const uint32_t * idx, int n) :
+            values(values), first(0), stride(1), n(n), idx(idx) {}
+
+        int size() const {
+            return n;
+        }
+
+        inline ET & operator[](int i) const {
+            return (idx == NULL ? values[first + i * stride] : values[idx[i]]);
+        }
+    };
+
+    template <typename ET>
+    class csr_vertex;
+
+    template <typename ET>
+    class csr_adjacency {
+    public:
+        vid_t window_st, window_en;
+
+        /* Row offsets to the neighbor arrays, number of vertices + 1 */
+        std::vector<size_t> in_offsets;
+        std::vector<size_t> out_offsets;
+
+        std::vector<vid_t> in_nbrs;
+        std::vector<vid_t> out_nbrs;
+
+        /* Edge data index of each in-edge and of the first out-edge of each vertex */
+        std::vector<uint32_t> in_edge_idx;
+        std::vector<size_t> out_first_edge;
+
+        /* Edge data index of each out-edge, only if the shard has deleted edges */
+        std::vector<uint32_t> out_edge_idx;
+
+        edge_value_blocks<ET> values;
+
+        csr_adjacency() : window_st(0), window_en(0) {}
+
+        int num_vertices() const {
+            return (int) (window_en - window_st + 1);
+        }
+
+        size_t num_edges() const {
+            return in_nbrs.size() + out_nbrs.size();
+        }
+
+        /**
+         * Memory used by the edges, for budgeting windows.
+         */
+        static size_t bytes_per_inedge() {
+            return sizeof(vid_t) + sizeof(uint32_t);
+        }
+
+        static size_t bytes_per_outedge() {
+            return sizeof(vid_t);
+        }
+
+        csr_vertex<ET> vertex(vid_t vid);
+    };
+
+    /**
+     * View of one vertex of a csr_adjacency.
+     */
+    template <typename ET>
+    class csr_vertex {
+        csr_adjacency<ET> * adj;
+        int i;  // Index in the window
+
+    public:
+        csr_vertex(csr_adjacency<ET> * adj, int i) : adj(adj), i(i) {}
+
+        vid_t id() const {
+            return adj->window_st + i;
+        }
+
+        int num_inedges() const {
+            return (int) (adj->in_offsets[i + 1] - adj->in_offsets[i]);
+        }
+
+        int num_outedges() const {
+            return (int) (adj->out_offsets[i + 1] - adj->out_offsets[i]);
+        }
+
+        int num_edges() const {
+            return num_inedges() + num_outedges();
+        }
+
+        /* Contiguous arrays of the neighbor ids */
+        const vid_t * in_neighbors() const {
+            return &adj->in_nbrs[adj->in_offsets[i]];
+        }
+
+        const vid_t * out_neighbors() const {
+            return &adj->out_nbrs[adj->out_offsets[i]];
+        }
+
+        vid_t in_neighbor(int j) const {
+            return adj->in_nbrs[adj->in_offsets[i] + j];
+        }
+
+        vid_t out_neighbor(int j) const {
+            return adj->out_nbrs[adj->out_offsets[i] + j];
+        }
+
+        ET & inedge_value(int j) const {
+            return adj->values[adj->in_edge_idx[adj->in_offsets[i] + j]];
+        }
+
+        ET & outedge_value(int j) const {
+            if (!adj->out_edge_idx.empty()) return adj->values[adj->out_edge_idx[adj->out_offsets[i] + j]];
+            return adj->values[adj->out_first_edge[i] + j];
+        }
+
+        edge_value_span<ET> outedge_values() const {
+            if (!adj->out_edge_idx.empty()) {
+                return edge_value_span<ET>(adj->values, &adj->out_edge_idx[0] + adj->out_offsets[i], num_outedges());
+            }
+            return edge_value_span<ET>(adj->values, adj->out_first_edge[i], num_outedges());
+        }
+    };
+
+    template <typename ET>
+    csr_vertex<ET> csr_adjacency<ET>::vertex(vid_t vid) {
+        assert(vid >= window_st && vid <= window_en);
+        return csr_vertex<ET>(this, (int) (vid - window_st));
+    }
+}
+
+#endif
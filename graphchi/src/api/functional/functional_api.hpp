@@ -27,6 +27,10 @@
  * layer on top of the standard API, but uses a specialized engine "functional_engine",
  * which processes the graph data in different order. Namely, it first loads in-edges,
  * then executes updates, and finally writes new values (broadcasts) to out-edges.
+ * By default the unweighted kernels are run with "functional_pullpush_engine", which
+ * does not store the edge values but computes them from the values of the vertices,
+ * and so reads each shard once per iteration. Set configuration option "pullpush"
+ * to 0 to use the functional engine.
  */
 
 
@@ -38,6 +42,7 @@
 #include "api/graph_objects.hpp"
 #include "api/graphchi_context.hpp"
 #include "engine/functional/functional_engine.hpp"
+#include "engine/functional/functional_pullpush_engine.hpp"
 #include "metrics/metrics.hpp"
 #include "graphchi_types.hpp"
 
@@ -57,6 +62,18 @@ namespace graphchi {
         typedef FVertexDataType VertexDataType;
         typedef FEdgeDataType EdgeDataType;
         
+        /**
+         * Kernels whose gather is a plain sum, minimum or maximum of the values of
+         * the in-neighbors can declare it, for example
+         *     typedef sum_op<float> gather_op;
+         * (see api/reducers.hpp). Then op_neighborval() and plus() are not called:
+         * the pull/push engine computes value_to_neighbor() once for each vertex,
+         * with nbid the id of the vertex itself, and reduces the values of the
+         * in-neighbors of each vertex with SIMD instructions. So value_to_neighbor()
+         * must not depend on nbid, and the gather starts from reset().
+         */
+        typedef scalar_gather gather_op;
+        
         functional_kernel() {}
          
         /* Initial value - on first iteration */
@@ -75,6 +92,27 @@ namespace graphchi {
     }; 
 
     
+    /**
+     * Runs the program with the pull/push engine, or with the functional
+     * engine if the configuration option "pullpush" is 0.
+     */
+    template <class PROGRAM>
+    void run_functional_program(PROGRAM &program, std::string filename, int nshards, int niters,
+                                bool deterministic, metrics &_m) {
+        typedef typename PROGRAM::VertexDataType VT;
+        typedef typename PROGRAM::EdgeDataType ET;
+        typedef typename PROGRAM::fvertex_t fvertex_t;
+        if (get_option_int("pullpush", 1) != 0) {
+            functional_pullpush_engine<VT, ET, fvertex_t> engine(filename, nshards, false, _m);
+            engine.run(program, niters);
+        } else {
+            functional_engine<VT, ET, fvertex_t> engine(filename, nshards, false, _m);
+            engine.set_modifies_inedges(false); // Important
+            engine.set_modifies_outedges(true); // Important
+            engine.set_enable_deterministic_parallelism(deterministic);
+            engine.run(program, niters);
+        }
+    }
     
     /** 
      * Run a functional kernel with unweighted edges.
@@ -97,15 +135,7 @@ namespace graphchi {
         /* Process input file - if not already preprocessed */
         int nshards           
             = convert_if_notexists<typename FunctionalProgramProxySemisync<KERNEL>::EdgeDataType>(filename, get_option_string("nshards", "auto"));
-        functional_engine<typename FunctionalProgramProxySemisync<KERNEL>::VertexDataType, 
-            typename FunctionalProgramProxySemisync<KERNEL>::EdgeDataType,
-            typename FunctionalProgramProxySemisync<KERNEL>::fvertex_t > 
-                engine(filename, nshards, false, _m);
-        
-        
-        engine.set_modifies_inedges(false); // Important
-        engine.set_modifies_outedges(true); // Important
-        engine.run(program, niters);
+        run_functional_program(program, filename, nshards, niters, true, _m);
     }
     
     
@@ -124,14 +154,7 @@ namespace graphchi {
         FunctionalProgramProxyBulkSync<KERNEL> program;
         int nshards           
             = convert_if_notexists<typename FunctionalProgramProxyBulkSync<KERNEL>::EdgeDataType>(filename, get_option_string("nshards", "auto"));
-        functional_engine<typename FunctionalProgramProxyBulkSync<KERNEL>::VertexDataType,
-            typename FunctionalProgramProxyBulkSync<KERNEL>::EdgeDataType,
-            typename FunctionalProgramProxyBulkSync<KERNEL>::fvertex_t > 
-                engine(filename, nshards, false, _m);
-        engine.set_modifies_inedges(false); // Important
-        engine.set_modifies_outedges(true); // Important
-        engine.set_enable_deterministic_parallelism(false); // Bulk synchronous does not need consistency.
-        engine.run(program, niters);
+        run_functional_program(program, filename, nshards, niters, false, _m); // Bulk synchronous does not need consistency.
     }
     
 }
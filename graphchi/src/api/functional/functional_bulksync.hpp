@@ -53,6 +53,7 @@ namespace graphchi {
         
         typedef typename KERNEL::VertexDataType VT;
         typedef PairContainer<typename KERNEL::EdgeDataType> ET;
+        typedef KERNEL kernel_t;
        
         KERNEL kernel;
 
@@ -61,10 +62,14 @@ namespace graphchi {
         vertex_info vinfo;
         graphchi_context * gcontext;
         
-        functional_vertex_unweighted_bulksync() : graphchi_vertex<VT, ET> () {}
+        /* Pull/push engine: values of the neighbors on the previous iteration, and its context */
+        functional_message<VT> * messages;
+        graphchi_context * prevcontext;
+        
+        functional_vertex_unweighted_bulksync() : graphchi_vertex<VT, ET> (), messages(NULL), prevcontext(NULL) {}
         
         functional_vertex_unweighted_bulksync(graphchi_context &ginfo, vid_t _id, int indeg, int outdeg) : 
-        graphchi_vertex<VT, ET> (_id, NULL, NULL, indeg, outdeg) { 
+        graphchi_vertex<VT, ET> (_id, NULL, NULL, indeg, outdeg), messages(NULL), prevcontext(NULL) { 
             vinfo.indegree = indeg;
             vinfo.outdegree = outdeg;
             vinfo.vertexid = _id;
@@ -92,10 +97,16 @@ namespace graphchi {
                 cumval = kernel.plus(cumval, kernel.op_neighborval(*gcontext, 
                                                                vinfo, 
                                                                src, 
-                                                               ptr->oldval(gcontext->iteration)));
+                                                               (messages == NULL ? ptr->oldval(gcontext->iteration) : message_from(src))));
             }
         }
         
+        /* The value the neighbor wrote to the edge on the previous iteration */
+        inline typename KERNEL::EdgeDataType message_from(vid_t src) {
+            functional_message<VT> &msg = messages[src];
+            return kernel.value_to_neighbor(*prevcontext, msg.info, vinfo.vertexid, msg.value);
+        }
+        
         void ready(graphchi_context &ginfo) {
             this->set_data(kernel.compute_vertexvalue(*gcontext, vinfo, cumval));
         }
@@ -119,6 +130,11 @@ namespace graphchi {
         static bool read_outedges() {
             return true;
         }
+        
+        /* New values are visible on the next iteration only */
+        static bool bulk_synchronous() {
+            return true;
+        }
     };
     
     
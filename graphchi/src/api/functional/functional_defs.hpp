@@ -27,7 +27,18 @@
 #ifndef GRAPHCHI_FUNCTIONALDEFS_DEF
 #define GRAPHCHI_FUNCTIONALDEFS_DEF
 
+#include <assert.h>
+
 #include "api/graphchi_program.hpp"
+#include "api/reducers.hpp"
+
+/* Lets the compiler vectorize the reduction loops with the instruction set
+   it targets (for example -mavx2 or -mavx512f), if OpenMP 4.0 is available. */
+#if defined(_OPENMP) && _OPENMP >= 201307
+#define FUNCTIONAL_GATHER_SIMD(clause) _Pragma(#clause)
+#else
+#define FUNCTIONAL_GATHER_SIMD(clause)
+#endif
 
 namespace graphchi {
     
@@ -36,6 +47,92 @@ namespace graphchi {
         int indegree;
         int outdegree;
     };
+    
+    /**
+     * Value of a vertex, as pushed to its out-neighbors by the pull/push engine
+     * on the given iteration.
+     */
+    template <typename VertexDataType>
+    struct functional_message {
+        vertex_info info;
+        int iteration;
+        VertexDataType value;
+    };
+    
+    /**
+     * Default gather of the kernels: op_neighborval() and plus() are called for
+     * each in-edge. See functional_kernel::gather_op.
+     */
+    struct scalar_gather {};
+    
+    /**
+     * Reduces the values of the in-neighbors of a vertex, values[nbrs[0]] ...
+     * values[nbrs[n-1]], to acc with the operation GatherOp of the reducers.
+     * The loops of sum_op, min_op and max_op are vectorized, other operations
+     * are combined one value at a time.
+     */
+    template <typename GatherOp>
+    struct functional_gather {
+        static const bool vectorized = true;
+        
+        template <typename T>
+        static T reduce(T acc, const T * values, const vid_t * nbrs, int n) {
+            for(int j=0; j < n; j++) {
+                GatherOp::combine(acc, values[nbrs[j]]);
+            }
+            return acc;
+        }
+    };
+    
+    template <>
+    struct functional_gather<scalar_gather> {
+        static const bool vectorized = false;
+        
+        template <typename T>
+        static T reduce(T acc, const T * values, const vid_t * nbrs, int n) {
+            assert(false);
+            return acc;
+        }
+    };
+    
+    template <typename T>
+    struct functional_gather<sum_op<T> > {
+        static const bool vectorized = true;
+        
+        static T reduce(T acc, const T * values, const vid_t * nbrs, int n) {
+            FUNCTIONAL_GATHER_SIMD(omp simd reduction(+:acc))
+            for(int j=0; j < n; j++) {
+                acc += values[nbrs[j]];
+            }
+            return acc;
+        }
+    };
+    
+    template <typename T>
+    struct functional_gather<min_op<T> > {
+        static const bool vectorized = true;
+        
+        static T reduce(T acc, const T * values, const vid_t * nbrs, int n) {
+            FUNCTIONAL_GATHER_SIMD(omp simd reduction(min:acc))
+            for(int j=0; j < n; j++) {
+                acc = (values[nbrs[j]] < acc ? values[nbrs[j]] : acc);
+            }
+            return acc;
+        }
+    };
+    
+    template <typename T>
+    struct functional_gather<max_op<T> > {
+        static const bool vectorized = true;
+        
+        static T reduce(T acc, const T * values, const vid_t * nbrs, int n) {
+            FUNCTIONAL_GATHER_SIMD(omp simd reduction(max:acc))
+            for(int j=0; j < n; j++) {
+                acc = (values[nbrs[j]] > acc ? values[nbrs[j]] : acc);
+            }
+            return acc;
+        }
+    };
 
 };
 
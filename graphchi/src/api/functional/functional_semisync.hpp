@@ -47,6 +47,7 @@ public:
     
     typedef typename KERNEL::VertexDataType VT;
     typedef typename KERNEL::EdgeDataType ET;
+    typedef KERNEL kernel_t;
     
     VT cumval;
     
@@ -54,10 +55,14 @@ public:
     vertex_info vinfo;
     graphchi_context * gcontext;
     
-    functional_vertex_unweighted_semisync() : graphchi_vertex<VT, ET> () {}
+    /* Pull/push engine: values of the neighbors, and the context of the previous iteration */
+    functional_message<VT> * messages;
+    graphchi_context * prevcontext;
+    
+    functional_vertex_unweighted_semisync() : graphchi_vertex<VT, ET> (), messages(NULL), prevcontext(NULL) {}
     
     functional_vertex_unweighted_semisync(graphchi_context &ginfo, vid_t _id, int indeg, int outdeg) : 
-    graphchi_vertex<VT, ET> (_id, NULL, NULL, indeg, outdeg) { 
+    graphchi_vertex<VT, ET> (_id, NULL, NULL, indeg, outdeg), messages(NULL), prevcontext(NULL) { 
         vinfo.indegree = indeg;
         vinfo.outdegree = outdeg;
         vinfo.vertexid = _id;
@@ -81,10 +86,18 @@ public:
     // we do not need atomic instructions here!
     inline void add_inedge(vid_t src, ET * ptr, bool special_edge) {
         if (gcontext->iteration > 0) {
-            cumval = kernel.plus(cumval, kernel.op_neighborval(*gcontext, vinfo, src, *ptr));
+            cumval = kernel.plus(cumval, kernel.op_neighborval(*gcontext, vinfo, src, (messages == NULL ? *ptr : message_from(src))));
         } 
     }
     
+    /* The value the neighbor would have written to the edge: the neighbor has been
+       updated either on this iteration or on the previous one. */
+    inline ET message_from(vid_t src) {
+        functional_message<VT> &msg = messages[src];
+        return kernel.value_to_neighbor(msg.iteration == gcontext->iteration ? *gcontext : *prevcontext,
+                                        msg.info, vinfo.vertexid, msg.value);
+    }
+    
     void ready(graphchi_context &gcontext_) {
         this->set_data(kernel.compute_vertexvalue(gcontext_, vinfo, cumval));
     }
@@ -102,6 +115,11 @@ public:
         return false;
     }
     
+    /* New values are visible to the next sub-intervals */
+    static bool bulk_synchronous() {
+        return false;
+    }
+    
     
 };
 
@@ -38,6 +38,10 @@
 #include "graphchi_types.hpp"
 #include "util/qsort.hpp"
 
+#ifdef SUPPORT_DELETIONS
+#include "shards/tombstones.hpp"
+#endif
+
 namespace graphchi {
     
 /**
@@ -93,53 +97,6 @@ namespace graphchi {
     }
     
     
-#ifdef SUPPORT_DELETIONS
-    
-    /*
-     * Hacky support for edge deletions.
-     * Edges are deleted by setting the value of the edge to a special
-     * value that denotes it was deleted.
-     * In the future, a better system could be designed.
-     */
-    
-    // This is hacky...
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(bool val) {
-        return val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val) {
-        return 0xffffffff == (unsigned int)val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(vid_t val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(vid_t val) {
-        return 0xffffffffu == val;
-    }
-    
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(float val);
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(float val) {
-        return !(val < 0 || val > 0);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e) {
-        e->set_data(true);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e) {
-        e->set_data(0xffffffff);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e) {
-        e->set_data(0xffffffff);
-    }
-    
-#endif  
     
     
     template <typename VertexDataType, typename EdgeDataType>
@@ -220,12 +177,6 @@ namespace graphchi {
         // Optimization: as only memshard (not streaming shard) creates inedgers,
         // we do not need atomic instructions here!
         inline void add_inedge(vid_t src, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (inedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_inc++;
-                return;
-            }
-#endif
             if (inedges_ptr != NULL) 
                 inedges_ptr[inc] = graphchi_edge<EdgeDataType>(src, ptr);
             inc++;  // Note: do not move inside the brackets, since we need to still keep track of inc even if inedgeptr is null!
@@ -237,12 +188,6 @@ namespace graphchi {
         }
         
         inline void add_outedge(vid_t dst, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (outedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_outc++;
-                return;
-            }
-#endif
             int i = __sync_add_and_fetch(&outc, 1);
             if (outedges_ptr != NULL) outedges_ptr[i-1] = graphchi_edge<EdgeDataType>(dst, ptr);
             assert(dst != vertexid);
@@ -343,6 +288,10 @@ namespace graphchi {
         
         
 #ifdef SUPPORT_DELETIONS
+        /**
+         * Deletes an edge. Other vertices may still see the edge during
+         * the current iteration. See shards/tombstones.hpp.
+         */
         void VARIABLE_IS_NOT_USED remove_edge(int i) {
             remove_edgev(edge(i));
         }
@@ -354,6 +303,13 @@ namespace graphchi {
         void VARIABLE_IS_NOT_USED remove_outedge(int i) {
             remove_edgev(outedge(i));
         }
+        
+    private:
+        void remove_edgev(graphchi_edge<EdgeDataType> * e) {
+            assert(e->data_ptr != NULL);
+            pending_edge_deletions().add(e->data_ptr);
+        }
+    public:
 #endif
         
         
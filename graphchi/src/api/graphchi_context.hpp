@@ -39,6 +39,7 @@
 
 #include "graphchi_types.hpp"
 #include "api/ischeduler.hpp"
+#include "api/reducers.hpp"
 
 namespace graphchi {
     
@@ -52,12 +53,13 @@ namespace graphchi {
         int num_iterations;
         int last_iteration;
         int execthreads;
-        std::vector<double> deltas;
+        sum_reducer<double> deltas;
+        std::vector<ireducer *> reducers;
         timeval start;
         std::string filename;
         double last_deltasum;
         
-        graphchi_context() : scheduler(NULL), iteration(0), last_iteration(-1) {
+        graphchi_context() : scheduler(NULL), iteration(0), last_iteration(-1), execthreads(omp_get_max_threads()) {
             gettimeofday(&start, NULL);
             last_deltasum = 0.0;
         }
@@ -76,16 +78,42 @@ namespace graphchi {
         }
         
         void reset_deltas(int nthreads) {
-            deltas = std::vector<double>(nthreads, 0.0);
+            deltas.reset(nthreads);
         }
         
         double get_delta() {
-            double d = 0.0;
-            for(int i=0; i < (int)deltas.size(); i++) {
-                d += deltas[i];
+            deltas.merge();
+            last_deltasum = deltas.value();
+            return last_deltasum;
+        }
+        
+        /**
+          * Registers a reducer, which the engine resets before each iteration
+          * and merges before after_iteration(). Registering the same reducer
+          * again has no effect. The reducers are forgotten when the engine is started.
+          */
+        void add_reducer(ireducer * reducer) {
+            for(size_t i=0; i < reducers.size(); i++) {
+                if (reducers[i] == reducer) return;
+            }
+            reducer->reset(execthreads);
+            reducers.push_back(reducer);
+        }
+        
+        void reset_reducers(int nthreads) {
+            for(size_t i=0; i < reducers.size(); i++) {
+                reducers[i]->reset(nthreads);
+            }
+        }
+        
+        void merge_reducers() {
+            for(size_t i=0; i < reducers.size(); i++) {
+                reducers[i]->merge();
             }
-            last_deltasum = d;
-            return d;
+        }
+        
+        void clear_reducers() {
+            reducers.clear();
         }
         
         inline bool isnan(double x) {
@@ -99,7 +127,7 @@ namespace graphchi {
           * @param delta
           */
         void log_change(double delta) {
-            deltas[omp_get_thread_num()] += delta;  
+            deltas.add(delta);
             assert(delta >= 0);
             assert(!isnan(delta)); /* Sanity check */
         }
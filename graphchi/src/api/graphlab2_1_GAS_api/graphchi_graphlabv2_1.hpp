@@ -30,6 +30,8 @@
 #define DEF_GRAPHLAB_WRAPPERS
 
 #include "graphchi_basic_includes.hpp"
+#include "util/dense_bitset.hpp"
+#include "util/pthread_tools.hpp"
 
 using namespace graphchi;
  
@@ -68,6 +70,69 @@ namespace graphlab {
     
     typedef vid_t vertex_id_type;
     
+#define GATHER_CACHE_LOCKS 1024
+    
+    /**
+     * Cache of the gather results of the vertices, see icontext::post_delta().
+     * Kept in memory, like the vertex data of the wrapper. Deltas are
+     * added to a cached value under a lock, so they can be posted by
+     * concurrent updates.
+     */
+    template <typename GatherType>
+    class gather_cache {
+        std::vector<GatherType> values;
+        dense_bitset valid;
+        spinlock locks[GATHER_CACHE_LOCKS];
+        
+        inline spinlock & lock_for(vid_t v) {
+            return locks[v % GATHER_CACHE_LOCKS];
+        }
+        
+    public:
+        gather_cache(size_t nvertices) : values(nvertices), valid(nvertices) {
+            valid.clear();
+        }
+        
+        /**
+         * Copies the cached value of the vertex to out.
+         * @return false if the vertex has no cached value
+         */
+        bool get(vid_t v, GatherType &out) {
+            if (!valid.get(v)) return false;
+            lock_for(v).lock();
+            bool found = valid.get(v);
+            if (found) out = values[v];
+            lock_for(v).unlock();
+            return found;
+        }
+        
+        void set(vid_t v, const GatherType &value) {
+            lock_for(v).lock();
+            values[v] = value;
+            valid.set_bit(v);
+            lock_for(v).unlock();
+        }
+        
+        /**
+         * Adds delta to the cached value of the vertex. If the vertex
+         * has no cached value, the delta is dropped: the next gather
+         * will see the change.
+         */
+        void add(vid_t v, const GatherType &delta) {
+            if (!valid.get(v)) return;
+            lock_for(v).lock();
+            if (valid.get(v)) values[v] += delta;
+            lock_for(v).unlock();
+        }
+        
+        void clear(vid_t v) {
+            lock_for(v).lock();
+            valid.clear_bit(v);
+            values[v] = GatherType();
+            lock_for(v).unlock();
+        }
+    };
+    
     template<typename GraphType,
     typename GatherType, 
     typename MessageType>
@@ -107,11 +172,12 @@ namespace graphlab {
         /* GraphChi */
         graphchi_context * gcontext;
         
-        
+        /* NULL if gather caching is not enabled */
+        gather_cache<gather_type> * cache;
         
     public:        
         
-        icontext(graphchi_context * gcontext) : gcontext(gcontext) {}
+        icontext(graphchi_context * gcontext, gather_cache<gather_type> * cache = NULL) : gcontext(gcontext), cache(cache) {}
         
         /** \brief icontext destructor */
         virtual ~icontext() { }
@@ -283,7 +349,7 @@ namespace graphlab {
          */
         virtual void post_delta(const vertex_type& vertex, 
                                 const gather_type& delta) { 
-            assert(false); // Not implemented
+            if (cache != NULL) cache->add(vertex.id(), delta);
         } 
         
         /**
@@ -295,7 +361,7 @@ namespace graphlab {
          * \param vertex [in] the vertex whose cache to clear.
          */
         virtual void clear_gather_cache(const vertex_type& vertex) {
-            assert(false); // Not implemented
+            if (cache != NULL) cache->clear(vertex.id());
         } 
         
     }; // end of icontext
@@ -534,9 +600,19 @@ namespace graphlab {
         typedef typename GraphLabVertexProgram::message_type message_type;
         
         std::vector<GLVertexDataType> * vertexInmemoryArray;
+        
+        /* Gather caching is enabled with the option use_cache=1, as in GraphLab. The vertex
+           program must then post the changes of its neighbors' gathers with post_delta(). */
+        bool use_cache;
+        gather_cache<gather_type> * cache;
      
-        GraphLabWrapper() {
+        GraphLabWrapper() : cache(NULL) {
             vertexInmemoryArray = new std::vector<GLVertexDataType>();
+            use_cache = get_option_int("use_cache", 0) != 0;
+        }
+        
+        virtual ~GraphLabWrapper() {
+            if (cache != NULL) delete cache;
         }
         
         /**
@@ -546,6 +622,11 @@ namespace graphlab {
             if (gcontext.iteration == 0) {
                 logstream(LOG_INFO) << "Initialize vertices in memory." << std::endl;
                 vertexInmemoryArray->resize(gcontext.nvertices);
+                if (use_cache) {
+                    logstream(LOG_INFO) << "Gather caching enabled." << std::endl;
+                    if (cache != NULL) delete cache;
+                    cache = new gather_cache<gather_type>(gcontext.nvertices);
+                }
             }
         }
         
@@ -571,7 +652,7 @@ namespace graphlab {
          * Update function.
          */
         void update(graphchi_vertex<bool, EdgeDataType> &vertex, graphchi_context &gcontext) {
-            graphlab::icontext<graph_type, gather_type, message_type> glcontext(&gcontext);
+            graphlab::icontext<graph_type, gather_type, message_type> glcontext(&gcontext, cache);
             
             /* Create the vertex program */
             GraphLabVertexWrapper<GLVertexDataType, EdgeDataType> wrapperVertex(vertex.id(), &vertex, vertexInmemoryArray);
@@ -581,9 +662,10 @@ namespace graphlab {
             glVertexProgram.init(glcontext, wrapperVertex, typename GraphLabVertexProgram::message_type());
             const GraphLabVertexProgram& const_vprog = glVertexProgram;
             
-            /* Gather */
-            edge_dir_type gather_direction = const_vprog.gather_edges(glcontext, wrapperVertex);
+            /* Gather, unless the vertex has a cached gather */
             gather_type sum;
+            bool cached = (cache != NULL && cache->get(vertex.id(), sum));
+            edge_dir_type gather_direction = (cached ? NO_EDGES : const_vprog.gather_edges(glcontext, wrapperVertex));
             
             int gathered = 0;
             switch (gather_direction) {
@@ -610,7 +692,9 @@ namespace graphlab {
                 default:
                     assert(false); // Huh?
             }
-            
+            if (cache != NULL && !cached) {
+                cache->set(vertex.id(), sum);
+            }
             
             /* Apply */
             glVertexProgram.apply(glcontext, wrapperVertex, sum);
@@ -39,6 +39,13 @@ namespace graphchi {
         public:
             virtual ~ischeduler() {} 
             virtual void add_task(vid_t vid) = 0;
+            /**
+             * Adds priority to a vertex. Schedulers without priorities
+             * just schedule the vertex.
+             */
+            virtual void add_task(vid_t vid, float priority) {
+                add_task(vid);
+            }
             virtual void remove_tasks(vid_t fromvertex, vid_t tovertex) = 0;
             virtual void add_task_to_all()  = 0;
             virtual bool is_scheduled(vid_t vertex) = 0;
@@ -53,6 +60,7 @@ namespace graphchi {
     public:
         non_scheduler() : nwarnings(0) {}
         virtual ~non_scheduler() {} 
+        using ischeduler::add_task;
         virtual void add_task(vid_t vid) {
             if (nwarnings++ % 10000 == 0) {
                 logstream(LOG_WARNING) << "Tried to add task to scheduler, but scheduling was not enabled!" << std::endl;
@@ -0,0 +1,201 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Per-thread reducers for aggregating values in update functions. Each
+ * thread adds to a slot of its own, padded to a cache line, so that the
+ * threads do not share cache lines. The slots are merged after the iteration.
+ * Register a reducer with graphchi_context::add_reducer() to have the engine
+ * reset it before each iteration and merge it before after_iteration():
+ *
+ *    sum_reducer<double> rmse;
+ *    void before_iteration(int iteration, graphchi_context &gcontext) {
+ *        gcontext.add_reducer(&rmse);
+ *    }
+ *    void update(...) { rmse.add(err * err); }
+ *    void after_iteration(int iteration, graphchi_context &gcontext) {
+ *        std::cout << sqrt(rmse.value() / n) << std::endl;
+ *    }
+ */
+
+#ifndef DEF_GRAPHCHI_REDUCERS
+#define DEF_GRAPHCHI_REDUCERS
+
+#include <assert.h>
+#include <omp.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#define REDUCER_CACHE_LINE 64
+
+namespace graphchi {
+
+    class ireducer {
+    public:
+        virtual ~ireducer() {}
+        /* Clears the slots of nthreads threads */
+        virtual void reset(int nthreads) = 0;
+        /* Combines the slots to the value */
+        virtual void merge() = 0;
+    };
+
+    template <typename T>
+    struct sum_op {
+        static inline void combine(T &a, const T &b) { a += b; }
+        static T identity() { return T(0); }
+    };
+
+    template <typename T>
+    struct min_op {
+        static inline void combine(T &a, const T &b) { if (b < a) a = b; }
+        static T identity() { return std::numeric_limits<T>::max(); }
+    };
+
+    template <typename T>
+    struct max_op {
+        static inline void combine(T &a, const T &b) { if (b > a) a = b; }
+        static T identity() {
+            return std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max();
+        }
+    };
+
+    /**
+     * Reduces values of type T with the operation Op.
+     */
+    template <typename T, typename Op>
+    class thread_reducer : public ireducer {
+        struct slot {
+            T value;
+            char padding[REDUCER_CACHE_LINE - sizeof(T) % REDUCER_CACHE_LINE];
+            slot() : value(Op::identity()) {}
+        };
+
+        std::vector<slot> slots;
+        T result;
+
+    public:
+        thread_reducer() : slots(omp_get_max_threads()), result(Op::identity()) {}
+
+        void reset(int nthreads) {
+            slots.assign(std::max(nthreads, 1), slot());
+            result = Op::identity();
+        }
+
+        /**
+         * Slot of the calling thread.
+         */
+        inline T & local() {
+            assert(omp_get_thread_num() < (int) slots.size());
+            return slots[omp_get_thread_num()].value;
+        }
+
+        inline void add(const T &x) {
+            Op::combine(local(), x);
+        }
+
+        void merge() {
+            result = Op::identity();
+            for(size_t i=0; i < slots.size(); i++) {
+                Op::combine(result, slots[i].value);
+            }
+        }
+
+        /**
+         * Value of the last merge.
+         */
+        T value() const {
+            return result;
+        }
+    };
+
+    template <typename T>
+    class sum_reducer : public thread_reducer<T, sum_op<T> > {};
+
+    template <typename T>
+    class min_reducer : public thread_reducer<T, min_op<T> > {};
+
+    template <typename T>
+    class max_reducer : public thread_reducer<T, max_op<T> > {};
+
+    class count_reducer : public thread_reducer<size_t, sum_op<size_t> > {
+    public:
+        inline void inc() {
+            local()++;
+        }
+    };
+
+    /**
+     * Element-wise sum of vectors of fixed length, for example histograms.
+     */
+    template <typename T>
+    class vector_reducer : public ireducer {
+        struct slot {
+            std::vector<T> value;
+            char padding[REDUCER_CACHE_LINE];
+        };
+
+        size_t length;
+        std::vector<slot> slots;
+        std::vector<T> result;
+
+    public:
+        vector_reducer(size_t length) : length(length), result(length, T(0)) {
+            reset(omp_get_max_threads());
+        }
+
+        void reset(int nthreads) {
+            slots.resize(std::max(nthreads, 1));
+            for(size_t i=0; i < slots.size(); i++) {
+                slots[i].value.assign(length, T(0));
+            }
+            result.assign(length, T(0));
+        }
+
+        inline std::vector<T> & local() {
+            assert(omp_get_thread_num() < (int) slots.size());
+            return slots[omp_get_thread_num()].value;
+        }
+
+        inline void add(size_t i, const T &x) {
+            local()[i] += x;
+        }
+
+        void merge() {
+            result.assign(length, T(0));
+            for(size_t i=0; i < slots.size(); i++) {
+                for(size_t j=0; j < length; j++) {
+                    result[j] += slots[i].value[j];
+                }
+            }
+        }
+
+        const std::vector<T> & value() const {
+            return result;
+        }
+    };
+
+}
+
+#endif
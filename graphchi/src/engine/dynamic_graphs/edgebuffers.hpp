@@ -30,8 +30,16 @@
 #define DEF_GRAPHCHI_EDGEBUFFERS
 
 #include <stdlib.h>
+#include <assert.h>
+#include <algorithm>
 #include <vector> 
 
+#include "util/pthread_tools.hpp"
+
+#ifdef SUPPORT_DELETIONS
+#include "shards/tombstones.hpp"
+#endif
+
 
 namespace graphchi {
     
@@ -46,23 +54,92 @@ namespace graphchi {
         EdgeDataType data;
         bool accounted_for_outc;
         bool accounted_for_inc;
+        bool deleted;
         created_edge(vid_t src, vid_t dst, EdgeDataType _data) : src(src), dst(dst), data(_data), accounted_for_outc(false),
-        accounted_for_inc(false) {}
+        accounted_for_inc(false), deleted(false) {}
     };
     
 #define EDGE_BUFFER_CHUNKSIZE 65536
     
     /**
      * Efficient chunked edge-buffer with very low memory-overhead (compared
-     * to just using a std-vector.
+     * to just using a std-vector. Chunks are never moved, so pointers to
+     * the edges stay valid while edges are added.
+     * Not thread-safe: writers and concurrent readers must hold the lock.
+     *
+     * The edges are indexed by source and by destination, so that the edges
+     * of a range of vertices can be found without scanning the whole buffer.
      */
     template <typename ET>
     class edge_buffer_flat {
         
+        /**
+         * Edge indices sorted by source or destination. The first nsorted are
+         * sorted; edges added after them form an unsorted tail, which is sorted
+         * and merged when it grows too long. Sorting is stable, so edges with the
+         * same key stay in the order they were added.
+         */
+        struct vertex_index {
+            std::vector<unsigned int> idx;
+            unsigned int nsorted;
+            
+            vertex_index() : nsorted(0) {}
+        };
+        
+        struct key_less {
+            edge_buffer_flat * buf;
+            bool bysrc;
+            key_less(edge_buffer_flat * buf, bool bysrc) : buf(buf), bysrc(bysrc) {}
+            bool operator()(unsigned int a, unsigned int b) const {
+                return buf->key(a, bysrc) < buf->key(b, bysrc);
+            }
+        };
+        
         unsigned int count;
         std::vector<created_edge<ET> *> bufs;
+        vertex_index by_src, by_dst;
+        
+        inline vid_t key(unsigned int i, bool bysrc) {
+            created_edge<ET> * e = (*this)[i];
+            return (bysrc ? e->src : e->dst);
+        }
+        
+        void merge_tail(vertex_index & index, bool bysrc) {
+            std::vector<unsigned int>::iterator mid = index.idx.begin() + index.nsorted;
+            std::stable_sort(mid, index.idx.end(), key_less(this, bysrc));
+            std::inplace_merge(index.idx.begin(), mid, index.idx.end(), key_less(this, bysrc));
+            index.nsorted = (unsigned int) index.idx.size();
+        }
+        
+        void find_range(vertex_index & index, bool bysrc, vid_t st, vid_t en, std::vector<unsigned int> & out) {
+            unsigned int tail = (unsigned int) index.idx.size() - index.nsorted;
+            if (tail > 1024 && tail > index.nsorted / 8) {
+                merge_tail(index, bysrc);
+            }
+            /* Binary search for the first edge with key >= st */
+            unsigned int lo = 0, hi = index.nsorted;
+            while(lo < hi) {
+                unsigned int mid = lo + (hi - lo) / 2;
+                if (key(index.idx[mid], bysrc) < st) lo = mid + 1;
+                else hi = mid;
+            }
+            size_t outst = out.size();
+            for(unsigned int j=lo; j < index.nsorted && key(index.idx[j], bysrc) <= en; j++) {
+                out.push_back(index.idx[j]);
+            }
+            size_t tailst = out.size();
+            for(unsigned int j=index.nsorted; j < (unsigned int) index.idx.size(); j++) {
+                vid_t k = key(index.idx[j], bysrc);
+                if (k >= st && k <= en) out.push_back(index.idx[j]);
+            }
+            if (out.size() > tailst) {
+                std::stable_sort(out.begin() + tailst, out.end(), key_less(this, bysrc));
+                std::inplace_merge(out.begin() + outst, out.begin() + tailst, out.end(), key_less(this, bysrc));
+            }
+        }
         
     public:    
+        mutex lock;
         
         edge_buffer_flat() : count(0) {
         }
@@ -72,11 +149,19 @@ namespace graphchi {
         }
         
         void clear() {
+#ifdef SUPPORT_DELETIONS
+            resolve_deletions();  // Before the chunks are freed and their addresses reused
+#endif
             for(int i=0; i< (int)bufs.size(); i++) {
+#ifdef SUPPORT_DELETIONS
+                assert_no_pending_deletions(bufs[i], EDGE_BUFFER_CHUNKSIZE * sizeof(created_edge<ET>));
+#endif
                 free(bufs[i]);
             }   
             bufs.clear();       
             count = 0;
+            by_src = vertex_index();
+            by_dst = vertex_index();
         }
         
         unsigned int size() {
@@ -98,6 +183,57 @@ namespace graphchi {
                 bufs.push_back((created_edge<ET>*)calloc(sizeof(created_edge<ET>), EDGE_BUFFER_CHUNKSIZE));
             }
             bufs[bufidx][idx % EDGE_BUFFER_CHUNKSIZE] = cedge;
+            by_src.idx.push_back(idx);
+            by_dst.idx.push_back(idx);
+        }
+        
+        /**
+         * Removes the first n edges added. The remaining edges are moved,
+         * so pointers to them are invalidated.
+         */
+        void remove_first(unsigned int n) {
+            assert(n <= count);
+            if (n == 0) return;
+            std::vector<created_edge<ET> > rest;
+            rest.reserve(count - n);
+            for(unsigned int i=n; i < count; i++) {
+                rest.push_back(*(*this)[i]);
+            }
+            clear();
+            for(size_t i=0; i < rest.size(); i++) {
+                add(rest[i]);
+            }
+        }
+
+#ifdef SUPPORT_DELETIONS
+        /**
+         * Marks the buffered edges deleted by the updates, see pending_edge_deletions().
+         */
+        void resolve_deletions() {
+            std::vector<size_t> offsets;
+            for(size_t b=0; b < bufs.size(); b++) {
+                offsets.clear();
+                pending_edge_deletions().take((const char *) bufs[b], EDGE_BUFFER_CHUNKSIZE * sizeof(created_edge<ET>), offsets);
+                for(size_t j=0; j < offsets.size(); j++) {
+                    bufs[b][offsets[j] / sizeof(created_edge<ET>)].deleted = true;
+                }
+            }
+        }
+#endif
+        
+        /**
+         * Appends to out the indices of the edges with source in [st, en], in
+         * the order of the source, and for the same source in the order they were added.
+         */
+        void find_by_src(vid_t st, vid_t en, std::vector<unsigned int> & out) {
+            find_range(by_src, true, st, en, out);
+        }
+        
+        /**
+         * Same as find_by_src(), but by destination.
+         */
+        void find_by_dst(vid_t st, vid_t en, std::vector<unsigned int> & out) {
+            find_range(by_dst, false, st, en, out);
         }
         
     private:
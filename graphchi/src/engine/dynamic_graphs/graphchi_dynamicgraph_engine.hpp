@@ -36,6 +36,7 @@
 
 #include "engine/graphchi_engine.hpp"
 #include "engine/dynamic_graphs/edgebuffers.hpp"
+#include "engine/dynamic_graphs/shard_compactor.hpp"
 #include "logger/logger.hpp"
 
 
@@ -55,7 +56,29 @@ namespace graphchi {
         graphchi_engine<VertexDataType, EdgeDataType, svertex_t>(base_filename, nshards, selective_scheduling, _m){
             _m.set("engine", "dynamicgraphs");
             added_edges = 0;
-            maxshardsize = 200 * 1024 * 1024;
+            last_commit = 0;
+            max_edge_buffer = 0;
+            maxshardsize = get_option_long("dyngraph.maxshardsize_mb", 200) * 1024 * 1024;
+            ingest_open = false;
+            ingest_closed = false;
+            committing = false;
+            engine_running = false;
+            executing_updates = false;
+            ingest_wait_metric = _m.register_metric("ingest_wait", TIME);
+            ingest_rejected_metric = _m.register_metric("ingest_rejected", INTEGER);
+            
+            compaction_horizon = get_option_int("dyngraph.compaction.horizon", 10);
+            compaction_buffer_weight = get_option_float("dyngraph.compaction.buffer_weight", 1.0f);
+            compaction_pressure = get_option_float("dyngraph.compaction.pressure", 0.5f);
+            compaction_merge_metric = _m.register_metric("compaction_merge", TIME);
+            compaction_swap_metric = _m.register_metric("compaction_swap", TIME);
+        }
+        
+        virtual ~graphchi_dynamicgraph_engine() {
+            if (!compactions.empty()) {
+                pthread_join(compaction_thread, NULL);
+                for(size_t i=0; i < compactions.size(); i++) delete compactions[i];
+            }
         }
         
     protected:
@@ -64,23 +87,48 @@ namespace graphchi {
          * Bookkeeping of buffered and deleted edges.
          */
         std::vector< std::vector< edge_buffer * > > new_edge_buffers;
-        std::vector<int> deletecounts;
         std::vector<std::string> shard_suffices;
         
         vid_t max_vertex_id;
         size_t max_edge_buffer;
         size_t last_commit;
-        size_t added_edges;
+        volatile size_t added_edges;
         std::string state;
         size_t maxshardsize;
         size_t edges_in_shards;
         size_t orig_edges;
         
         /**
-         * Concurrency control
+         * Concurrency control. Edges are appended to each buffer under the buffer's
+         * own lock, while holding the ingest lock for reading. Between iterations, compaction holds the
+         * ingest lock for writing, so it sees no concurrent additions.
          */
         mutex schedulerlock;
         mutex shardlock;
+        rwlock ingestlock;
+        
+        /* Producers wait on the condition until the buffers are ready and have room */
+        mutex ingest_mutex;
+        conditional ingest_cond;
+        bool ingest_open;    // Buffers have been initialized
+        bool ingest_closed;  // Last iteration has finished
+        bool committing;     // Compaction is pausing the producers
+        metric_handle ingest_wait_metric;
+        metric_handle ingest_rejected_metric;  // Edges not added by the engine's threads, as the buffers were full
+        
+        /* Callers of add_edges() on the engine's threads must not wait, see called_by_engine() */
+        bool engine_running;
+        pthread_t engine_thread;
+        volatile bool executing_updates;
+        
+        /* Compactions in progress, merged one by one in the background thread */
+        std::vector<shard_compactor<EdgeDataType> *> compactions;
+        pthread_t compaction_thread;
+        int compaction_horizon;
+        float compaction_buffer_weight;
+        float compaction_pressure;
+        metric_handle compaction_merge_metric;
+        metric_handle compaction_swap_metric;
         
         /** 
          * Preloading will interfere with the operation.
@@ -197,7 +245,15 @@ namespace graphchi {
                 std::string origblockname = filename_shard_edata_block(origfile, i, base_engine::blocksize);
                 std::string dstblockname = filename_shard_edata_block(dstfile, i, base_engine::blocksize);
                 cp(origblockname, dstblockname);
+                if (file_exists(filename_block_tombstones(origblockname))) {
+                    cp(filename_block_tombstones(origblockname), filename_block_tombstones(dstblockname));
+                } else {
+                    remove(filename_block_tombstones(dstblockname).c_str());
+                }
             }
+#ifdef SUPPORT_DELETIONS
+            edge_tombstone_registry().release(dstfile);
+#endif
         }
         
         
@@ -282,34 +338,32 @@ namespace graphchi {
             return this->nshards - 1; // Last shard
         }
         
-    public:       
-        bool add_edge(vid_t src, vid_t dst, EdgeDataType edata) {
-            if (src == dst) {
-                logstream(LOG_WARNING) << "WARNING : tried to add self-edge!" << std::endl;
-                return true;
-            }
-            if (this->iter < 1) {
-                logstream(LOG_WARNING) << "Tried to add edge before first iteration has passed" << std::endl;
-                usleep(1000000);
-                return false;
-            }
-            if (added_edges - last_commit > 1.2 * max_edge_buffer) {
-                logstream(LOG_INFO) << "Over 20% of max buffer... hold on...." << std::endl;
-                usleep(1000000); // Sleep 1 sec
-                return false;
-            }
+        /**
+         * Whether the caller is an update function, which runs in a parallel region
+         * of the engine, or a callback on the thread running the engine. The buffers
+         * are committed only between the iterations, so these callers cannot wait for room.
+         */
+        bool called_by_engine() {
+            if (engine_running && pthread_equal(pthread_self(), engine_thread)) return true;
+            return executing_updates && omp_get_level() > 0;
+        }
+        
+        void set_ingest_state(bool open, bool closed) {
+            ingest_mutex.lock();
+            ingest_open = open;
+            ingest_closed = closed;
+            ingest_cond.broadcast();
+            ingest_mutex.unlock();
+        }
+        
+        /**
+         * Extends the degree file and the scheduler to the new maximum vertex id.
+         */
+        void ensure_max_vertex_id(vid_t maxid) {
             this->modification_lock.lock();
-            added_edges++;
-            int shard = get_shard_for(dst);
-            int srcshard = get_shard_for(src);
-            /* Maintain max vertex id */
-            vid_t prev_max_id = max_vertex_id;
-            max_vertex_id = std::max(max_vertex_id, dst);
-            max_vertex_id = std::max(max_vertex_id, src);
-            
-            // Extend degree and vertex data files
-            if (max_vertex_id>prev_max_id) {
-                this->degree_handler->ensure_size(this->max_vertex_id); // Expand the file
+            if (maxid > max_vertex_id) {
+                max_vertex_id = maxid;
+                this->degree_handler->ensure_size(max_vertex_id); // Expand the file
                 
                 // Expand scheduler
                 if (this->scheduler != NULL) {
@@ -318,11 +372,106 @@ namespace graphchi {
                     schedulerlock.unlock();
                 }
             }
-            
-            // Add edge to buffers
-            new_edge_buffers[shard][srcshard]->add(src, dst, edata);            
             this->modification_lock.unlock();
-            return true;
+        }
+        
+    public:
+        /**
+         * Adds a batch of edges to the buffers. Can be called from several
+         * threads concurrently, also while the updates run. Edges are grouped
+         * by their buffer, so each buffer is locked once per batch.
+         * Producer threads block until the engine has initialized the buffers, and
+         * while the buffers are full until the engine has compacted them into the shards.
+         * Update functions and other callbacks of the engine must not block, as the
+         * buffers are compacted only after the iteration: for them, the call returns
+         * zero instead of waiting.
+         * Self-edges are ignored.
+         * @return number of edges added; zero if the engine has finished its last iteration,
+         *         or if called by the engine and the buffers are not ready or are full.
+         */
+        size_t add_edges(const created_edge<EdgeDataType> * edges, size_t n) {
+            bool nowait = called_by_engine();
+            metrics_timer wt = this->m.start_timer();
+            ingest_mutex.lock();
+            bool ready = false;
+            while(!ingest_closed) {
+                ready = ingest_open && !committing && added_edges - last_commit <= 1.2 * max_edge_buffer;
+                if (ready || nowait) break;
+                ingest_cond.wait(ingest_mutex);
+            }
+            bool closed = ingest_closed;
+            ingest_mutex.unlock();
+            if (!nowait) this->m.stop_timer(wt, ingest_wait_metric);
+            if (closed) {
+                logstream(LOG_WARNING) << "Tried to add edges after the last iteration." << std::endl;
+                return 0;
+            }
+            if (!ready) {
+                this->m.add(ingest_rejected_metric, (double) n);
+                return 0;
+            }
+            
+            /* Extending the vertex range takes the modification lock, so do it before
+               taking the ingest lock, which compaction takes while holding the modification lock. */
+            vid_t maxid = 0;
+            for(size_t i=0; i < n; i++) {
+                maxid = std::max(maxid, std::max(edges[i].src, edges[i].dst));
+            }
+            if (maxid > max_vertex_id) {
+                ensure_max_vertex_id(maxid);
+            }
+            
+            ingestlock.readlock();
+            int nbuffers = this->nshards * this->nshards;
+            std::vector<int> target(n);
+            std::vector<size_t> bufstart(nbuffers + 1, 0);
+            size_t nself = 0;
+            for(size_t i=0; i < n; i++) {
+                if (edges[i].src == edges[i].dst) {
+                    target[i] = -1;
+                    nself++;
+                    continue;
+                }
+                target[i] = get_shard_for(edges[i].dst) * this->nshards + get_shard_for(edges[i].src);
+                bufstart[target[i] + 1]++;
+            }
+            for(int b=0; b < nbuffers; b++) bufstart[b + 1] += bufstart[b];
+            std::vector<size_t> order(n - nself);
+            std::vector<size_t> pos(bufstart.begin(), bufstart.end() - 1);
+            for(size_t i=0; i < n; i++) {
+                if (target[i] >= 0) order[pos[target[i]]++] = i;
+            }
+            
+            for(int b=0; b < nbuffers; b++) {
+                if (bufstart[b] == bufstart[b + 1]) continue;
+                edge_buffer &buffer = *new_edge_buffers[b / this->nshards][b % this->nshards];
+                buffer.lock.lock();
+                for(size_t j=bufstart[b]; j < bufstart[b + 1]; j++) {
+                    const created_edge<EdgeDataType> &e = edges[order[j]];
+                    buffer.add(e.src, e.dst, e.data);
+                }
+                buffer.lock.unlock();
+            }
+            __sync_add_and_fetch(&added_edges, n - nself);
+            ingestlock.unlock();
+            
+            if (nself > 0) {
+                logstream(LOG_WARNING) << "WARNING : tried to add " << nself << " self-edges!" << std::endl;
+            }
+            return n - nself;
+        }
+        
+        /**
+         * Adds one edge, see add_edges(). In an update function, returns false
+         * if the buffers are full.
+         */
+        bool add_edge(vid_t src, vid_t dst, EdgeDataType edata) {
+            if (src == dst) {
+                logstream(LOG_WARNING) << "WARNING : tried to add self-edge!" << std::endl;
+                return true;
+            }
+            created_edge<EdgeDataType> edge(src, dst, edata);
+            return add_edges(&edge, 1) == 1;
         }
         
         void add_task(vid_t vid) {
@@ -334,15 +483,30 @@ namespace graphchi {
         }
        
     protected:
+        /**
+         * Adds the buffered edges to the vertices. Only edges whose degrees have been
+         * counted are added, because the edge arrays of the vertices were
+         * allocated by the degrees. Edges added after that are added in the next iteration.
+         */
         void incorporate_buffered_edges(int window, vid_t window_st, vid_t window_en, std::vector<svertex_t> & vertices) {
             // Lock acquired
             int ncreated = 0;
+            std::vector<unsigned int> found;
             // First outedges
             for(int shard=0; shard<this->nshards; shard++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->src >= window_st && edge->src <= window_en) {
+                buffer_for_window.lock.lock();
+                found.clear();
+                buffer_for_window.find_by_src(window_st, window_en, found);
+                for(size_t j=0; j < found.size(); j++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window[found[j]];
+                    if (edge->accounted_for_outc) {
+#ifdef SUPPORT_DELETIONS
+                        if (edge->deleted) {
+                            vertices[edge->src-window_st].deleted_outc++;
+                            continue;
+                        }
+#endif
                         if (vertices[edge->src-window_st].scheduled) {
                             if (vertices[edge->src-window_st].scheduled)
                                 vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
@@ -350,14 +514,24 @@ namespace graphchi {
                         }
                     }
                 }
+                buffer_for_window.lock.unlock();
             }
             
             // Then inedges
             for(int w=0; w<this->nshards; w++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->dst >= window_st && edge->dst <= window_en) {
+                buffer_for_window.lock.lock();
+                found.clear();
+                buffer_for_window.find_by_dst(window_st, window_en, found);
+                for(size_t j=0; j < found.size(); j++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window[found[j]];
+                    if (edge->accounted_for_inc) {
+#ifdef SUPPORT_DELETIONS
+                        if (edge->deleted) {
+                            vertices[edge->dst - window_st].deleted_inc++;
+                            continue;
+                        }
+#endif
                         if (vertices[edge->dst - window_st].scheduled) {
                             assert(edge->data < 1e20);
                             if (vertices[edge->dst-window_st].scheduled)
@@ -366,45 +540,51 @@ namespace graphchi {
                         }
                     }
                 }
+                buffer_for_window.lock.unlock();
             }
             logstream(LOG_INFO) << "::: Used " << ncreated << " buffered edges." << std::endl;
         }
         
         bool incorporate_new_edge_degrees(int window, vid_t window_st, vid_t window_en) {
             bool modified = false;
+            std::vector<unsigned int> found;
             // First outedges
             for(int shard=0; shard < this->nshards; shard++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->src >= window_st && edge->src <= window_en) {
-                        if (!edge->accounted_for_outc) {
-                            degree d = this->degree_handler->get_degree(edge->src);
-                            d.outdegree++;
-                            this->degree_handler->set_degree(edge->src, d);
-                            
-                            modified = true;
-                            edge->accounted_for_outc = true;
-                        }
+                buffer_for_window.lock.lock();
+                found.clear();
+                buffer_for_window.find_by_src(window_st, window_en, found);
+                for(size_t j=0; j < found.size(); j++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window[found[j]];
+                    if (!edge->accounted_for_outc) {
+                        degree d = this->degree_handler->get_degree(edge->src);
+                        d.outdegree++;
+                        this->degree_handler->set_degree(edge->src, d);
+                        
+                        modified = true;
+                        edge->accounted_for_outc = true;
                     }
                 }
+                buffer_for_window.lock.unlock();
             }
             
             // Then inedges
             for(int w=0; w < this->nshards; w++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->dst >= window_st && edge->dst <= window_en) {
-                        if (!edge->accounted_for_inc) {
-                            degree d = this->degree_handler->get_degree(edge->dst);
-                            d.indegree++;
-                            this->degree_handler->set_degree(edge->dst, d);                            
-                            edge->accounted_for_inc = true;
-                            modified = true;
-                        }
+                buffer_for_window.lock.lock();
+                found.clear();
+                buffer_for_window.find_by_dst(window_st, window_en, found);
+                for(size_t j=0; j < found.size(); j++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window[found[j]];
+                    if (!edge->accounted_for_inc) {
+                        degree d = this->degree_handler->get_degree(edge->dst);
+                        d.indegree++;
+                        this->degree_handler->set_degree(edge->dst, d);                            
+                        edge->accounted_for_inc = true;
+                        modified = true;
                     }
                 }
+                buffer_for_window.lock.unlock();
             }
             return modified;
         }
@@ -446,6 +626,11 @@ namespace graphchi {
                 int inc = deg.indegree;
                 int outc = deg.outdegree;
                 
+                /* Edges are loaded only for scheduled vertices */
+                if (this->scheduler != NULL && !this->scheduler->is_scheduled(fromvid + i)) {
+                    inc = outc = 0;
+                }
+                
                 // Raw data and object cost included
                 memreq += sizeof(svertex_t) + (sizeof(EdgeDataType) + sizeof(vid_t) + 
                                                sizeof(graphchi_edge<EdgeDataType>))*(outc + inc);
@@ -457,18 +642,27 @@ namespace graphchi {
         }
         
         
+        /* Graph may be modified while loading */
+        virtual bool pipelining_supported() {
+            return false;
+        }
+        
+        /* Graph may be modified during the iteration */
+        virtual bool interval_reordering_supported() {
+            return false;
+        }
+        
+        /* New edges are buffered and written to the shards between the intervals */
+        virtual bool inmemory_mode_supported() {
+            return false;
+        }
+        
         virtual void load_before_updates(std::vector<svertex_t> &vertices) {  
             state = "load-edges";
 
             this->base_engine::load_before_updates(vertices);
-            
-#ifdef SUPPORT_DELETIONS
-            for(unsigned int i=0; i < (unsigned int)vertices.size(); i++) {
-                deletecounts[this->exec_interval] += vertices[i].deleted_inc;
-            }
-        #endif
-            
             state = "execute-updates";
+            executing_updates = true;
         }
         
         
@@ -482,24 +676,30 @@ namespace graphchi {
             this->intervals[this->nshards - 1].second = max_vertex_id;
             this->vertex_data_handler->check_size(max_vertex_id + 1);
             initialize_sliding_shards();
-            
-            /* Deleted edge tracking */
-            deletecounts.clear();
-            for(int p=0; p < this->nshards; p++) 
-                deletecounts.push_back(0);
+            set_ingest_state(true, false);
         }
         
         virtual void iteration_finished() {
-            if (this->iter < this->niters - 1) {
-                // Flush and restart stream shards before commiting edges
-                for(int p=0; p < this->nshards; p++) {
-                    this->sliding_shards[p]->flush();
-                    this->sliding_shards[p]->set_offset(0, 0, 0);
-                }
-                
-                this->iomgr->wait_for_writes();
-                
-                commit_graph_changes();
+            bool last = !(this->iter < this->niters - 1);
+            state = "compaction";
+            pause_ingest();
+#ifdef SUPPORT_DELETIONS
+            for(int p=0; p < this->nshards; p++) {
+                for(int w=0; w < this->nshards; w++) new_edge_buffers[p][w]->resolve_deletions();
+            }
+#endif
+            if (!compactions.empty() && (compactions.back()->finished || last)) {
+                finish_compactions();
+            }
+            if (compactions.empty() && !last) {
+                std::vector<int> shards = choose_shards_to_compact();
+                if (!shards.empty()) start_compactions(shards);
+            }
+            resume_ingest();
+            
+            if (last) {
+                /* No more compactions: release producers waiting for room */
+                set_ingest_state(ingest_open, true);
             }
         }
         
@@ -511,11 +711,14 @@ namespace graphchi {
             
             this->vertex_data_handler->clear(this->num_vertices());
             orig_edges = 0;
+            engine_thread = pthread_self();
+            engine_running = true;
         }
         
         
         /* */
         virtual void load_after_updates(std::vector<svertex_t> &vertices) {
+            executing_updates = false;
             this->base_engine::load_after_updates(vertices);
             adjust_degrees_for_deleted(vertices, this->sub_interval_st);
         }   
@@ -528,418 +731,217 @@ namespace graphchi {
     protected:
         
         
-#define BBUF 32000000
-        
         /**
-         * Code for committing changes to disk.
+         * Shard compaction, see shard_compactor.hpp. The adjacency of the shards is
+         * merged with their buffered edges shard by shard in a background thread, while
+         * the updates continue. The new shards are swapped in between iterations.
          */
-        void commit_graph_changes() {            
-            // Count deleted
-            size_t ndeleted = 0;
-            for(size_t i=0; i < deletecounts.size(); i++) {
-                ndeleted += deletecounts[i];
-            }
-            
-            // TODO: remove ad hoc limits, move to configuration.
-            // Perhaps do some cost estimation?
-            logstream(LOG_DEBUG) << "Total deleted: " << ndeleted << " total edges: " << this->num_edges() << std::endl;
-
-            if (added_edges - last_commit < max_edge_buffer * 0.8 && ndeleted < this->num_edges() * 0.1) {
-                std::cout << "==============================" << std::endl;
-                std::cout << "No time to commit yet.... Only " << (added_edges - last_commit) << " / " << max_edge_buffer
-                << " in buffers" << std::endl;
-                return;
-            }
-            
-            
-            bool rangeschanged = false;
-            state = "commit-ingests";
-            vid_t maxwindow = 4000000; // FIXME: HARDCODE
-            size_t mem_budget = this->membudget_mb * 1024 * 1024;
+        
+        std::string dyngraph_adj_basename() {
+            return filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph";
+        }
+        
+        std::string dyngraph_edata_basename() {
+            return filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph";
+        }
+        
+        /* Stops new producers, and waits for the ones adding edges */
+        void pause_ingest() {
             this->modification_lock.lock();
+            ingest_mutex.lock();
+            committing = true;
+            ingest_mutex.unlock();
+            ingestlock.writelock();
+        }
+        
+        void resume_ingest() {
+            ingestlock.unlock();
+            ingest_mutex.lock();
+            committing = false;
+            ingest_cond.broadcast();
+            ingest_mutex.unlock();
+            this->modification_lock.unlock();
+        }
+        
+        /**
+         * Cost model: compacting a shard reads and writes all its edges once. Each
+         * iteration it saves decoding the deleted edges, and the memory and lookups of the
+         * buffered edges, weighted by dyngraph.compaction.buffer_weight. A shard is compacted
+         * if the savings over the next iterations (at most dyngraph.compaction.horizon)
+         * exceed the cost. When the buffers are filling up (dyngraph.compaction.pressure
+         * of max_edgebuffer_mb), the shards with at least the average number of buffered
+         * edges are compacted regardless of the cost.
+         * Costs are in edges, as all edges have the same size.
+         */
+        std::vector<int> choose_shards_to_compact() {
+            double horizon = (double) std::min(this->niters - this->iter - 1, compaction_horizon);
+            size_t nbuffered = num_buffered_edges();
+            bool pressure = nbuffered >= compaction_pressure * max_edge_buffer;
             
-            // Clean up sliding shards
-            // NOTE: there is a problem since this will waste
-            // io-sessions
-            std::vector<int> edgespershard;
+            std::vector<int> shards;
             for(int p=0; p < this->nshards; p++) {
-                edgespershard.push_back(this->sliding_shards[p]->num_edges());
-            }
-            
-            std::vector<std::pair<vid_t, vid_t> > newranges;
-            std::vector<std::string> newsuffices;
-            
-            char iterstr[128];
-            sprintf(iterstr, "%d", this->iter);
-            
-            size_t min_buffer_in_shard_to_commit = max_edge_buffer / this->nshards / 2;
-            
-            std::vector<bool> was_commited(this->nshards, true);
-            
-            for(int shard=0; shard < this->nshards; shard++) {
-                std::vector<edge_buffer*> &shard_buffer = new_edge_buffers[shard];
-                
-                // Check there are any new edges
                 size_t bufedges = 0;
                 for(int w=0; w < this->nshards; w++) {
-                    bufedges += shard_buffer[w]->size();
-                    
+                    bufedges += new_edge_buffers[p][w]->size();
                 }
-                
-                if (bufedges < min_buffer_in_shard_to_commit && deletecounts[shard] * 1.0 / edgespershard[shard] < 0.2) {
-                    logstream(LOG_DEBUG) << shard << ": not enough edges for shard: " << bufedges << " deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << std::endl;
-                    newranges.push_back(this->intervals[shard]);
-                    newsuffices.push_back(shard_suffices[shard]);
-                    was_commited[shard] = false;
-                    continue;
-                } else {
-                    logstream(LOG_DEBUG) << shard << ": going to rewrite, deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << " bufedges: " << bufedges << std::endl;
-                    shardlock.lock();
-                    delete this->sliding_shards[shard];
-                    this->sliding_shards[shard] = NULL;
-                    shardlock.unlock();
-                }
-                std::string origshardfile = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                std::string origadjfile = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                
-                // Get file size
-                off_t sz = get_shard_edata_filesize<EdgeDataType>(origshardfile);
-                
-                int outparts = ( sz >= (off_t) maxshardsize ? 2 : 1);
-                
-                vid_t splitpos = 0;
-                std::cout << "Size: " << sz << " vs. maxshardsize: " << maxshardsize << std::endl;
-                if (sz > (off_t)maxshardsize) {
-                    rangeschanged = true;
-                    // Compute number edges (not including ingested ones!)
-                    size_t halfedges = (sz / sizeof(EdgeDataType)) / 2;
-                    // Correct to include estimate of ingested ones
-                    for(int w=0; w < this->nshards; w++) {
-                        halfedges += new_edge_buffers[shard][w]->size() / 2;
-                    }
-                    size_t nedges = 0;
-                    
-                    vid_t st = this->intervals[shard].first;
-                    splitpos = st + (this->intervals[shard].second - st) / 2;
-                    bool found = false;
-                    while(st < this->intervals[shard].second) {
-                        vid_t en = std::min(st + maxwindow, this->intervals[shard].second);
-                        this->degree_handler->load(st, en);
-                        int nv = en - st + 1;
-                        
-                        for(int i=0; i<nv; i++) {
-                            nedges += this->degree_handler->get_degree(st + i).indegree;
-                            if (nedges >= halfedges) {
-                                splitpos = i+st-1;
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (found) break;
-                        st = en+1;
-                    }
-                    assert(splitpos > this->intervals[shard].first && splitpos < this->intervals[shard].second);
+                double savings = horizon * (num_deleted_edges(p) + compaction_buffer_weight * bufedges);
+                size_t edges = get_shard_edata_filesize<EdgeDataType>(dyngraph_edata_basename() + shard_suffices[p]) / sizeof(EdgeDataType);
+                double cost = 2.0 * (edges + bufedges);
+                if ((pressure && bufedges > 0 && bufedges * this->nshards >= nbuffered) || savings > cost) {
+                    shards.push_back(p);
                 }
-                
-                for(int splits=0; splits<outparts; splits++) { // Note: this is not super-efficient because we do the operation twice in case of split
-                    typename base_engine::slidingshard_t * curshard = 
-                    new typename base_engine::slidingshard_t(this->iomgr, origshardfile, origadjfile, 
-                                                             this->intervals[shard].first, this->intervals[shard].second, 
-                                                             base_engine::blocksize, this->m, true);
-                    
-                    
-                    std::string suffix = "";
-                    char partstr[128];
-                    sprintf(partstr, "%d", shard);
-                    if (splits == 0) {
-                        suffix = std::string(partstr);
-                    } else {
-                        suffix = std::string(partstr) + ".split";  
-                    }
-                    suffix = suffix + ".i" + std::string(iterstr);
-                    newsuffices.push_back(suffix);
-                    std::string outfile_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + suffix;
-                    std::string outfile_edata_dirname = dirname_shard_edata_block(outfile_edata, base_engine::blocksize);
-                    mkdir(outfile_edata_dirname.c_str(), 0777);
-                    std::string outfile_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + suffix;
-                    
-                    vid_t splitstart = this->intervals[shard].first;
-                    vid_t splitend = this->intervals[shard].second;
-                    if (shard == this->nshards - 1) splitend = max_vertex_id;
-                    
-                    // This is looking more and more hacky
-                    if (outparts == 2) {
-                        if (splits==0) splitend = splitpos;
-                        else splitstart = splitpos+1;
-                    }
-                    newranges.push_back(std::pair<vid_t,vid_t>(splitstart, splitend)); 
-                    
-                    // Create the adj file
-                    int f = open(outfile_adj.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    int err = ftruncate(f, 0);
-                    if (err != 0) {
-                        logstream(LOG_ERROR) << "Error truncating " << outfile_adj << ", error: " << strerror(errno) << std::endl;
-                    }
-                    assert(err == 0);
-                    /* Create edge data file */
-                    int ef = open(outfile_edata.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    err = ftruncate(ef, 0);
-                    if (err != 0) {
-                        logstream(LOG_ERROR) << "Error truncating " << outfile_edata << ", error: " << strerror(errno) << std::endl;
-                    }
-                    assert(err == 0);
-                    char * buf = (char*) malloc(BBUF); 
-                    char * bufptr = buf;
-                    char * ebuf = (char*) malloc(BBUF);
-                    char * ebufptr = ebuf;
-                    size_t tot_edatabytes = 0;
-                    
-                    // Now create a new shard file window by window
-                    for(int window=0; window < this->nshards; window++) {
-                        vid_t range_st = this->intervals[window].first;
-                        vid_t range_en = this->intervals[window].second;
-                        if (window == this->nshards - 1) range_en = max_vertex_id;
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
-                        
-                        for(vid_t window_st=range_st; window_st<range_en; ) {
-                            // Check how much we can read
-                            vid_t window_en = determine_next_window(window, window_st, 
-                                                                    std::min(range_en, window_st + (vid_t)maxwindow), mem_budget);
-                            // Create vertices
-                            int nvertices = window_en-window_st+1;
-                            std::vector< svertex_t > vertices(nvertices, svertex_t());
-                            /* Allocate edge data: to do this, need to compute sum of in & out edges */
-                            graphchi_edge<EdgeDataType> * edata = NULL;
-                            size_t num_edges=0;
-                            for(int i=0; i<nvertices; i++) {
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                num_edges += d.indegree+d.outdegree;
-                            }
-                            size_t ecounter = 0;
-                            edata = (graphchi_edge<EdgeDataType>*)malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
-                            for(int i=0; i<(int)nvertices; i++) {
-                                //  int inc = degrees[i].indegree;
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                int outc = d.outdegree;
-                                vertices[i] = svertex_t(window_st+i, &edata[ecounter], 
-                                                        &edata[ecounter+0], 0, outc);
-                                vertices[i].scheduled = true; // guarantee that shard will read it
-                                ecounter += 0 + outc;
-                            }
-                            
-                            // Read vertices in
-                            curshard->read_next_vertices(nvertices, window_st, vertices, false, true);
-                            
-                            // Incorporate buffered edges
-                            for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                                created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                                if (edge->src >= window_st && edge->src <= window_en) {
-                                    vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
-                                    
-                                }
-                            }
-                            this->iomgr->wait_for_reads();
-                            
-                            // If we are splitting, need to adjust counts
-                            std::vector<int> adjusted_counts(vertices.size(), 0);
-                            for(int iv=0; iv< (int)vertices.size(); iv++) adjusted_counts[iv] = vertices[iv].outc;
-                            
-                            if (outparts == 2) {
-                                // do actual counts by removing the edges not in this split
-                                for(int iv=0; iv< (int)vertices.size(); iv++) {
-                                    svertex_t &vertex = vertices[iv];
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (!(vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend)) {
-                                            adjusted_counts[iv]--;  
-                                        }
-                                    }
-                                }
-                            }   
-                            
-#ifdef SUPPORT_DELETIONS
-                            // Adjust counts to remove deleted edges
-                            for(int iv=0; iv< (int)vertices.size(); iv++) {
-                                svertex_t &vertex = vertices[iv];
-                                for(int i=0; i<vertex.outc; i++) {
-                                    if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
-                                        adjusted_counts[iv]--;  
-                                        assert(false);
-                                    }
-                                }
-                            }
-                            
-                            // Adjust degrees
-                            //   adjust_degrees_for_deleted(vertices, window_st); // Double counting problem, that is why commented out.
-#endif
-                            
-                            size_t ne = 0;
-                            for(vid_t curvid=window_st; curvid<=window_en;) {
-                                int iv = curvid - window_st;
-                                svertex_t &vertex = vertices[iv];
-                                int count = adjusted_counts[iv];                            
-                                if (count == 0) {
-                                    // Check how many next ones are zeros
-                                    int nz=0;
-                                    curvid++;
-                                    for(; curvid <= window_en && nz<254; curvid++) {
-                                        if (adjusted_counts[curvid - window_st] == 0) {
-                                            nz++;
-                                        } else {
-                                            break;
-                                        }
-                                    }
-                                    uint8_t nnz = (uint8_t)nz;
-                                    // Write zero
-                                    bwrite<uint8_t>(f, buf, bufptr, 0);
-                                    bwrite<uint8_t>(f, buf, bufptr, nnz);
-                                } else {
-                                    if (count < 255) {
-                                        uint8_t x = (uint8_t)count;
-                                        bwrite<uint8_t>(f, buf, bufptr, x);
-                                    } else {
-                                        bwrite<uint8_t>(f, buf, bufptr, 0xff);
-                                        bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
-                                    }
-                                    
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend) {
+            }
+            return shards;
+        }
+        
+        size_t num_deleted_edges(int p) {
 #ifdef SUPPORT_DELETIONS
-                                            if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
-                                                assert(false);
-                                                
-                                            } 
+            return get_edge_tombstones<EdgeDataType>(dyngraph_edata_basename() + shard_suffices[p], base_engine::blocksize)->num_deleted();
+#else
+            return 0;
 #endif
-                                            bwrite(f, buf, bufptr,  vertex.outedge(i)->vertexid);
-                                            bwrite_edata<EdgeDataType>(ebuf, ebufptr, vertex.outedge(i)->get_data(), tot_edatabytes, outfile_edata);
-                                            ne++;
-                                        } else assert(outparts == 2);
-                                    }
-                                    curvid++;
-                                }
-                            } 
-                            free(edata);
-                            window_st = window_en+1;
-                        }
-                        
-                    } // end window
-                    
-                    // Flush buffers
-                    writea(f, buf, bufptr-buf);
-                    
-                    edata_flush<EdgeDataType>(ebuf, ebufptr, outfile_edata, tot_edatabytes);
-                    
-                    // Write .size file for the edata firectory
-                    std::string sizefilename = outfile_edata + ".size";
-                    std::ofstream ofs(sizefilename.c_str());
-                    ofs << tot_edatabytes;
-                    ofs.close();
-
-                    // Release
-                    free(buf); 
-                    free(ebuf);
-                    
-                    delete curshard;
-                    close(f);
-                    close(ef);
-                    
-                    this->iomgr->wait_for_writes();
-                } // splits
+        }
+        
+        void start_compactions(std::vector<int> shards) {
+            for(size_t i=0; i < shards.size(); i++) {
+                int p = shards[i];
+                std::stringstream suffix;
+                suffix << p << ".i" << this->iter;
+                vid_t range_en = (p == this->nshards - 1 ? max_vertex_id : this->intervals[p].second);
+                shard_compactor<EdgeDataType> * compaction =
+                    new shard_compactor<EdgeDataType>(p, dyngraph_adj_basename(), dyngraph_edata_basename(),
+                                                      shard_suffices[p], suffix.str(), this->intervals[p].first, range_en,
+                                                      max_vertex_id, base_engine::blocksize, maxshardsize);
                 
-                // Delete old shard
-                std::string old_file_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];          
-                std::string old_file_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                std::string old_blockdir =  dirname_shard_edata_block(old_file_edata, base_engine::blocksize);
-
-                remove(old_file_adj.c_str());
-                remove(old_blockdir.c_str());
+                /* Snapshot of the buffered edges of the shard, without the deleted ones. The
+                   buffers of the source windows are in the order of the source. */
+                std::vector<unsigned int> found;
+                for(int w=0; w < this->nshards; w++) {
+                    edge_buffer &buffer_for_window = *new_edge_buffers[p][w];
+                    compaction->buffer_counts.push_back(buffer_for_window.size());
+                    found.clear();
+                    buffer_for_window.find_by_src(0, max_vertex_id, found);
+                    for(size_t j=0; j < found.size(); j++) {
+                        created_edge<EdgeDataType> * edge = buffer_for_window[found[j]];
+                        if (!edge->deleted) compaction->add_buffered_edge(edge);
+                    }
+                }
+                compaction->find_deleted_edges();
                 
-                std::string old_sizefilename = old_file_edata + ".size";
-                remove(old_sizefilename.c_str());
+                logstream(LOG_INFO) << "Compacting shard " << p << ": edges: " << compaction->num_edges() << " buffered: "
+                    << compaction->num_buffered_edges() << " deleted: " << compaction->num_deleted_edges() << std::endl;
+                compactions.push_back(compaction);
+            }
+            int ret = pthread_create(&compaction_thread, NULL, compaction_thread_loop, this);
+            assert(ret >= 0);
+        }
+        
+        static void * compaction_thread_loop(void * _engine) {
+            graphchi_dynamicgraph_engine * engine = (graphchi_dynamicgraph_engine *) _engine;
+            for(size_t i=0; i < engine->compactions.size(); i++) {
+                metrics_timer t = engine->m.start_timer();
+                engine->compactions[i]->merge_adjacency();
+                engine->m.stop_timer(t, engine->compaction_merge_metric);
             }
+            return NULL;
+        }
+        
+        /**
+         * Waits for the background merges, then writes the edge values of the
+         * new shards and replaces the old ones. Must be called between iterations.
+         */
+        void finish_compactions() {
+            metrics_timer t = this->m.start_timer();
+            pthread_join(compaction_thread, NULL);
             
-            // Clear buffers
-            for(int shard=0; shard < this->nshards; shard++) {
-                if (was_commited[shard]) {
-                    for (int win=0; win < this->nshards; win++) {
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][win];
-                        for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                            created_edge<EdgeDataType> * edge = buffer_for_window[ebi];                            
-                            if (!edge->accounted_for_outc) {
-                                std::cout << "Edge not accounted (out)! " << edge->src << " -- " << edge->dst << std::endl;
-                            }
-                            if (!edge->accounted_for_inc) {
-                                std::cout << "Edge not accounted (in)! " << edge->src << " -- " << edge->dst << std::endl;
-                            }
-                            
-                            assert(edge->accounted_for_inc);
-                            assert(edge->accounted_for_outc);
-                        }
-                        buffer_for_window.clear();
-                    }
+            shardlock.lock();
+            for(size_t i=0; i < compactions.size(); i++) {
+                int p = compactions[i]->shard;
+                delete this->sliding_shards[p];
+                this->sliding_shards[p] = NULL;
+            }
+            shardlock.unlock();
+            this->iomgr->wait_for_writes();
+            
+            /* The degrees of the buffered edges are normally counted by now, as the
+               engine has run at least one iteration since the snapshot. */
+            bool accounted = true;
+            for(size_t i=0; i < compactions.size(); i++) {
+                std::vector<created_edge<EdgeDataType> *> &edges = compactions[i]->buffered_edges();
+                for(size_t j=0; j < edges.size() && accounted; j++) {
+                    accounted = edges[j]->accounted_for_outc && edges[j]->accounted_for_inc;
                 }
             }
+            if (!accounted) account_buffered_degrees();
             
-            // Update number of shards:
-            last_commit = added_edges;
-            this->intervals = newranges;
-            shard_suffices = newsuffices;
-            this->nshards = (int) this->intervals.size();
+            for(size_t i=0; i < compactions.size(); i++) {
+                shard_compactor<EdgeDataType> * compaction = compactions[i];
+                compaction->copy_values();
+                int p = compaction->shard;
+                for(int w=0; w < this->nshards; w++) {
+                    new_edge_buffers[p][w]->remove_first(compaction->buffer_counts[w]);
+                    last_commit += compaction->buffer_counts[w];
+                }
+                compaction->remove_old_shard();
+            }
             
-            /* If the vertex intervals change, need to recreate the shard objects. */
+            /* Shards in decreasing order, so that splits do not change the indices of the rest */
+            bool rangeschanged = false;
+            for(int i=(int)compactions.size() - 1; i >= 0; i--) {
+                int p = compactions[i]->shard;
+                std::vector<compaction_part> &parts = compactions[i]->parts;
+                shard_suffices[p] = parts[0].suffix;
+                if (parts.size() == 2) {
+                    logstream(LOG_INFO) << "Split shard " << p << " at " << parts[0].range_en << std::endl;
+                    this->intervals[p] = std::pair<vid_t, vid_t>(parts[0].range_st, parts[0].range_en);
+                    this->intervals.insert(this->intervals.begin() + p + 1, std::pair<vid_t, vid_t>(parts[1].range_st, parts[1].range_en));
+                    shard_suffices.insert(shard_suffices.begin() + p + 1, parts[1].suffix);
+                    rangeschanged = true;
+                }
+                delete compactions[i];
+            }
+            compactions.clear();
+            
+            /* If the vertex intervals change, need to recreate the shard objects and buffers. */
             if (rangeschanged) {
+                this->nshards = (int) this->intervals.size();
                 shardlock.lock();
                 for (int i=0; i<(int)this->sliding_shards.size(); i++) {
                     if (this->sliding_shards[i] != NULL) delete this->sliding_shards[i];
                 }
                 this->sliding_shards.clear();
                 shardlock.unlock();
+                init_buffers();
             }
+            
             /* Write meta-file with the number of vertices */
             std::string numv_filename = base_engine::base_filename + ".numvertices";
             FILE * f = fopen(numv_filename.c_str(), "w");
             fprintf(f, "%lu\n", base_engine::num_vertices());
             fclose(f);
             
-            init_buffers();
-            this->modification_lock.unlock();
-        }
-        
-        
-        template <typename T>
-        void bwrite(int f, char * buf, char * &bufptr, T val) {
-            if (bufptr+sizeof(T)-buf>=BBUF) {
-                writea(f, buf, bufptr-buf);
-                bufptr = buf;
-            }
-            *((T*)bufptr) = val;
-            bufptr += sizeof(T);
+            this->m.stop_timer(t, compaction_swap_metric);
         }
         
-        
-        template <typename T>
-        void edata_flush(char * buf, char * bufptr, std::string & shard_filename, size_t totbytes) {
-            int blockid = (int) ((totbytes - sizeof(T)) / base_engine::blocksize);
-            int len = (int) (bufptr - buf);
-            assert(len <= (int)base_engine::blocksize);
-            
-            std::string block_filename = filename_shard_edata_block(shard_filename, blockid, base_engine::blocksize);
-            int f = open(block_filename.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-            write_compressed(f, buf, len);
-            close(f);
-        }
-        
-        template <typename T>
-        void bwrite_edata(char * buf, char * &bufptr, T val, size_t & totbytes, std::string & shard_filename) {            
-            if ((int) (bufptr + sizeof(T) - buf) > (int)base_engine::blocksize) {
-                edata_flush<T>(buf, bufptr, shard_filename, totbytes);
-                bufptr = buf;
+        /**
+         * Counts the degrees of all buffered edges not counted yet.
+         */
+        void account_buffered_degrees() {
+            vid_t maxwindow = 1000000;
+            for(int w=0; w < this->nshards; w++) {
+                vid_t range_en = (w == this->nshards - 1 ? max_vertex_id : this->intervals[w].second);
+                for(vid_t st=this->intervals[w].first; st <= range_en; ) {
+                    vid_t en = std::min(range_en, st + maxwindow - 1);
+                    this->degree_handler->load(st, en);
+                    if (incorporate_new_edge_degrees(w, st, en)) {
+                        this->degree_handler->save();
+                    }
+                    if (en == range_en) break;
+                    st = en + 1;
+                }
             }
-            totbytes += sizeof(T);
-            *((T*)bufptr) = val;
-            bufptr += sizeof(T);
         }
         
-
         
         /** 
           * HTTP admin
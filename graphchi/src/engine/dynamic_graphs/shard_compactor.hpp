@@ -0,0 +1,544 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Compaction of one shard of the dynamic graph engine: merges a snapshot of
+ * the buffered edges into the shard and drops the deleted edges. The shard is
+ * split in two by destination if it grows over the maximum size.
+ *
+ * Compaction has two phases. The adjacency files are immutable while the
+ * engine runs, so the new adjacency is merged in a background thread while the
+ * updates continue. The result is a plan, which tells for each edge of the new
+ * shard where its value comes from. Edge values are modified by the updates,
+ * so they are copied by the plan only when the engine swaps in the new shard
+ * between iterations. Copying is sequential block I/O without parsing the adjacency.
+ */
+
+#ifndef DEF_GRAPHCHI_SHARD_COMPACTOR
+#define DEF_GRAPHCHI_SHARD_COMPACTOR
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "api/chifilenames.hpp"
+#include "api/graph_objects.hpp"
+#include "engine/dynamic_graphs/edgebuffers.hpp"
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "shards/tombstones.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    /**
+     * Buffered edge in the snapshot of a compaction.
+     */
+    struct compaction_edge {
+        vid_t src, dst;
+        compaction_edge(vid_t src, vid_t dst) : src(src), dst(dst) {}
+    };
+
+    /**
+     * Run of consecutive edges of the new shard, whose values are
+     * consecutive old edges of the shard or consecutive snapshot edges.
+     */
+    struct compaction_segment {
+        bool buffered;
+        size_t first;
+        size_t len;
+
+        compaction_segment(bool buffered, size_t first) : buffered(buffered), first(first), len(1) {}
+    };
+
+    /**
+     * New shard written by a compaction.
+     */
+    struct compaction_part {
+        vid_t range_st, range_en;
+        std::string suffix;
+        std::string adjfile;
+        std::string edatafile;
+        size_t nedges;
+        std::vector<compaction_segment> plan;
+
+        /* Adjacency output */
+        int f;
+        std::vector<char> buf;
+        vid_t nextvid;
+
+        compaction_part() : range_st(0), range_en(0), nedges(0), f(-1), nextvid(0) {}
+
+        void add_edge(bool buffered, size_t idx) {
+            if (!plan.empty() && plan.back().buffered == buffered && plan.back().first + plan.back().len == idx) {
+                plan.back().len++;
+            } else {
+                plan.push_back(compaction_segment(buffered, idx));
+            }
+            nedges++;
+        }
+    };
+
+    /**
+     * Sequential reader of an adjacency file.
+     */
+    class adjacency_reader {
+        int f;
+        std::vector<char> buf;
+        size_t pos, len;
+
+        void fill() {
+            size_t rest = len - pos;
+            memmove(&buf[0], &buf[pos], rest);
+            ssize_t a = read(f, &buf[rest], buf.size() - rest);
+            assert(a >= 0);
+            len = rest + (size_t) a;
+            pos = 0;
+        }
+
+    public:
+        adjacency_reader(std::string filename, size_t bufsize = 16 * 1024 * 1024) : buf(bufsize), pos(0), len(0) {
+            f = open(filename.c_str(), O_RDONLY);
+            if (f < 0) {
+                logstream(LOG_FATAL) << "Could not open " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+        }
+
+        ~adjacency_reader() {
+            close(f);
+        }
+
+        bool done() {
+            if (pos == len) fill();
+            return pos == len;
+        }
+
+        template <typename T>
+        T read_val() {
+            if (pos + sizeof(T) > len) fill();
+            assert(pos + sizeof(T) <= len);
+            T val = *((T*) &buf[pos]);
+            pos += sizeof(T);
+            return val;
+        }
+    };
+
+    template <typename ET>
+    class shard_compactor {
+
+        std::string adjfile, edatafile;
+        std::string basename_adj, basename_edata, suffix;
+        vid_t range_st, range_en;
+        vid_t max_vertex_id;
+        size_t blocksize;
+        size_t maxshardsize;
+
+        /* Buffered edges to merge, sorted by source. The background
+           merge uses the copies of the endpoints. */
+        std::vector<compaction_edge> snapshot;
+        std::vector<created_edge<ET> *> buffered;
+
+        /* Sorted indices of deleted edges of the shard */
+        std::vector<size_t> deleted;
+
+    public:
+        int shard;
+        std::vector<compaction_part> parts;
+        volatile bool finished;
+
+        /**
+         * The files of the new shards are the basenames followed by the suffix,
+         * and the suffix + ".split" for the second half of a split.
+         */
+        shard_compactor(int shard, std::string basename_adj, std::string basename_edata, std::string oldsuffix, std::string suffix,
+                        vid_t range_st, vid_t range_en, vid_t max_vertex_id, size_t blocksize, size_t maxshardsize) :
+            adjfile(basename_adj + oldsuffix), edatafile(basename_edata + oldsuffix), basename_adj(basename_adj),
+            basename_edata(basename_edata), suffix(suffix), range_st(range_st), range_en(range_en), max_vertex_id(max_vertex_id),
+            blocksize(blocksize), maxshardsize(maxshardsize), shard(shard), finished(false) {}
+
+        /* Number of edges taken from each buffer of the shard */
+        std::vector<unsigned int> buffer_counts;
+
+        /**
+         * Adds a buffered edge to merge. Must be added in the order of the source.
+         * The edge must stay in the buffer until the values have been copied.
+         */
+        void add_buffered_edge(created_edge<ET> * edge) {
+            assert(snapshot.empty() || snapshot.back().src <= edge->src);
+            snapshot.push_back(compaction_edge(edge->src, edge->dst));
+            buffered.push_back(edge);
+        }
+
+        std::vector<created_edge<ET> *> & buffered_edges() {
+            return buffered;
+        }
+
+        size_t num_buffered_edges() {
+            return snapshot.size();
+        }
+
+        size_t num_deleted_edges() {
+            return deleted.size();
+        }
+
+        size_t num_edges() {
+            return get_shard_edata_filesize<ET>(edatafile) / sizeof(ET);
+        }
+
+        /**
+         * Finds the deleted edges of the shard from its tombstones. Must be called
+         * while the engine does not modify the shard.
+         */
+        void find_deleted_edges() {
+#ifdef SUPPORT_DELETIONS
+            deleted.clear();
+            get_edge_tombstones<ET>(edatafile, blocksize)->get_deleted(deleted);
+#endif
+        }
+
+        /**
+         * Merges the adjacency of the shard with the buffered edges, dropping the
+         * deleted edges, and writes the new adjacency files. Does not access the
+         * edge values, so can run while the engine is running.
+         */
+        void merge_adjacency() {
+            size_t total = num_edges() - deleted.size() + snapshot.size();
+            vid_t splitpos = range_en;
+            if (total * sizeof(ET) > maxshardsize) {
+                splitpos = find_split(total);
+            }
+
+            parts.resize(splitpos < range_en ? 2 : 1);
+            for(int i=0; i < (int) parts.size(); i++) {
+                compaction_part & part = parts[i];
+                part.range_st = (i == 0 ? range_st : splitpos + 1);
+                part.range_en = (i + 1 == (int) parts.size() ? range_en : splitpos);
+                part.suffix = (i == 0 ? suffix : suffix + ".split");
+                part.adjfile = basename_adj + part.suffix;
+                part.edatafile = basename_edata + part.suffix;
+                part.f = open(part.adjfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                if (part.f < 0) {
+                    logstream(LOG_FATAL) << "Could not create " << part.adjfile << " error: " << strerror(errno) << std::endl;
+                }
+                assert(part.f >= 0);
+            }
+
+            adjacency_reader reader(adjfile);
+            std::vector<vid_t> targets;
+            size_t oldidx = 0;
+            size_t nextdeleted = 0;
+            size_t s = 0;
+            vid_t vid = 0;
+            while(!reader.done()) {
+                uint8_t ns = reader.read_val<uint8_t>();
+                if (ns == 0x00) {
+                    uint8_t nz = reader.read_val<uint8_t>();
+                    vid += nz + 1;
+                    continue;
+                }
+                uint32_t n = (ns == 0xff ? reader.read_val<uint32_t>() : ns);
+                targets.resize(n);
+                for(uint32_t i=0; i < n; i++) targets[i] = reader.read_val<vid_t>();
+
+                /* Buffered edges of vertices before this one */
+                while(s < snapshot.size() && snapshot[s].src < vid) {
+                    s = merge_vertex(snapshot[s].src, NULL, 0, 0, nextdeleted, s);
+                }
+                s = merge_vertex(vid, &targets[0], n, oldidx, nextdeleted, s);
+                oldidx += n;
+                vid++;
+            }
+            assert(oldidx == num_edges());
+            while(s < snapshot.size()) {
+                s = merge_vertex(snapshot[s].src, NULL, 0, 0, nextdeleted, s);
+            }
+
+            for(int i=0; i < (int) parts.size(); i++) {
+                compaction_part & part = parts[i];
+                write_zeros(part, max_vertex_id + 1);
+                writea(part.f, &part.buf[0], part.buf.size());
+                close(part.f);
+                part.f = -1;
+                std::vector<char>().swap(part.buf);
+            }
+            finished = true;
+        }
+
+        /**
+         * Writes the edge values of the new shards, with the old values
+         * of the shard and the values of the buffered edges. Edges deleted
+         * after the snapshot are marked deleted in the new shards. Must be called
+         * while the engine does not modify the shard.
+         */
+        void copy_values() {
+            edge_value_reader reader(edatafile, blocksize);
+#ifdef SUPPORT_DELETIONS
+            edge_tombstones * oldtombstones = get_edge_tombstones<ET>(edatafile, blocksize);
+#endif
+            for(int i=0; i < (int) parts.size(); i++) {
+                compaction_part & part = parts[i];
+                std::string dirname = dirname_shard_edata_block(part.edatafile, blocksize);
+                mkdir(dirname.c_str(), 0777);
+
+                std::vector<ET> block;
+                block.reserve(blocksize / sizeof(ET));
+                int blockid = 0;
+                std::vector<size_t> newdeleted;
+                size_t pos = 0;
+                for(size_t j=0; j < part.plan.size(); j++) {
+                    compaction_segment & seg = part.plan[j];
+                    for(size_t k=0; k < seg.len; k++, pos++) {
+#ifdef SUPPORT_DELETIONS
+                        if (seg.buffered ? buffered[seg.first + k]->deleted : oldtombstones->is_deleted(seg.first + k)) {
+                            newdeleted.push_back(pos);
+                        }
+#endif
+                        block.push_back(seg.buffered ? buffered[seg.first + k]->data : reader.get(seg.first + k));
+                        if (block.size() * sizeof(ET) == blocksize) {
+                            write_block(part.edatafile, blockid++, block);
+                        }
+                    }
+                }
+                if (!block.empty()) write_block(part.edatafile, blockid++, block);
+
+                std::string sizefilename = part.edatafile + ".size";
+                std::ofstream ofs(sizefilename.c_str());
+                ofs << part.nedges * sizeof(ET);
+                ofs.close();
+                
+                edge_tombstone_registry().release(part.edatafile);
+                if (!newdeleted.empty()) {
+                    edge_tombstones * tombstones = get_edge_tombstones<ET>(part.edatafile, blocksize);
+                    for(size_t j=0; j < newdeleted.size(); j++) tombstones->set_deleted(newdeleted[j]);
+                    tombstones->save();
+                }
+            }
+        }
+
+        void remove_old_shard() {
+            remove_shard_files(adjfile, edatafile, blocksize);
+        }
+
+        /**
+         * Removes the adjacency and edge data files of a shard.
+         */
+        static void remove_shard_files(std::string adjfile, std::string edatafile, size_t blocksize) {
+            size_t edatasize = get_shard_edata_filesize<ET>(edatafile);
+            size_t nblocks = (edatasize + blocksize - 1) / blocksize;
+            for(size_t i=0; i < nblocks; i++) {
+                std::string blockname = filename_shard_edata_block(edatafile, (int) i, blocksize);
+                remove(blockname.c_str());
+                delete_block_tombstones(blockname);
+            }
+            remove(dirname_shard_edata_block(edatafile, blocksize).c_str());
+            edge_tombstone_registry().release(edatafile);
+            remove((edatafile + ".size").c_str());
+            remove(adjfile.c_str());
+        }
+
+    private:
+
+        /**
+         * Random access to the edge values of a shard, by reading one block at a time.
+         * Fast when the values are accessed in increasing order.
+         */
+        class edge_value_reader {
+            std::string edatafile;
+            size_t blocksize;
+            size_t edatasize;
+            int curblock;
+            std::vector<ET> block;
+
+        public:
+            edge_value_reader(std::string edatafile, size_t blocksize) : edatafile(edatafile), blocksize(blocksize), curblock(-1) {
+                edatasize = get_shard_edata_filesize<ET>(edatafile);
+                assert(blocksize % sizeof(ET) == 0);
+            }
+
+            ET get(size_t idx) {
+                size_t perblock = blocksize / sizeof(ET);
+                int blockid = (int) (idx / perblock);
+                if (blockid != curblock) {
+                    size_t len = std::min(blocksize, edatasize - blockid * blocksize);
+                    block.resize(len / sizeof(ET));
+                    std::string blockname = filename_shard_edata_block(edatafile, blockid, blocksize);
+                    int f = open(blockname.c_str(), O_RDONLY);
+                    if (f < 0) {
+                        logstream(LOG_FATAL) << "Could not open " << blockname << " error: " << strerror(errno) << std::endl;
+                    }
+                    assert(f >= 0);
+                    read_compressed(f, &block[0], len);
+                    close(f);
+                    curblock = blockid;
+                }
+                return block[idx % perblock];
+            }
+        };
+
+        void write_block(std::string edatafile, int blockid, std::vector<ET> & block) {
+            std::string blockname = filename_shard_edata_block(edatafile, blockid, blocksize);
+            int f = open(blockname.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            assert(f >= 0);
+            write_compressed(f, &block[0], block.size() * sizeof(ET));
+            close(f);
+            delete_block_tombstones(blockname);
+            block.clear();
+        }
+
+        /**
+         * Finds the destination that splits the edges of the shard in half. Counts the
+         * in-edges in a histogram of vertex ranges, so the split is approximate.
+         */
+        vid_t find_split(size_t total) {
+            uint64_t nvertices = (uint64_t) range_en - range_st + 1;
+            if (nvertices < 3) return range_en;
+            size_t nbuckets = (size_t) std::min(nvertices, (uint64_t) 65536);
+            std::vector<size_t> counts(nbuckets, 0);
+
+            adjacency_reader reader(adjfile);
+            while(!reader.done()) {
+                uint8_t ns = reader.read_val<uint8_t>();
+                if (ns == 0x00) {
+                    reader.read_val<uint8_t>();
+                    continue;
+                }
+                uint32_t n = (ns == 0xff ? reader.read_val<uint32_t>() : ns);
+                for(uint32_t i=0; i < n; i++) {
+                    vid_t dst = reader.read_val<vid_t>();
+                    counts[bucket(dst, nbuckets, nvertices)]++;
+                }
+            }
+            for(size_t i=0; i < snapshot.size(); i++) {
+                counts[bucket(snapshot[i].dst, nbuckets, nvertices)]++;
+            }
+
+            size_t acc = 0;
+            for(size_t b=0; b < nbuckets; b++) {
+                acc += counts[b];
+                if (acc >= total / 2) {
+                    vid_t splitpos = (vid_t) (range_st + (b + 1) * nvertices / nbuckets - 1);
+                    return std::max((vid_t) (range_st + 1), std::min(splitpos, (vid_t) (range_en - 1)));
+                }
+            }
+            return range_en;
+        }
+
+        /* The last shard may have edges to vertices added after the compaction started */
+        size_t bucket(vid_t dst, size_t nbuckets, uint64_t nvertices) {
+            return std::min(nbuckets - 1, (size_t) ((uint64_t) (dst - range_st) * nbuckets / nvertices));
+        }
+
+        /**
+         * Writes the edges of a vertex: the old edges not deleted, followed by the
+         * buffered edges of the vertex, starting from snapshot index s.
+         * @return index of the first snapshot edge of the next vertices
+         */
+        size_t merge_vertex(vid_t vid, vid_t * targets, uint32_t n, size_t oldidx, size_t & nextdeleted, size_t s) {
+            size_t send = s;
+            while(send < snapshot.size() && snapshot[send].src == vid) send++;
+
+            for(int i=0; i < (int) parts.size(); i++) {
+                compaction_part & part = parts[i];
+                uint32_t count = 0;
+                size_t nd = nextdeleted;
+                for(uint32_t j=0; j < n; j++) {
+                    if (nd < deleted.size() && deleted[nd] == oldidx + j) {
+                        nd++;
+                        continue;
+                    }
+                    if (in_part(part, targets[j])) count++;
+                }
+                for(size_t j=s; j < send; j++) {
+                    if (in_part(part, snapshot[j].dst)) count++;
+                }
+                if (count == 0) continue;
+
+                write_zeros(part, vid);
+                if (count < 255) {
+                    write_val<uint8_t>(part, (uint8_t) count);
+                } else {
+                    write_val<uint8_t>(part, 0xff);
+                    write_val<uint32_t>(part, count);
+                }
+                nd = nextdeleted;
+                for(uint32_t j=0; j < n; j++) {
+                    if (nd < deleted.size() && deleted[nd] == oldidx + j) {
+                        nd++;
+                        continue;
+                    }
+                    if (in_part(part, targets[j])) {
+                        write_val<vid_t>(part, targets[j]);
+                        part.add_edge(false, oldidx + j);
+                    }
+                }
+                for(size_t j=s; j < send; j++) {
+                    if (in_part(part, snapshot[j].dst)) {
+                        write_val<vid_t>(part, snapshot[j].dst);
+                        part.add_edge(true, j);
+                    }
+                }
+                part.nextvid = vid + 1;
+            }
+            while(nextdeleted < deleted.size() && deleted[nextdeleted] < oldidx + n) nextdeleted++;
+            return send;
+        }
+
+        bool in_part(compaction_part & part, vid_t dst) {
+            /* The last shard also gets the edges to vertices added after the compaction started */
+            return dst >= part.range_st && (dst <= part.range_en || &part == &parts.back());
+        }
+
+        /* Writes zero-counts for the vertices before vid */
+        void write_zeros(compaction_part & part, vid_t vid) {
+            while(part.nextvid < vid) {
+                vid_t nz = std::min((vid_t) 255, vid - part.nextvid);
+                write_val<uint8_t>(part, 0);
+                write_val<uint8_t>(part, (uint8_t) (nz - 1));
+                part.nextvid += nz;
+            }
+        }
+
+        template <typename T>
+        void write_val(compaction_part & part, T val) {
+            if (part.buf.size() + sizeof(T) > 16 * 1024 * 1024) {
+                writea(part.f, &part.buf[0], part.buf.size());
+                part.buf.clear();
+            }
+            const char * p = (const char *) &val;
+            part.buf.insert(part.buf.end(), p, p + sizeof(T));
+        }
+    };
+
+}
+
+#endif
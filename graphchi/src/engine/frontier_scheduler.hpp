@@ -0,0 +1,252 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Frontier scheduler. Like the bitset scheduler, keeps a bit per vertex, but
+ * also counts the scheduled vertices of each range of 2^FRONTIER_RANGE_BITS
+ * vertices, so that the engine can skip intervals and windows without
+ * scheduled vertices without testing their bits. While the frontier is
+ * small, the scheduled vertices are also kept in a queue, so they can be
+ * listed without scanning the bitset. When the queue overflows, the scheduler
+ * switches to the dense mode where the bitset is scanned, and back to the
+ * sparse mode when enough tasks have been removed.
+ */
+
+#ifndef DEF_GRAPHCHI_FRONTIERSCHEDULER
+#define DEF_GRAPHCHI_FRONTIERSCHEDULER
+
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "api/ischeduler.hpp"
+#include "util/dense_bitset.hpp"
+
+#define FRONTIER_RANGE_BITS 12
+
+namespace graphchi {
+
+    class frontier_scheduler : public ischeduler {
+    private:
+        dense_bitset bitset;
+        vid_t nvertices;
+
+        /* Number of scheduled vertices in each range */
+        std::vector<uint32_t> rangecounts;
+
+        /* Sparse mode: vertices scheduled since the queue was built. May contain
+           vertices that have been removed since, and duplicates. */
+        std::vector<vid_t> queue;
+        volatile size_t nqueued;
+
+        void set_size(vid_t n) {
+            nvertices = n;
+            rangecounts.resize(((size_t)n >> FRONTIER_RANGE_BITS) + 1, 0);
+            /* Listing the bitset reads one word for 64 vertices, so a larger
+               queue would not be faster. */
+            queue.resize(std::max((size_t)1024, (size_t)n / 64));
+        }
+
+        inline vid_t range_start(size_t r) const {
+            return (vid_t) (r << FRONTIER_RANGE_BITS);
+        }
+
+        inline vid_t range_end(size_t r) const {
+            return (vid_t) std::min((size_t)nvertices - 1, ((r + 1) << FRONTIER_RANGE_BITS) - 1);
+        }
+
+        /* Builds the queue from the bitset, skipping empty ranges. */
+        void rebuild_queue() {
+            std::vector<vid_t> tasks;
+            tasks.reserve(queue.size());
+            get_tasks(0, nvertices - 1, tasks, true);
+            assert(tasks.size() <= queue.size());
+            std::copy(tasks.begin(), tasks.end(), queue.begin());
+            nqueued = tasks.size();
+        }
+
+    public:
+        bool has_new_tasks;
+
+        frontier_scheduler(vid_t nvertices) : bitset(nvertices), nqueued(0), has_new_tasks(false) {
+            set_size(nvertices);
+        }
+
+        virtual ~frontier_scheduler() {}
+
+        using ischeduler::add_task;
+
+        inline void add_task(vid_t vertex) {
+            if (!bitset.set_bit(vertex)) {
+                __sync_add_and_fetch(&rangecounts[vertex >> FRONTIER_RANGE_BITS], 1);
+                size_t pos = __sync_fetch_and_add(&nqueued, 1);
+                if (pos < queue.size()) queue[pos] = vertex;
+            }
+            has_new_tasks = true;
+        }
+
+        /**
+         * Extends the scheduler to new vertices, which are not scheduled.
+         */
+        virtual void resize(vid_t maxsize) {
+            assert(maxsize >= nvertices);
+            bool sparse = is_sparse();
+            bitset.resize(maxsize);
+            set_size(maxsize);
+            if (!sparse) nqueued = queue.size() + 1;
+        }
+
+        inline bool is_scheduled(vid_t vertex) {
+            return bitset.get(vertex);
+        }
+
+        inline void remove_task(vid_t vertex) {
+            if (bitset.clear_bit(vertex)) {
+                __sync_sub_and_fetch(&rangecounts[vertex >> FRONTIER_RANGE_BITS], 1);
+            }
+        }
+
+        /**
+         * Removes the tasks of vertices fromvertex..tovertex (inclusive). Must not be
+         * called concurrently with add_task().
+         */
+        virtual void remove_tasks(vid_t fromvertex, vid_t tovertex) {
+            if (nvertices == 0 || fromvertex >= nvertices) return;
+            tovertex = std::min(tovertex, nvertices - 1);
+            for(size_t r = fromvertex >> FRONTIER_RANGE_BITS; r <= (tovertex >> FRONTIER_RANGE_BITS); r++) {
+                if (rangecounts[r] == 0) continue;
+                vid_t st = std::max(fromvertex, range_start(r)), en = std::min(tovertex, range_end(r));
+                if (st == range_start(r) && en == range_end(r)) {
+                    rangecounts[r] = 0;
+                } else {
+                    rangecounts[r] -= (uint32_t) bitset.count_bits(st, en);
+                }
+            }
+            bitset.clear_bits(fromvertex, tovertex);
+
+            if (is_sparse()) {
+                /* Drop the removed vertices from the queue */
+                size_t n = 0;
+                for(size_t i=0; i < nqueued; i++) {
+                    if (bitset.get(queue[i])) queue[n++] = queue[i];
+                }
+                nqueued = n;
+            } else if (num_tasks() <= queue.size() / 2) {
+                rebuild_queue();
+            }
+        }
+
+        void add_task_to_all() {
+            has_new_tasks = true;
+            bitset.setall();
+            if (nvertices == 0) return;
+            bitset.clear_bits(nvertices, (vid_t) (((size_t)nvertices / 64 + 1) * 64 - 1));
+            for(size_t r=0; r < rangecounts.size(); r++) {
+                rangecounts[r] = (uint32_t) (range_end(r) - range_start(r) + 1);
+            }
+            nqueued = queue.size() + 1;
+        }
+
+        /**
+         * Returns true if the scheduled vertices are listed from the queue.
+         */
+        bool is_sparse() const {
+            return nqueued <= queue.size();
+        }
+
+        /**
+         * Number of vertices scheduled in fromvertex..tovertex (inclusive).
+         */
+        size_t num_tasks(vid_t fromvertex, vid_t tovertex) const {
+            if (nvertices == 0 || fromvertex >= nvertices) return 0;
+            tovertex = std::min(tovertex, nvertices - 1);
+            size_t count = 0;
+            for(size_t r = fromvertex >> FRONTIER_RANGE_BITS; r <= (tovertex >> FRONTIER_RANGE_BITS); r++) {
+                if (rangecounts[r] == 0) continue;
+                vid_t st = std::max(fromvertex, range_start(r)), en = std::min(tovertex, range_end(r));
+                if (st == range_start(r) && en == range_end(r)) {
+                    count += rangecounts[r];
+                } else {
+                    count += bitset.count_bits(st, en);
+                }
+            }
+            return count;
+        }
+
+        size_t num_tasks() const {
+            size_t count = 0;
+            for(size_t r=0; r < rangecounts.size(); r++) count += rangecounts[r];
+            return count;
+        }
+
+        /**
+         * Finds the first vertex scheduled in fromvertex..tovertex (inclusive).
+         * @return false if none is scheduled
+         */
+        bool first_task(vid_t fromvertex, vid_t tovertex, vid_t &vertex) const {
+            if (nvertices == 0 || fromvertex >= nvertices) return false;
+            tovertex = std::min(tovertex, nvertices - 1);
+            std::vector<vid_t> tasks;
+            for(size_t r = fromvertex >> FRONTIER_RANGE_BITS; r <= (tovertex >> FRONTIER_RANGE_BITS); r++) {
+                if (rangecounts[r] == 0) continue;
+                bitset.get_set_bits(std::max(fromvertex, range_start(r)), std::min(tovertex, range_end(r)), tasks);
+                if (!tasks.empty()) {
+                    vertex = tasks[0];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Appends the vertices scheduled in fromvertex..tovertex (inclusive) to out,
+         * in increasing order. Must not be called concurrently with add_task().
+         * @param dense if true, scans the bitset even in the sparse mode
+         */
+        void get_tasks(vid_t fromvertex, vid_t tovertex, std::vector<vid_t> &out, bool dense=false) const {
+            if (nvertices == 0 || fromvertex >= nvertices) return;
+            tovertex = std::min(tovertex, nvertices - 1);
+            if (is_sparse() && !dense) {
+                size_t first = out.size();
+                for(size_t i=0; i < nqueued; i++) {
+                    vid_t v = queue[i];
+                    if (v >= fromvertex && v <= tovertex && bitset.get(v)) out.push_back(v);
+                }
+                std::sort(out.begin() + first, out.end());
+                out.erase(std::unique(out.begin() + first, out.end()), out.end());
+            } else {
+                for(size_t r = fromvertex >> FRONTIER_RANGE_BITS; r <= (tovertex >> FRONTIER_RANGE_BITS); r++) {
+                    if (rangecounts[r] == 0) continue;
+                    bitset.get_set_bits(std::max(fromvertex, range_start(r)), std::min(tovertex, range_end(r)), out);
+                }
+            }
+        }
+    };
+
+}
+
+
+#endif
+
@@ -46,6 +46,16 @@ namespace graphchi {
         }
         
     protected:
+        /* Override - out-edges are loaded after the updates */
+        virtual bool pipelining_supported() {
+            return false;
+        }
+        
+        /* Override - in-edges are gathered and out-edges broadcast on every iteration */
+        virtual bool inmemory_mode_supported() {
+            return false;
+        }
+        
         /* Override - load only memory shard (i.e inedges) */
         virtual void load_before_updates(std::vector<fvertex_t> &vertices) {
             logstream(LOG_DEBUG) << "Processing in-edges." << std::endl;
@@ -0,0 +1,241 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Two-phase engine for the unweighted functional API. The functional engine
+ * reads the in-edges of a sub-interval from the memory shard, and after the
+ * updates streams every sliding shard to write the new values to the out-edges.
+ * With unweighted kernels, the value of an edge is a function of the value of
+ * its source only, so this engine does not store it at all:
+ *
+ *  - pull: the in-edges of the sub-interval are read from the adjacency of the
+ *    memory shard, and the value of each edge is computed from the message
+ *    of its source (value_to_neighbor()) and gathered to the vertex;
+ *  - push: after the updates, the new values of the sub-interval are written
+ *    to a dense message buffer, one message per vertex.
+ *
+ * So each shard is read once per iteration, and its edge data not at all. The
+ * message buffer holds the latest values in the semi-synchronous model, and the
+ * values of the previous iteration in the bulk-synchronous model, where the
+ * new values are written to a second buffer.
+ *
+ * If the kernel declares its gather_op (see functional_kernel), the push phase
+ * stores only the value sent to the neighbors, one edge value per vertex, and the
+ * pull phase decodes the in-edges of the sub-interval to contiguous neighbor
+ * arrays (memory_shard::load_csr()) and reduces them with functional_gather.
+ * As the adjacency does not change, the arrays of all sub-intervals are kept
+ * after the first iteration if they fit in the memory budget (option "inmemory"),
+ * and the following iterations do not read the shards.
+ */
+
+
+#ifndef GRAPHCHI_FUNCTIONALPULLPUSHENGINE_DEF
+#define GRAPHCHI_FUNCTIONALPULLPUSHENGINE_DEF
+
+#include <map>
+#include <vector>
+
+#include "api/csr_vertex.hpp"
+#include "api/functional/functional_defs.hpp"
+#include "engine/functional/functional_engine.hpp"
+#include "logger/logger.hpp"
+
+namespace graphchi {
+
+    template <typename VertexDataType, typename EdgeDataType, typename fvertex_t>
+    class functional_pullpush_engine : public functional_engine<VertexDataType, EdgeDataType, fvertex_t> {
+
+        typedef functional_engine<VertexDataType, EdgeDataType, fvertex_t> base_engine;
+        typedef typename fvertex_t::kernel_t kernel_t;
+        typedef typename kernel_t::EdgeDataType message_t;
+        typedef functional_gather<typename kernel_t::gather_op> gather_t;
+
+        /* Messages read by the pull phase, and written by the push phase in the bulk-synchronous model */
+        std::vector<functional_message<VertexDataType> > messages;
+        std::vector<functional_message<VertexDataType> > next_messages;
+        
+        /* Vectorized gather: the values sent to the neighbors, and the in-edges of the sub-interval */
+        std::vector<message_t> values;
+        std::vector<message_t> next_values;
+        csr_adjacency<EdgeDataType> csr;
+        
+        /* In-edges of each sub-interval by its first vertex, if kept over the iterations */
+        bool cache_inedges;
+        std::map<vid_t, csr_adjacency<EdgeDataType> *> inedge_cache;
+
+        /* Context of the previous iteration, for the messages sent then */
+        graphchi_context prevcontext;
+
+    public:
+        functional_pullpush_engine(std::string base_filename, int nshards, bool selective_scheduling, metrics &_m) :
+        base_engine(base_filename, nshards, selective_scheduling, _m), cache_inedges(false) {
+            _m.set("engine", "functional-pullpush");
+
+            /* Edges are neither read nor written. The updates only write the value of
+               the vertex, so they can be run in parallel. */
+            this->set_only_adjacency(true);
+            this->set_modifies_inedges(false);
+            this->set_modifies_outedges(false);
+            this->set_enable_deterministic_parallelism(false);
+        }
+        
+        virtual ~functional_pullpush_engine() {
+            typename std::map<vid_t, csr_adjacency<EdgeDataType> *>::iterator it;
+            for(it = inedge_cache.begin(); it != inedge_cache.end(); ++it) {
+                delete it->second;
+            }
+        }
+
+    protected:
+        
+        /**
+         * Memory needed to keep the in-edges of all sub-intervals: the neighbor ids,
+         * at most the size of the adjacency files, and the offsets of the vertices.
+         */
+        size_t inedge_cache_bytes() {
+            size_t adjbytes = 0;
+            for(int p=0; p < this->nshards; p++) {
+                adjbytes += get_filesize(filename_shard_adj(this->base_filename, p, this->nshards));
+            }
+            return adjbytes + this->num_vertices() * 3 * sizeof(size_t);
+        }
+        
+        /* In-edges of the sub-interval, from the cache or decoded from the memory shard */
+        csr_adjacency<EdgeDataType> * load_inedges() {
+            vid_t st = this->sub_interval_st;
+            typename std::map<vid_t, csr_adjacency<EdgeDataType> *>::iterator it = inedge_cache.find(st);
+            if (it != inedge_cache.end()) {
+                if (it->second->window_en == this->sub_interval_en) return it->second;
+                delete it->second;
+                inedge_cache.erase(it);
+            }
+            csr_adjacency<EdgeDataType> * adj = &csr;
+            if (cache_inedges) {
+                adj = new csr_adjacency<EdgeDataType>();
+                inedge_cache[st] = adj;
+            }
+            if (!this->memoryshard->loaded()) {
+                this->memoryshard->load();
+            }
+            this->memoryshard->load_csr(st, this->sub_interval_en, *adj, true, false);
+            return adj;
+        }
+
+        virtual void initialize_before_run() {
+            base_engine::initialize_before_run();
+            if (gather_t::vectorized) {
+                values.resize(this->num_vertices());
+                if (fvertex_t::bulk_synchronous()) {
+                    next_values.resize(this->num_vertices());
+                }
+                cache_inedges = this->enable_inmemory_mode &&
+                    inedge_cache_bytes() <= size_t(this->membudget_mb) * 1024 * 1024;
+                logstream(LOG_INFO) << "In-edges " << (cache_inedges ? "kept in memory" : "read on every iteration") << std::endl;
+            } else {
+                messages.resize(this->num_vertices());
+                if (fvertex_t::bulk_synchronous()) {
+                    next_messages.resize(this->num_vertices());
+                }
+            }
+        }
+        
+        /* Override - with a vectorized gather, reduce the in-edges here instead of in add_inedge() */
+        virtual void load_before_updates(std::vector<fvertex_t> &vertices) {
+            if (!gather_t::vectorized) {
+                base_engine::load_before_updates(vertices);
+                return;
+            }
+            this->vertex_data_handler->load(this->sub_interval_st, this->sub_interval_en);
+            
+            /* Nothing is gathered on the first iteration */
+            if (this->chicontext.iteration > 0) {
+                csr_adjacency<EdgeDataType> * adj = load_inedges();
+                const message_t * nbvalues = &values[0];
+                this->m.start_time("functional_gather");
+#pragma omp parallel for schedule(dynamic, 1024)
+                for(int i=0; i < (int)vertices.size(); i++) {
+                    if (!vertices[i].scheduled) continue;
+                    csr_vertex<EdgeDataType> cv = adj->vertex(this->sub_interval_st + i);
+                    vertices[i].cumval = gather_t::reduce((message_t) vertices[i].cumval, nbvalues,
+                                                          cv.in_neighbors(), cv.num_inedges());
+                }
+                this->m.stop_time("functional_gather", false);
+            }
+            this->iomgr->wait_for_reads();
+        }
+
+        /* Override - gather from the messages */
+        virtual void init_vertices(std::vector<fvertex_t> &vertices, graphchi_edge<EdgeDataType> * &e) {
+            base_engine::init_vertices(vertices, e);
+            if (gather_t::vectorized) return;
+            prevcontext = this->chicontext;
+            prevcontext.iteration = this->chicontext.iteration - 1;
+            for(int i=0; i < (int)vertices.size(); i++) {
+                vertices[i].messages = &messages[0];
+                vertices[i].prevcontext = &prevcontext;
+            }
+        }
+
+        /* Override - push the new values instead of writing them to the out-edges */
+        virtual void load_after_updates(std::vector<fvertex_t> &vertices) {
+            logstream(LOG_DEBUG) << "Pushing the new values." << std::endl;
+            if (gather_t::vectorized) {
+                std::vector<message_t> &outvalues = (fvertex_t::bulk_synchronous() ? next_values : values);
+#pragma omp parallel for
+                for(int i=0; i < (int)vertices.size(); i++) {
+                    fvertex_t &v = vertices[i];
+                    if (!v.scheduled) continue;
+                    outvalues[v.id()] = v.kernel.value_to_neighbor(this->chicontext, v.vinfo, v.id(), v.get_data());
+                }
+                return;
+            }
+            std::vector<functional_message<VertexDataType> > &out = (fvertex_t::bulk_synchronous() ? next_messages : messages);
+            int iteration = this->chicontext.iteration;
+#pragma omp parallel for
+            for(int i=0; i < (int)vertices.size(); i++) {
+                fvertex_t &v = vertices[i];
+                if (!v.scheduled) continue;
+                functional_message<VertexDataType> &msg = out[v.id()];
+                msg.info = v.vinfo;
+                msg.iteration = iteration;
+                msg.value = v.get_data();
+            }
+        }
+
+        virtual void iteration_finished() {
+            base_engine::iteration_finished();
+            if (fvertex_t::bulk_synchronous()) {
+                messages.swap(next_messages);
+                values.swap(next_values);
+            }
+        }
+
+    }; // End class
+
+}; // End namespace
+
+
+#endif
+
+
@@ -47,12 +47,15 @@
 #include "api/graphchi_program.hpp"
 #include "engine/auxdata/degree_data.hpp"
 #include "engine/auxdata/vertex_data.hpp"
-#include "engine/bitset_scheduler.hpp"
+#include "engine/frontier_scheduler.hpp"
+#include "engine/priority_scheduler.hpp"
+#include "engine/work_partitioner.hpp"
 #include "io/stripedio.hpp"
 #include "logger/logger.hpp"
 #include "metrics/metrics.hpp"
 #include "shards/memoryshard.hpp"
 #include "shards/slidingshard.hpp"
+#include "util/memory_arena.hpp"
 #include "util/pthread_tools.hpp"
 
 
@@ -81,21 +84,28 @@ namespace graphchi {
         /* Auxilliary data handlers */
         degree_data * degree_handler;
         vertex_data_store<VertexDataType> * vertex_data_handler;
+        vertex_data_store<VertexDataType> * prefetch_vertex_data_handler; // Second buffer for pipelining
         
         /* Computational context */
         graphchi_context chicontext;
         
         /* Scheduler */
-        bitset_scheduler * scheduler;
+        frontier_scheduler * scheduler;
+        priority_scheduler * prio_scheduler;  // Same as scheduler, if priorities are used
         
         /* Configuration */
         bool modifies_outedges;
         bool modifies_inedges;
         bool only_adjacency;
         bool use_selective_scheduling;
+        bool use_priorities;
+        float priority_threshold;
         bool enable_deterministic_parallelism;
         bool store_inedges;
         bool disable_vertexdata_storage;
+        bool enable_pipelining;
+        bool enable_inmemory_mode;
+        int checkpoint_interval;
         bool preload_commit; //alow storing of modified edge data on preloaded data into memory
 
         size_t blocksize;
@@ -121,6 +131,54 @@ namespace graphchi {
         /* Metrics */
         metrics &m;
         
+        /**
+         * Sub-interval with its vertices and edges loaded. When pipelining,
+         * the next sub-interval is loaded into a second buffer while the
+         * updates of the current one are executed. The vertex vector and
+         * the edge arena are reused from one sub-interval to the next.
+         */
+        struct subinterval_buffer {
+            vid_t st, en;
+            std::vector<svertex_t> vertices;
+            graphchi_edge<EdgeDataType> * edata;
+            vertex_data_store<VertexDataType> * vdata;
+            memory_arena arena;
+            subinterval_buffer() : st(0), en(0), edata(NULL), vdata(NULL) {}
+        };
+        
+        subinterval_buffer subinterval_buffers[2];
+        
+        /* Edge-balanced chunks of the sub-interval for the update threads */
+        edge_balanced_partitioner exec_partitioner;
+        
+        /* Latencies of the phases */
+        metric_handle load_subinterval_metric, memshard_load_metric, exec_metric, save_vertices_metric;
+        
+        /* Levels of the vertices that are not parallel safe, see compute_nonsafe_levels() */
+        std::vector<int> nonsafe_level;
+        std::vector<int> nonsafe_level_start;
+        std::vector<int> nonsafe_order;
+        
+        /* Offsets of the scheduled vertices of the sub-interval by decreasing priority,
+           empty if the vertices are run in the order of their ids */
+        std::vector<int> priority_order;
+        
+        /* Memory shards of all intervals, if the whole graph is run in memory */
+        bool inmemory_all_shards;
+        std::vector<memshard_t *> inmemory_shards;
+        
+        /* Vertices scheduled on the previous in-memory mode iteration */
+        std::vector<vid_t> inmemory_frontier;
+        bool inmemory_frontier_valid;
+        
+        struct prefetch_task {
+            graphchi_engine * engine;
+            subinterval_buffer * buf;
+            vid_t st, maxvid;
+            prefetch_task(graphchi_engine * engine, subinterval_buffer * buf, vid_t st, vid_t maxvid) :
+                engine(engine), buf(buf), st(st), maxvid(maxvid) {}
+        };
+        
         void print_config() {
             logstream(LOG_INFO) << "Engine configuration: " << std::endl;
             logstream(LOG_INFO) << " exec_threads = " << exec_threads << std::endl;
@@ -128,6 +186,8 @@ namespace graphchi {
             logstream(LOG_INFO) << " membudget_mb = " << membudget_mb << std::endl;
             logstream(LOG_INFO) << " blocksize = " << blocksize << std::endl;
             logstream(LOG_INFO) << " scheduler = " << use_selective_scheduling << std::endl;
+            logstream(LOG_INFO) << " pipelining = " << pipelining_enabled() << std::endl;
+            logstream(LOG_INFO) << " inmemory = " << is_inmemory_mode() << std::endl;
         }
         
     public:
@@ -146,6 +206,10 @@ namespace graphchi {
                 iomgr->set_disable_preloading(true);
             }
             m.stop_time("iomgr_init");
+            load_subinterval_metric = m.register_metric("load_subinterval", TIME);
+            memshard_load_metric = m.register_metric("memshard_load", TIME);
+            exec_metric = m.register_metric("execute-updates", TIME);
+            save_vertices_metric = m.register_metric("save_vertices", TIME);
 #ifndef DYNAMICEDATA
             logstream(LOG_INFO) << "Initializing graphchi_engine. This engine expects " << sizeof(EdgeDataType)
             << "-byte edge data. " << std::endl;
@@ -176,6 +240,10 @@ namespace graphchi {
 #endif
             
             disable_vertexdata_storage = false;
+            enable_pipelining = get_option_int("pipeline", 0) != 0;
+            enable_inmemory_mode = get_option_int("inmemory", 1) != 0;
+            checkpoint_interval = get_option_int("checkpoint_interval", 0);
+            inmemory_all_shards = false;
 
             membudget_mb = get_option_int("membudget_mb", 1024);
             nupdates = 0;
@@ -183,9 +251,14 @@ namespace graphchi {
             work = 0;
             nedges = 0;
             scheduler = NULL;
+            prio_scheduler = NULL;
+            use_priorities = get_option_int("priority", 0) != 0;
+            priority_threshold = get_option_float("priority_threshold", 0.0f);
+            inmemory_frontier_valid = false;
             store_inedges = true;
             degree_handler = NULL;
             vertex_data_handler = NULL;
+            prefetch_vertex_data_handler = NULL;
             enable_deterministic_parallelism = true;
             load_threads = get_option_int("loadthreads", 2);
             exec_threads = get_option_int("execthreads", omp_get_max_threads());
@@ -202,10 +275,15 @@ namespace graphchi {
         virtual ~graphchi_engine() {
             if (degree_handler != NULL) delete degree_handler;
             if (vertex_data_handler != NULL) delete vertex_data_handler;
+            if (prefetch_vertex_data_handler != NULL) delete prefetch_vertex_data_handler;
             if (memoryshard != NULL) {
                 delete memoryshard;
                 memoryshard = NULL;
             }
+            for(int p=0; p < (int)inmemory_shards.size(); p++) {
+                delete inmemory_shards[p];
+            }
+            inmemory_shards.clear();
             for(int i=0; i < (int)sliding_shards.size(); i++) {
                 if (sliding_shards[i] != NULL) {
                     delete sliding_shards[i];
@@ -214,6 +292,7 @@ namespace graphchi {
             }
             degree_handler = NULL;
             vertex_data_handler = NULL;
+            prefetch_vertex_data_handler = NULL;
             delete iomgr;
         }
         
@@ -284,19 +363,65 @@ namespace graphchi {
         virtual void initialize_scheduler() {
             if (use_selective_scheduling) {
                 if (scheduler != NULL) delete scheduler;
-                scheduler = new bitset_scheduler((int) num_vertices());
+                if (use_priorities) {
+                    scheduler = prio_scheduler = new priority_scheduler(num_vertices(), priority_threshold);
+                } else {
+                    scheduler = new frontier_scheduler(num_vertices());
+                    prio_scheduler = NULL;
+                }
                 scheduler->add_task_to_all();
             } else {
                 scheduler = NULL;
+                prio_scheduler = NULL;
             }
         }
         
         /**
-         * If the data is only in one shard, we can just
-         * keep running from memory.
+         * If the data is only in one shard, or all the shards fit in the
+         * memory budget, we can just keep running from memory.
          */
         bool is_inmemory_mode() {
-            return nshards == 1;
+            return (nshards == 1 && inmemory_mode_supported()) || inmemory_all_shards;
+        }
+        
+        /**
+         * Whether the engine can load the edges once and run all iterations from
+         * memory. Engines that load the edges their own way must override this.
+         */
+        virtual bool inmemory_mode_supported() {
+#ifndef DYNAMICEDATA
+            return true;
+#else
+            return false;
+#endif
+        }
+        
+        /**
+         * Memory needed to keep all the shards in memory: the adjacency and edge
+         * data of the shards, the edge objects of the vertices, and the vertices.
+         */
+        size_t inmemory_bytes() {
+            size_t adjbytes = 0;
+            for(int p=0; p < nshards; p++) {
+                adjbytes += get_filesize(filename_shard_adj(base_filename, p, nshards));
+            }
+            size_t edges = (only_adjacency ? adjbytes / sizeof(vid_t) : nedges);
+            size_t nv = num_vertices();
+            return adjbytes + edges * ((only_adjacency ? 0 : sizeof(EdgeDataType)) + (1 + store_inedges) * sizeof(graphchi_edge<EdgeDataType>)) +
+                nv * (sizeof(svertex_t) + sizeof(VertexDataType) + sizeof(degree));
+        }
+        
+        /**
+         * Decides whether all the shards are loaded into memory for the run.
+         */
+        void determine_inmemory_mode() {
+            inmemory_all_shards = false;
+            if (nshards > 1 && enable_inmemory_mode && inmemory_mode_supported()) {
+                size_t needed = inmemory_bytes();
+                inmemory_all_shards = (needed <= size_t(membudget_mb) * 1024 * 1024);
+                logstream(LOG_INFO) << "Graph needs " << needed / 1024 / 1024 << " MB in memory, budget "
+                << membudget_mb << " MB: " << (inmemory_all_shards ? "running in memory" : "streaming the shards") << std::endl;
+            }
         }
         
         
@@ -318,6 +443,11 @@ namespace graphchi {
                     int inc = deg.indegree;
                     int outc = deg.outdegree;
                     
+                    /* Edges are loaded only for scheduled vertices */
+                    if (scheduler != NULL && !scheduler->is_scheduled(fromvid + i)) {
+                        inc = outc = 0;
+                    }
+                    
                     // Raw data and object cost included
                     memreq += sizeof(svertex_t) + (sizeof(EdgeDataType) + sizeof(vid_t) + sizeof(graphchi_edge<EdgeDataType>))*(outc + inc);
                     if (memreq > membudget) {
@@ -337,12 +467,11 @@ namespace graphchi {
             size_t num_edges = 0;
             int nvertices = en - st + 1;
             if (scheduler != NULL) {
-                for(int i=0; i < nvertices; i++) {
-                    bool is_sched = scheduler->is_scheduled(st + i);
-                    if (is_sched) {
-                        degree d = degree_handler->get_degree(st + i);
-                        num_edges += d.indegree * store_inedges + d.outdegree;
-                    }
+                std::vector<vid_t> tasks;
+                scheduler->get_tasks(st, en, tasks);
+                for(size_t i=0; i < tasks.size(); i++) {
+                    degree d = degree_handler->get_degree(tasks[i]);
+                    num_edges += d.indegree * store_inedges + d.outdegree;
                 }
             } else {
                 for(int i=0; i < nvertices; i++) {
@@ -354,9 +483,35 @@ namespace graphchi {
         }
         
         virtual void load_before_updates(std::vector<svertex_t> &vertices) {
+            load_subinterval(sub_interval_st, sub_interval_en, vertices, vertex_data_handler, false);
+        }
+        
+        /**
+         * Loads the edges and vertex values of vertices st..en.
+         * @param vdata vertex data buffer to load into
+         * @param keep_previous if true, sliding shards do not release the blocks of the previous sub-interval
+         */
+        void load_subinterval(vid_t st, vid_t en, std::vector<svertex_t> &vertices, vertex_data_store<VertexDataType> * vdata,
+                              bool keep_previous) {
+            metrics_timer me = m.start_timer();
+            
+            /* Sliding shards can seek past the unscheduled vertices once
+               their index has been recorded on the first iteration. The tasks of
+               the window have been removed from the scheduler already. */
+            std::vector<vid_t> window_tasks;
+            bool skip_unscheduled = (scheduler != NULL && chicontext.iteration > 0);
+            if (skip_unscheduled) {
+                for(size_t i=0; i < vertices.size(); i++) {
+                    if (vertices[i].scheduled) window_tasks.push_back(st + (vid_t)i);
+                }
+            }
+            vid_t first_scheduled = (window_tasks.empty() ? st : window_tasks[0]);
+            
             omp_set_num_threads(load_threads);
 #pragma omp parallel for schedule(dynamic, 1)
             for(int p=-1; p < nshards; p++)  {
+                /* Load time of each shard is also summed to the vector "shard_load" */
+                metrics_timer shardtimer = m.start_timer();
                 if (p==(-1)) {
                     /* Load memory shard */
                     if (!memoryshard->loaded()) {
@@ -364,20 +519,21 @@ namespace graphchi {
                     }
                     
                     /* Load vertex edges from memory shard */
-                    memoryshard->load_vertices(sub_interval_st, sub_interval_en, vertices);
+                    memoryshard->load_vertices(st, en, vertices);
+                    m.add_vector_entry("shard_load", exec_interval, m.stop_timer(shardtimer, memshard_load_metric));
                     
-                    /* Load vertices */ 
-                    vertex_data_handler->load(sub_interval_st, sub_interval_en);
-
                     /* Load vertices */
                     if (!disable_vertexdata_storage) {
-                        vertex_data_handler->load(sub_interval_st, sub_interval_en);
+                        vdata->load(st, en);
                     }
                 } else {
                     /* Load edges from a sliding shard */
                     if (p != exec_interval) {
-                        sliding_shards[p]->read_next_vertices((int) vertices.size(), sub_interval_st, vertices,
-                                                              scheduler != NULL && chicontext.iteration == 0);
+                        sliding_shards[p]->move_close_to(first_scheduled);
+                        sliding_shards[p]->read_next_vertices((int) vertices.size(), st, vertices,
+                                                              scheduler != NULL && chicontext.iteration == 0, false, keep_previous,
+                                                              skip_unscheduled ? &window_tasks : NULL);
+                        m.add_vector_entry("shard_load", p, m.elapsed(shardtimer));
                         
                     }
                 }
@@ -385,70 +541,148 @@ namespace graphchi {
             
             /* Wait for all reads to complete */
             iomgr->wait_for_reads();
+            m.stop_timer(me, load_subinterval_metric);
+        }
+        
+        /**
+         * Groups the vertices that are not parallel safe to levels, so that
+         * the vertices of a level share no edges and each vertex comes after
+         * its in-window neighbors with smaller ids. Running the levels in order
+         * gives the same result as running the vertices serially in id order.
+         * Edges are read from the in-edge lists, so without stored in-edges
+         * each vertex gets a level of its own.
+         * @return number of levels
+         */
+        int compute_nonsafe_levels(std::vector<svertex_t> &vertices) {
+            int nvertices = (int) vertices.size();
+            nonsafe_level.assign(nvertices, -1);
+            std::vector<int> minlevel(nvertices, 0);
+            int nlevels = 0;
+            
+            for(int i=0; i < nvertices; i++) {
+                svertex_t & v = vertices[i];
+                if (v.parallel_safe || !v.scheduled) continue;
+                int lvl = minlevel[i];
+                if (store_inedges) {
+                    for(int j=0; j < v.num_inedges(); j++) {
+                        vid_t nb = v.inedge(j)->vertex_id();
+                        if (nb >= sub_interval_st && nb < sub_interval_st + i && nonsafe_level[nb - sub_interval_st] >= 0) {
+                            lvl = std::max(lvl, nonsafe_level[nb - sub_interval_st] + 1);
+                        }
+                    }
+                } else {
+                    lvl = nlevels;
+                }
+                nonsafe_level[i] = lvl;
+                nlevels = std::max(nlevels, lvl + 1);
+                
+                /* Out-edges are in the in-edge lists of the later vertices */
+                if (store_inedges) {
+                    for(int j=0; j < v.num_inedges(); j++) {
+                        vid_t nb = v.inedge(j)->vertex_id();
+                        if (nb > sub_interval_st + i && nb <= sub_interval_en) {
+                            minlevel[nb - sub_interval_st] = std::max(minlevel[nb - sub_interval_st], lvl + 1);
+                        }
+                    }
+                }
+            }
+            
+            /* Counting sort by level; within a level, by vertex id */
+            nonsafe_level_start.assign(nlevels + 1, 0);
+            for(int i=0; i < nvertices; i++) {
+                if (nonsafe_level[i] >= 0) nonsafe_level_start[nonsafe_level[i] + 1]++;
+            }
+            for(int l=0; l < nlevels; l++) nonsafe_level_start[l + 1] += nonsafe_level_start[l];
+            nonsafe_order.resize(nonsafe_level_start[nlevels]);
+            std::vector<int> pos(nonsafe_level_start.begin(), nonsafe_level_start.end() - 1);
+            for(int i=0; i < nvertices; i++) {
+                if (nonsafe_level[i] >= 0) nonsafe_order[pos[nonsafe_level[i]]++] = i;
+            }
+            return nlevels;
         }
         
         void exec_updates(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &userprogram,
                           std::vector<svertex_t> &vertices) {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
             size_t nvertices = vertices.size();
             if (!enable_deterministic_parallelism) {
                 for(int i=0; i < (int)nvertices; i++) vertices[i].parallel_safe = true;
             }
             
+            assert(nvertices == (size_t) (sub_interval_en - sub_interval_st + 1));
             omp_set_num_threads(exec_threads);
             
-#pragma omp parallel sections 
-            {
-#pragma omp section
-                {
-#pragma omp parallel for schedule(dynamic)
-                    for(int vid=sub_interval_st; vid <= (int)sub_interval_en; vid++) {
-                        svertex_t & v = vertices[vid - sub_interval_st];
-                        
-                        if (exec_threads == 1 || v.parallel_safe) {
-                            if (!disable_vertexdata_storage)
-                                v.dataptr = vertex_data_handler->vertex_data_ptr(vid);
-                            if (v.scheduled) 
-                                userprogram.update(v, chicontext);
-                        }
+            if (!priority_order.empty()) {
+                /* Highest priorities first */
+#pragma omp parallel for schedule(dynamic, 64)
+                for(int j=0; j < (int)priority_order.size(); j++) {
+                    svertex_t & v = vertices[priority_order[j]];
+                    if (v.parallel_safe) {
+                        if (!disable_vertexdata_storage)
+                            v.dataptr = vertex_data_handler->vertex_data_ptr(sub_interval_st + priority_order[j]);
+                        userprogram.update(v, chicontext);
                     }
                 }
-#pragma omp section
+            } else {
+                exec_partitioner.partition(vertices, exec_threads);
+                m.add("exec-hubs", exec_partitioner.num_hubs());
+            
+#pragma omp parallel
                 {
-                    if (exec_threads > 1 && enable_deterministic_parallelism) {
-                        int nonsafe_count = 0;
-                        for(int vid=sub_interval_st; vid <= (int)sub_interval_en; vid++) {
-                            svertex_t & v = vertices[vid - sub_interval_st];
-                            if (!v.parallel_safe && v.scheduled) {
+                    int thread = omp_get_thread_num();
+                    work_chunk chunk;
+                    while(exec_partitioner.next(thread, chunk)) {
+                        for(int i=chunk.st; i < chunk.en; i++) {
+                            svertex_t & v = vertices[i];
+                            vid_t vid = sub_interval_st + i;
+                        
+                            if (v.parallel_safe) {
                                 if (!disable_vertexdata_storage)
                                     v.dataptr = vertex_data_handler->vertex_data_ptr(vid);
-                                userprogram.update(v, chicontext);
-                                nonsafe_count++;
+                                if (v.scheduled) 
+                                    userprogram.update(v, chicontext);
                             }
                         }
-                        
-                        m.add("serialized-updates", nonsafe_count);
                     }
                 }
             }
-            m.stop_time(me, "execute-updates");
+            
+            /* Vertices that share edges with other vertices of the window. The
+               levels keep the order of the ids, so the results do not depend on
+               the number of threads. */
+            if (enable_deterministic_parallelism) {
+                int nlevels = compute_nonsafe_levels(vertices);
+                for(int l=0; l < nlevels; l++) {
+                    int lst = nonsafe_level_start[l], len = nonsafe_level_start[l + 1];
+#pragma omp parallel for schedule(dynamic, 16)
+                    for(int j=lst; j < len; j++) {
+                        int i = nonsafe_order[j];
+                        svertex_t & v = vertices[i];
+                        if (!disable_vertexdata_storage)
+                            v.dataptr = vertex_data_handler->vertex_data_ptr(sub_interval_st + i);
+                        userprogram.update(v, chicontext);
+                    }
+                }
+                m.add("nonsafe-updates", nonsafe_order.size());
+                m.add("nonsafe-levels", nlevels);
+            }
+            m.stop_timer(me, exec_metric);
         }
         
 
         /**
-         Special method for running all iterations with the same vertex-vector.
-         This is a hacky solution.
-
-         FIXME:  this does not work well with deterministic parallelism. Needs a
-         a separate analysis phase to check which vertices can be run in parallel, and
-         then run it in chunks. Not difficult.
-         **/
+         * Runs all iterations with the same vertex vector, which covers the whole graph.
+         * With deterministic parallelism, exec_updates() runs the vertices sharing
+         * edges in levels, as for any sub-interval. Writes a checkpoint every
+         * checkpoint_interval iterations, if set.
+         */
         void exec_updates_inmemory_mode(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &userprogram,
                                         std::vector<svertex_t> &vertices) {
             work = nupdates = 0;
             for(iter=0; iter<niters; iter++) {
                 logstream(LOG_INFO) << "In-memory mode: Iteration " << iter << " starts." << std::endl;
                 chicontext.iteration = iter;
+                chicontext.reset_reducers(exec_threads);
                 userprogram.before_iteration(iter, chicontext);
                 userprogram.before_exec_interval(0, (int)num_vertices(), chicontext);
 
@@ -457,14 +691,42 @@ namespace graphchi {
                         logstream(LOG_INFO) << "No new tasks to run!" << std::endl;
                         break;
                     }
-                    for(int i=0; i < (int)vertices.size(); i++) { // Could, should parallelize
-                        if (iter == 0 || scheduler->is_scheduled(i)) {
-                            vertices[i].scheduled =  true;
-                            nupdates++;
-                            work += vertices[i].inc + vertices[i].outc;
-                        } else {
-                            vertices[i].scheduled = false;
+                    if (iter > 0 && scheduler->is_sparse() && inmemory_frontier_valid) {
+                        /* Small frontier: only flip the flags of the previous and the current frontier */
+                        for(size_t j=0; j < inmemory_frontier.size(); j++) {
+                            vertices[inmemory_frontier[j]].scheduled = false;
+                        }
+                        inmemory_frontier.clear();
+                        scheduler->get_tasks(0, (vid_t) vertices.size() - 1, inmemory_frontier);
+                        for(size_t j=0; j < inmemory_frontier.size(); j++) {
+                            svertex_t &v = vertices[inmemory_frontier[j]];
+                            v.scheduled = true;
+                            work += v.inc + v.outc;
+                        }
+                        nupdates += inmemory_frontier.size();
+                    } else {
+                        size_t nsched = 0, nwork = 0;
+#pragma omp parallel for reduction(+:nsched,nwork)
+                        for(int i=0; i < (int)vertices.size(); i++) {
+                            if (iter == 0 || scheduler->is_scheduled(i)) {
+                                vertices[i].scheduled =  true;
+                                nsched++;
+                                nwork += vertices[i].inc + vertices[i].outc;
+                            } else {
+                                vertices[i].scheduled = false;
+                            }
                         }
+                        nupdates += nsched;
+                        work += nwork;
+                        /* The next round can flip the flags only if this frontier is known */
+                        inmemory_frontier.clear();
+                        inmemory_frontier_valid = (iter > 0 && scheduler->is_sparse());
+                        if (inmemory_frontier_valid) scheduler->get_tasks(0, (vid_t) vertices.size() - 1, inmemory_frontier);
+                    }
+                    
+                    priority_order.clear();
+                    if (prio_scheduler != NULL && iter > 0) {
+                        prio_scheduler->get_priority_order(0, (vid_t) vertices.size() - 1, priority_order);
                     }
                     
                     scheduler->has_new_tasks = false; // Kind of misleading since scheduler may still have tasks - but no new tasks.
@@ -478,7 +740,11 @@ namespace graphchi {
                 load_after_updates(vertices);
                 
                 userprogram.after_exec_interval(0, (int)num_vertices(), chicontext);
+                chicontext.merge_reducers();
                 userprogram.after_iteration(iter, chicontext);
+                if (checkpoint_interval > 0 && (iter + 1) % checkpoint_interval == 0 && iter + 1 < niters) {
+                    checkpoint_inmemory(vertices);
+                }
                 if (chicontext.last_iteration > 0 && chicontext.last_iteration <= iter){
                    logstream(LOG_INFO)<<"Stopping engine since last iteration was set to: " << chicontext.last_iteration << std::endl;
                    break;
@@ -488,25 +754,115 @@ namespace graphchi {
         }
         
 
+        /**
+         * Writes the vertex values and the edge data of the in-memory mode,
+         * keeping them in memory.
+         */
+        void checkpoint_inmemory(std::vector<svertex_t> &vertices) {
+            logstream(LOG_INFO) << "In-memory mode: checkpoint after iteration " << iter << std::endl;
+            save_vertices(vertices);
+            if (inmemory_all_shards) {
+                for(int p=0; p < nshards; p++) inmemory_shards[p]->write_edata();
+            } else if (memoryshard != NULL && memoryshard->loaded()) {
+                memoryshard->write_edata();
+            }
+            iomgr->wait_for_writes();
+        }
+        
+        /**
+         * Runs all iterations with every shard in memory. The memory shards of all
+         * intervals are loaded once into a single window of all vertices: the edges
+         * of each vertex are in one array of the arena, in-edges followed by out-edges,
+         * and point to the edge data kept in the memory shards. Edge data is written
+         * back after the last iteration and at checkpoints only.
+         */
+        void run_inmemory_all_shards(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &userprogram) {
+            chicontext.filename = base_filename;
+            chicontext.iteration = 0;
+            chicontext.num_iterations = niters;
+            chicontext.nvertices = num_vertices();
+            if (!only_adjacency) chicontext.nedges = num_edges();
+            chicontext.execthreads = exec_threads;
+            chicontext.reset_deltas(exec_threads);
+            if (!disable_vertexdata_storage)
+                vertex_data_handler->check_size(num_vertices());
+            
+            metrics_timer me = m.start_timer();
+            sub_interval_st = 0;
+            sub_interval_en = (vid_t) num_vertices() - 1;
+            exec_interval = 0;
+            
+            /* Start reading all the shards */
+            for(int p=0; p < nshards; p++) {
+                exec_interval = p;
+                memshard_t * shard = create_memshard(get_interval_start(p), get_interval_end(p));
+                shard->only_adjacency = only_adjacency;
+                shard->load();
+                inmemory_shards.push_back(shard);
+            }
+            
+            /* Every vertex is scheduled on the first iteration, so all edges are allocated */
+            degree_handler->load(sub_interval_st, sub_interval_en);
+            std::vector<svertex_t> &vertices = subinterval_buffers[0].vertices;
+            vertices.assign(sub_interval_en - sub_interval_st + 1, svertex_t());
+            graphchi_edge<EdgeDataType> * edata = NULL;
+            init_vertices(vertices, edata);
+            
+            /* The in-edges of a vertex are all in the shard of its interval,
+               but its out-edges are spread over the shards. */
+            for(int p=0; p < nshards; p++) {
+                inmemory_shards[p]->load_vertices(sub_interval_st, sub_interval_en, vertices);
+            }
+            if (!disable_vertexdata_storage) {
+                vertex_data_handler->load(sub_interval_st, sub_interval_en);
+            }
+            iomgr->wait_for_reads();
+            m.stop_timer(me, load_subinterval_metric);
+            
+            exec_updates_inmemory_mode(userprogram, vertices);
+            
+            /* Write back */
+            if (!disable_vertexdata_storage) {
+                save_vertices(vertices);
+            }
+            for(int p=0; p < nshards; p++) {
+                inmemory_shards[p]->commit(modifies_inedges, modifies_outedges);
+                delete inmemory_shards[p];
+            }
+            inmemory_shards.clear();
+            iomgr->wait_for_writes();
+            subinterval_buffers[0].arena.reset();
+            write_delta_log();
+        }
+        
         virtual void init_vertices(std::vector<svertex_t> &vertices, graphchi_edge<EdgeDataType> * &edata) {
+            init_vertices_range(sub_interval_st, sub_interval_en, vertices, edata, subinterval_buffers[0].arena);
+        }
+        
+        /**
+         * Initializes vertices st..en, allocating their edges from the arena.
+         * The arena must have been reset after the previous sub-interval.
+         */
+        void init_vertices_range(vid_t st, vid_t en, std::vector<svertex_t> &vertices, graphchi_edge<EdgeDataType> * &edata,
+                                 memory_arena &arena) {
             size_t nvertices = vertices.size();
             
             /* Compute number of edges */
-            size_t num_edges = num_edges_subinterval(sub_interval_st, sub_interval_en);
+            size_t num_edges = num_edges_subinterval(st, en);
             
             /* Allocate edge buffer */
-            edata = (graphchi_edge<EdgeDataType>*) malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
+            edata = (graphchi_edge<EdgeDataType>*) arena.allocate(num_edges * sizeof(graphchi_edge<EdgeDataType>));
             
             /* Assign vertex edge array pointers */
             size_t ecounter = 0;
             for(int i=0; i < (int)nvertices; i++) {
-                degree d = degree_handler->get_degree(sub_interval_st + i);
+                degree d = degree_handler->get_degree(st + i);
                 int inc = d.indegree;
                 int outc = d.outdegree;
-                vertices[i] = svertex_t(sub_interval_st + i, &edata[ecounter], 
+                vertices[i] = svertex_t(st + i, &edata[ecounter], 
                                         &edata[ecounter + inc * store_inedges], inc, outc);
                 if (scheduler != NULL) {
-                    bool is_sched = ( scheduler->is_scheduled(sub_interval_st + i));
+                    bool is_sched = ( scheduler->is_scheduled(st + i));
                     if (is_sched) {
                         vertices[i].scheduled =  true;
                         nupdates++;
@@ -523,8 +879,134 @@ namespace graphchi {
         }
         
         
+        /**
+         * Running the intervals out of order requires the shards to stay fixed during
+         * the iteration, and each sliding shard to be read once per sub-interval.
+         */
+        virtual bool interval_reordering_supported() {
+            return true;
+        }
+        
+        /**
+         * With priorities, the intervals are run in the order of the top priority of
+         * their scheduled vertices, otherwise in the order of their ids. The first
+         * iteration is always run in order, since it records the sliding shard indices.
+         */
+        void determine_interval_order(std::vector<int> &order) {
+            order.clear();
+            for(int p=0; p < nshards; p++) order.push_back(p);
+            if (prio_scheduler == NULL || iter == 0 || is_inmemory_mode() || !interval_reordering_supported()) {
+                return;
+            }
+            std::vector<std::pair<float, int> > top(nshards);
+            for(int p=0; p < nshards; p++) {
+                vid_t st = get_interval_start(p), en = get_interval_end(p);
+                top[p] = std::pair<float, int>(st <= en ? -prio_scheduler->top_priority(st, en) : 0.0f, p);
+            }
+            std::stable_sort(top.begin(), top.end());
+            for(int p=0; p < nshards; p++) order[p] = top[p].second;
+        }
+        
+        /**
+         * Pipelining loads the next sub-interval before the updates of the current one
+         * have run, so it cannot be used when updates may schedule vertices or when the
+         * engine loads edges after the updates.
+         */
+        virtual bool pipelining_supported() {
+            return true;
+        }
+        
+        bool pipelining_enabled() {
+            return enable_pipelining && !use_selective_scheduling && !is_inmemory_mode() && pipelining_supported();
+        }
+        
+        /**
+         * Determines the sub-interval starting from st, and loads it into buf.
+         */
+        void load_subinterval_buffer(subinterval_buffer * buf, vid_t st, vid_t maxvid, bool keep_previous) {
+            buf->st = st;
+            buf->en = determine_next_window(exec_interval, st, std::min(maxvid, st + maxwindow),
+                                            size_t(membudget_mb) * 1024 * 1024 / 2);
+            assert(buf->en >= buf->st);
+            
+            buf->vertices.assign(buf->en - buf->st + 1, svertex_t());
+            buf->edata = NULL;
+            init_vertices_range(buf->st, buf->en, buf->vertices, buf->edata, buf->arena);
+            load_subinterval(buf->st, buf->en, buf->vertices, buf->vdata, keep_previous);
+        }
+        
+        static void * prefetch_thread_loop(void * _task) {
+            prefetch_task * task = (prefetch_task *) _task;
+            task->engine->load_subinterval_buffer(task->buf, task->st, task->maxvid, true);
+            return NULL;
+        }
+        
+        /**
+         * Executes the sub-intervals of the current execution interval, loading
+         * the next sub-interval in a background thread while the updates of the
+         * current one run. The memory budget is split between the two buffers.
+         */
+        void exec_subintervals_pipelined(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &userprogram,
+                                         vid_t interval_st, vid_t interval_en) {
+            if (prefetch_vertex_data_handler == NULL)
+                prefetch_vertex_data_handler = new vertex_data_store<VertexDataType>(base_filename, num_vertices(), iomgr);
+            
+            vertex_data_store<VertexDataType> * main_vertex_data_handler = vertex_data_handler;
+            subinterval_buffer * buffers = subinterval_buffers;
+            buffers[0].vdata = vertex_data_handler;
+            buffers[1].vdata = prefetch_vertex_data_handler;
+            int cur = 0;
+            load_subinterval_buffer(&buffers[cur], interval_st, interval_en, false);
+            
+            while(true) {
+                subinterval_buffer &curbuf = buffers[cur];
+                subinterval_buffer &nextbuf = buffers[1 - cur];
+                sub_interval_st = curbuf.st;
+                sub_interval_en = curbuf.en;
+                logstream(LOG_INFO) << "Iteration " << iter << "/" << (niters - 1) << ", subinterval: " << sub_interval_st << " - " << sub_interval_en << std::endl;
+                
+                /* Start loading the next sub-interval */
+                bool has_next = curbuf.en < interval_en;
+                prefetch_task task(this, &nextbuf, curbuf.en + 1, interval_en);
+                pthread_t prefetch_thread;
+                if (has_next) {
+                    int ret = pthread_create(&prefetch_thread, NULL, prefetch_thread_loop, &task);
+                    assert(ret >= 0);
+                }
+                
+                logstream(LOG_INFO) << "Start updates" << std::endl;
+                vertex_data_handler = curbuf.vdata;
+                exec_updates(userprogram, curbuf.vertices);
+                load_after_updates(curbuf.vertices);
+                logstream(LOG_INFO) << "Finished updates" << std::endl;
+                
+                if (has_next) {
+                    metrics_entry me = m.start_time();
+                    pthread_join(prefetch_thread, NULL);
+                    m.stop_time(me, "pipeline_wait");
+                }
+                
+                /* Save vertices */
+                if (!disable_vertexdata_storage) {
+                    save_vertices(curbuf.vertices);
+                }
+                curbuf.arena.reset();
+                curbuf.edata = NULL;
+                if (!has_next) break;
+                
+                /* Blocks that belonged only to the finished sub-interval can now be committed */
+                for(int p=0; p < nshards; p++) {
+                    if (p != exec_interval) sliding_shards[p]->release_prior_to_window();
+                }
+                cur = 1 - cur;
+            }
+            vertex_data_handler = main_vertex_data_handler;
+            sub_interval_st = interval_en + 1;
+        }
+        
         void save_vertices(std::vector<svertex_t> &vertices) {
             if (disable_vertexdata_storage) return;
+            metrics_timer me = m.start_timer();
             size_t nvertices = vertices.size();
             bool modified_any_vertex = false;
             for(int i=0; i < (int)nvertices; i++) {
@@ -536,6 +1018,7 @@ namespace graphchi {
             if (modified_any_vertex) {
                 vertex_data_handler->save();
             }
+            m.stop_timer(me, save_vertices_metric);
         }
         
         virtual void load_after_updates(std::vector<svertex_t> &vertices) {
@@ -620,12 +1103,7 @@ namespace graphchi {
         // TODO: support for a minimum fraction of scheduled vertices
         bool is_any_vertex_scheduled(vid_t st, vid_t en) {
             if (scheduler == NULL) return true;
-            for(vid_t v=st; v<=en; v++) {
-                if (scheduler->is_scheduled(v)) {
-                    return true;
-                }
-            }
-            return false;
+            return scheduler->num_tasks(st, en) > 0;
         }
         
         virtual void initialize_iter() {
@@ -688,8 +1166,21 @@ namespace graphchi {
             }
                 
             initialize_scheduler();
+            determine_inmemory_mode();
             omp_set_nested(1);
             
+            /* Reducers are registered by the program for this run */
+            chicontext.clear_reducers();
+            
+            /* The edge arrays are bounded by the memory budget (half of it for each buffer if pipelining) */
+            size_t edge_budget = size_t(membudget_mb) * 1024 * 1024;
+            if (pipelining_enabled()) {
+                subinterval_buffers[0].arena.reserve(edge_budget / 2);
+                subinterval_buffers[1].arena.reserve(edge_budget / 2);
+            } else if (!is_inmemory_mode()) {
+                subinterval_buffers[0].arena.reserve(edge_budget);
+            }
+            
             /* Install a 'mock'-scheduler to chicontext if scheduler
              is not used. */
             chicontext.scheduler = scheduler;
@@ -701,8 +1192,11 @@ namespace graphchi {
             print_config();
             
             
-            /* Main loop */
-            for(iter=0; iter < niters; iter++) {
+            /* Main loop. If all the shards fit in memory, the iterations are run separately. */
+            if (inmemory_all_shards) {
+                run_inmemory_all_shards(userprogram);
+            }
+            for(iter=0; iter < niters && !inmemory_all_shards; iter++) {
                 logstream(LOG_INFO) << "Start iteration: " << iter << std::endl;
                 
                 initialize_iter();
@@ -720,6 +1214,7 @@ namespace graphchi {
                 
                 chicontext.execthreads = exec_threads;
                 chicontext.reset_deltas(exec_threads);
+                chicontext.reset_reducers(exec_threads);
                 
                 /* Call iteration-begin event handler */
                 if (!is_inmemory_mode())  // Run sepately
@@ -737,7 +1232,12 @@ namespace graphchi {
                 }
                 
                 /* Interval loop */
-                for(exec_interval=0; exec_interval < nshards; ++exec_interval) {
+                std::vector<int> interval_order;
+                determine_interval_order(interval_order);
+                int last_interval = -1;
+                for(int k=0; k < (int)interval_order.size(); k++) {
+                    exec_interval = interval_order[k];
+                    
                     /* Determine interval limits */
                     vid_t interval_st = get_interval_start(exec_interval);
                     vid_t interval_en = get_interval_end(exec_interval);
@@ -746,6 +1246,23 @@ namespace graphchi {
 
                     if (!is_inmemory_mode())
                         userprogram.before_exec_interval(interval_st, interval_en, chicontext);
+                    
+                    /* Skip the interval without loading its memory shard or degrees */
+                    if (!is_inmemory_mode() && !is_any_vertex_scheduled(interval_st, interval_en)) {
+                        logstream(LOG_INFO) << "No vertices scheduled in interval " << exec_interval << ", skip." << std::endl;
+                        userprogram.after_exec_interval(interval_st, interval_en, chicontext);
+                        continue;
+                    }
+                    
+                    /* Sliding shards only move forward, so they are rewound to return to an
+                       earlier interval. They then seek using the index recorded on the first iteration. */
+                    if (exec_interval < last_interval) {
+                        for(int p=0; p < nshards; p++) {
+                            sliding_shards[p]->flush();
+                            sliding_shards[p]->set_offset(0, 0, 0);
+                        }
+                    }
+                    last_interval = exec_interval;
 
                     /* Flush stream shard for the exec interval */
                     sliding_shards[exec_interval]->flush();
@@ -760,6 +1277,10 @@ namespace graphchi {
                     logstream(LOG_INFO) << chicontext.runtime() << "s: Starting: " 
                     << sub_interval_st << " -- " << interval_en << std::endl;
                     
+                    if (pipelining_enabled()) {
+                        exec_subintervals_pipelined(userprogram, interval_st, interval_en);
+                    }
+                    
                     while (sub_interval_st <= interval_en) {
                         
                         modification_lock.lock();
@@ -784,9 +1305,16 @@ namespace graphchi {
                         int nvertices = sub_interval_en - sub_interval_st + 1;
                         graphchi_edge<EdgeDataType> * edata = NULL;
                         
-                        std::vector<svertex_t> vertices(nvertices, svertex_t());
+                        std::vector<svertex_t> &vertices = subinterval_buffers[0].vertices;
+                        vertices.assign(nvertices, svertex_t());
                         init_vertices(vertices, edata);
                         
+                        /* Run order of the vertices, before their priorities are reset */
+                        priority_order.clear();
+                        if (prio_scheduler != NULL && iter > 0) {
+                            prio_scheduler->get_priority_order(sub_interval_st, sub_interval_en, priority_order);
+                        }
+                        
                         /* Now clear scheduler bits for the interval */
                         if (scheduler != NULL)
                             scheduler->remove_tasks(sub_interval_st, sub_interval_en);
@@ -815,11 +1343,9 @@ namespace graphchi {
                         }
                         sub_interval_st = sub_interval_en + 1;
                         
-                        /* Delete edge buffer. TODO: reuse. */
-                        if (edata != NULL) {
-                            delete edata;
-                            edata = NULL;
-                        }
+                        /* Release edge buffer for the next sub-interval */
+                        subinterval_buffers[0].arena.reset();
+                        edata = NULL;
                        
                     } // while subintervals
 
@@ -839,8 +1365,10 @@ namespace graphchi {
 
                 } // For exec_interval
                 
-                if (!is_inmemory_mode())  // Run sepately
+                if (!is_inmemory_mode()) {  // Run sepately
+                    chicontext.merge_reducers();
                     userprogram.after_iteration(iter, chicontext);
+                }
                 
                 /* Move the sliding shard of the current interval to correct position and flush
                  writes of all shards for next iteration. */
@@ -858,9 +1386,26 @@ namespace graphchi {
                     niters = chicontext.last_iteration + 1;
                     logstream(LOG_DEBUG) << "Last iteration is now: " << (niters-1) << std::endl;
                 }
+#ifdef SUPPORT_DELETIONS
+                /* In the in-memory mode the memory shard is kept loaded */
+                if (memoryshard != NULL && memoryshard->loaded()) memoryshard->resolve_deletions();
+#endif
                 iteration_finished();
+#ifdef SUPPORT_DELETIONS
+                /* Every block has been released, so the deletions left did not point to a shard */
+                if (pending_edge_deletions().size() > 0) {
+                    logstream(LOG_WARNING) << "Could not resolve " << pending_edge_deletions().size() << " edge deletions." << std::endl;
+                    pending_edge_deletions().clear();
+                }
+#endif
             } // Iterations
             
+            /* The memory shard of the single-shard in-memory mode is written back at the end */
+            if (is_inmemory_mode() && memoryshard != NULL && memoryshard->loaded()) {
+                memoryshard->commit(modifies_inedges, modifies_outedges);
+                iomgr->wait_for_writes();
+            }
+            
             // Commit preloaded shards
             if (preload_commit)
               iomgr->commit_preloaded();
@@ -961,6 +1506,31 @@ namespace graphchi {
             maxwindow = _maxwindow;
         }; 
         
+        /**
+         * If true, the next sub-interval is loaded while the updates
+         * of the current one are executed. Not used with selective scheduling.
+         * Default false (configuration parameter "pipeline").
+         */
+        void set_enable_pipelining(bool b) {
+            enable_pipelining = b;
+        }
+        
+        /**
+         * If true, all shards are loaded into memory for the run when the graph
+         * fits in the memory budget. Default true (configuration parameter "inmemory").
+         */
+        void set_enable_inmemory_mode(bool b) {
+            enable_inmemory_mode = b;
+        }
+        
+        /**
+         * In the in-memory mode, writes the vertex and edge data every
+         * n iterations. Default 0, at the end only (configuration parameter "checkpoint_interval").
+         */
+        void set_checkpoint_interval(int n) {
+            checkpoint_interval = n;
+        }
+        
     protected:
               
         virtual void _load_vertex_intervals() {
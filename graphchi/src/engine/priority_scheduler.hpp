@@ -0,0 +1,133 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Priority scheduler for delta-driven algorithms. add_task(vid, priority)
+ * accumulates the priority (for example the residual) of the vertex, and
+ * the vertex is scheduled once its priority reaches the threshold. The engine
+ * runs the intervals with the highest priorities first, and the vertices of a
+ * sub-interval in the order of their priority. The priority of a vertex is
+ * reset when it is run.
+ */
+
+#ifndef DEF_GRAPHCHI_PRIORITYSCHEDULER
+#define DEF_GRAPHCHI_PRIORITYSCHEDULER
+
+#include <algorithm>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "engine/frontier_scheduler.hpp"
+#include "util/atomic.hpp"
+
+namespace graphchi {
+
+    class priority_scheduler : public frontier_scheduler {
+    private:
+        std::vector<float> priorities;
+        float threshold;
+
+    public:
+        priority_scheduler(vid_t nvertices, float threshold) : frontier_scheduler(nvertices),
+            priorities(nvertices, 0.0f), threshold(threshold) {
+        }
+
+        virtual ~priority_scheduler() {}
+
+        using frontier_scheduler::add_task;
+
+        /**
+         * Adds priority to the vertex, and schedules it if its
+         * priority reaches the threshold.
+         */
+        void add_task(vid_t vertex, float priority) {
+            float oldval, newval;
+            do {
+                oldval = priorities[vertex];
+                newval = oldval + priority;
+            } while (!atomic_compare_and_swap(priorities[vertex], oldval, newval));
+            if (newval >= threshold) {
+                frontier_scheduler::add_task(vertex);
+            }
+        }
+
+        inline float get_priority(vid_t vertex) const {
+            return priorities[vertex];
+        }
+
+        void resize(vid_t maxsize) {
+            frontier_scheduler::resize(maxsize);
+            priorities.resize(maxsize, 0.0f);
+        }
+
+        /**
+         * Removes the tasks and resets the priorities of the scheduled vertices.
+         * Vertices below the threshold keep their priority.
+         */
+        void remove_tasks(vid_t fromvertex, vid_t tovertex) {
+            std::vector<vid_t> tasks;
+            get_tasks(fromvertex, tovertex, tasks);
+            for(size_t i=0; i < tasks.size(); i++) {
+                priorities[tasks[i]] = 0.0f;
+            }
+            frontier_scheduler::remove_tasks(fromvertex, tovertex);
+        }
+
+        /**
+         * Highest priority of the vertices scheduled in fromvertex..tovertex (inclusive),
+         * or zero if none is scheduled.
+         */
+        float top_priority(vid_t fromvertex, vid_t tovertex) const {
+            std::vector<vid_t> tasks;
+            get_tasks(fromvertex, tovertex, tasks);
+            float top = 0.0f;
+            for(size_t i=0; i < tasks.size(); i++) {
+                top = std::max(top, priorities[tasks[i]]);
+            }
+            return top;
+        }
+
+        /**
+         * Appends to out the offsets from fromvertex of the vertices scheduled in
+         * fromvertex..tovertex (inclusive), in the order of decreasing priority.
+         */
+        void get_priority_order(vid_t fromvertex, vid_t tovertex, std::vector<int> &out) const {
+            std::vector<vid_t> tasks;
+            get_tasks(fromvertex, tovertex, tasks);
+            std::vector<std::pair<float, int> > order(tasks.size());
+            for(size_t i=0; i < tasks.size(); i++) {
+                order[i] = std::pair<float, int>(-priorities[tasks[i]], (int) (tasks[i] - fromvertex));
+            }
+            std::sort(order.begin(), order.end());
+            for(size_t i=0; i < order.size(); i++) {
+                out.push_back(order[i].second);
+            }
+        }
+    };
+
+}
+
+
+#endif
+
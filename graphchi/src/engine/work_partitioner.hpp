@@ -0,0 +1,204 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Edge-balanced partitioning of a sub-interval for parallel update execution.
+ * The vertices are cut into chunks of roughly equal number of edges. Vertices
+ * with more edges than a chunk (hubs) get a chunk of their own and are handed
+ * out first, largest first, one per thread. Each thread then works through
+ * its own contiguous range of chunks, and steals chunks from the end of the
+ * other threads' ranges when it runs out.
+ */
+
+#ifndef DEF_GRAPHCHI_WORK_PARTITIONER
+#define DEF_GRAPHCHI_WORK_PARTITIONER
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+namespace graphchi {
+
+    /**
+     * Range [st, en) of indices to the vertex array.
+     */
+    struct work_chunk {
+        int st, en;
+        size_t cost;
+
+        work_chunk() : st(0), en(0), cost(0) {}
+        work_chunk(int st, int en, size_t cost) : st(st), en(en), cost(cost) {}
+    };
+
+    inline bool heavier_chunk(const work_chunk &a, const work_chunk &b) {
+        return a.cost > b.cost;
+    }
+
+    class edge_balanced_partitioner {
+
+        /**
+         * Range of a thread's chunks in the order-array. Head and tail are packed to
+         * one word so that the owner (taking from the head) and thieves (taking
+         * from the tail) can update them with a single compare-and-swap.
+         * Padded to a cache line.
+         */
+        struct worker_queue {
+            volatile uint64_t range;
+            char padding[64 - sizeof(uint64_t)];
+        };
+
+        std::vector<work_chunk> chunks;
+        std::vector<int> order;
+        std::vector<worker_queue> queues;
+        int nhubs;
+        int chunks_per_thread;
+
+        static uint64_t pack(uint32_t head, uint32_t tail) {
+            return ((uint64_t)head << 32) | tail;
+        }
+
+        bool take_head(worker_queue & q, work_chunk & chunk) {
+            while(true) {
+                uint64_t r = q.range;
+                uint32_t head = (uint32_t) (r >> 32), tail = (uint32_t) r;
+                if (head >= tail) return false;
+                if (__sync_bool_compare_and_swap(&q.range, r, pack(head + 1, tail))) {
+                    chunk = chunks[order[head]];
+                    return true;
+                }
+            }
+        }
+
+        bool take_tail(worker_queue & q, work_chunk & chunk) {
+            while(true) {
+                uint64_t r = q.range;
+                uint32_t head = (uint32_t) (r >> 32), tail = (uint32_t) r;
+                if (head >= tail) return false;
+                if (__sync_bool_compare_and_swap(&q.range, r, pack(head, tail - 1))) {
+                    chunk = chunks[order[tail - 1]];
+                    return true;
+                }
+            }
+        }
+
+    public:
+
+        edge_balanced_partitioner(int chunks_per_thread = 8) : nhubs(0), chunks_per_thread(chunks_per_thread) {}
+
+        /**
+         * Partitions the vertices for nthreads threads. The cost of a vertex is
+         * its number of edges, plus one for the update call. With one thread
+         * the hubs are not split off, so the chunks are taken in the order of
+         * the vertex ids.
+         */
+        template <typename svertex_t>
+        void partition(std::vector<svertex_t> & vertices, int nthreads) {
+            assert(nthreads > 0);
+            chunks.clear();
+            order.clear();
+            queues.resize(nthreads);
+            nhubs = 0;
+
+            int nvertices = (int) vertices.size();
+            size_t total = 0;
+            for(int i=0; i < nvertices; i++) {
+                total += (vertices[i].scheduled ? 1 + vertices[i].num_edges() : 1);
+            }
+            size_t target = std::max((size_t)1, total / (nthreads * chunks_per_thread));
+
+            /* Cut to chunks; hubs first to their own list */
+            bool split_hubs = (nthreads > 1);
+            std::vector<work_chunk> hubs;
+            size_t acc = 0;
+            int st = 0;
+            for(int i=0; i < nvertices; i++) {
+                size_t c = (vertices[i].scheduled ? 1 + vertices[i].num_edges() : 1);
+                if (split_hubs && c >= target) {
+                    if (i > st) chunks.push_back(work_chunk(st, i, acc));
+                    hubs.push_back(work_chunk(i, i + 1, c));
+                    acc = 0;
+                    st = i + 1;
+                    continue;
+                }
+                acc += c;
+                if (acc >= target) {
+                    chunks.push_back(work_chunk(st, i + 1, acc));
+                    acc = 0;
+                    st = i + 1;
+                }
+            }
+            if (nvertices > st) chunks.push_back(work_chunk(st, nvertices, acc));
+            std::sort(hubs.begin(), hubs.end(), heavier_chunk);
+            nhubs = (int) hubs.size();
+
+            /* Deal the hubs round-robin, then split the other chunks
+               to contiguous ranges of about equal total cost. */
+            std::vector< std::vector<int> > assigned(nthreads);
+            std::vector<size_t> load(nthreads, 0);
+            int nregular = (int) chunks.size();
+            for(int h=0; h < nhubs; h++) {
+                chunks.push_back(hubs[h]);
+                assigned[h % nthreads].push_back(nregular + h);
+                load[h % nthreads] += hubs[h].cost;
+            }
+            size_t share = total / nthreads + 1;
+            int w = 0;
+            for(int i=0; i < nregular; i++) {
+                while(w < nthreads - 1 && load[w] >= share) w++;
+                assigned[w].push_back(i);
+                load[w] += chunks[i].cost;
+            }
+
+            for(int t=0; t < nthreads; t++) {
+                uint32_t head = (uint32_t) order.size();
+                order.insert(order.end(), assigned[t].begin(), assigned[t].end());
+                queues[t].range = pack(head, (uint32_t) order.size());
+            }
+        }
+
+        /**
+         * Returns the next chunk for the thread: from its own range, or
+         * stolen from other threads. False when all chunks have been taken.
+         */
+        bool next(int thread, work_chunk & chunk) {
+            int nthreads = (int) queues.size();
+            if (thread < nthreads && take_head(queues[thread], chunk)) return true;
+            for(int k=1; k <= nthreads; k++) {
+                if (take_tail(queues[(thread + k) % nthreads], chunk)) return true;
+            }
+            return false;
+        }
+
+        int num_chunks() {
+            return (int) chunks.size();
+        }
+
+        int num_hubs() {
+            return nhubs;
+        }
+    };
+}
+
+#endif
+
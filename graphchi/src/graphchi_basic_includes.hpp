@@ -50,6 +50,7 @@
 #include "metrics/reps/basic_reporter.hpp"
 #include "metrics/reps/file_reporter.hpp"
 #include "metrics/reps/html_reporter.hpp"
+#include "metrics/reps/json_reporter.hpp"
 
 #include "preprocessing/conversions.hpp"
 
@@ -79,6 +80,9 @@ namespace graphchi {
             } else if (repname == "html") {
                 html_reporter rep(get_option_string("metrics.reporter.htmlfile", "metrics.html"));
                 m.report(rep);
+            } else if (repname == "json") {
+                json_reporter rep(get_option_string("metrics.reporter.jsonfile", "metrics.json"));
+                m.report(rep);
             } else {
                 logstream(LOG_WARNING) << "Could not find metrics reporter with name [" << repname << "], ignoring." << std::endl;
             }
@@ -0,0 +1,326 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Asynchronous I/O backends for the I/O manager. A backend keeps many
+ * pread/pwrite requests in flight from a single I/O thread. Two
+ * implementations are provided for Linux: io_uring and the kernel AIO
+ * interface (io_submit). Both use the system calls directly, so neither
+ * liburing nor libaio is required. Select with configuration
+ * parameter "io.backend" (pthreads, io_uring, aio or auto).
+ */
+
+#ifndef DEF_GRAPHCHI_IOBACKEND
+#define DEF_GRAPHCHI_IOBACKEND
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define GRAPHCHI_HAVE_IO_URING 1
+#endif
+#endif
+
+#include "logger/logger.hpp"
+#include "util/cmdopts.hpp"
+
+namespace graphchi {
+
+    /**
+     * Completed request, as returned by iobackend::reap().
+     * Result is the number of bytes transferred, or -errno.
+     */
+    struct io_completion {
+        void * cookie;
+        ssize_t result;
+    };
+
+    class iobackend {
+    public:
+        virtual ~iobackend() {}
+        virtual std::string name() = 0;
+
+        /* Maximum number of requests in flight */
+        virtual int capacity() = 0;
+
+        /* Queues a request. Requests are passed to the kernel on the next reap(). */
+        virtual void submit(int fd, bool write, char * buf, size_t len, size_t off, void * cookie) = 0;
+
+        /**
+         * Submits queued requests and collects completions into out. If block is true,
+         * waits until at least one request completes.
+         * @return number of completions
+         */
+        virtual int reap(io_completion * out, int maxevents, bool block) = 0;
+    };
+
+#ifdef GRAPHCHI_HAVE_IO_URING
+
+    class uring_backend : public iobackend {
+        int ringfd;
+        int depth;
+        int to_submit;
+
+        void * sq_ptr;
+        void * cq_ptr;
+        size_t sq_size, cq_size;
+        bool single_mmap;
+
+        unsigned * sq_head, * sq_tail, * sq_mask, * sq_array;
+        unsigned * cq_head, * cq_tail, * cq_mask;
+        struct io_uring_sqe * sqes;
+        struct io_uring_cqe * cqes;
+
+    public:
+        uring_backend() : ringfd(-1), depth(0), to_submit(0), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), single_mmap(false), sqes((struct io_uring_sqe *) MAP_FAILED) {}
+
+        virtual ~uring_backend() {
+            if (sqes != MAP_FAILED) munmap(sqes, depth * sizeof(struct io_uring_sqe));
+            if (!single_mmap && cq_ptr != MAP_FAILED) munmap(cq_ptr, cq_size);
+            if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+            if (ringfd >= 0) close(ringfd);
+        }
+
+        /* Returns false if io_uring is not available */
+        bool init(int entries) {
+            struct io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            ringfd = (int) syscall(__NR_io_uring_setup, entries, &p);
+            if (ringfd < 0) {
+                logstream(LOG_DEBUG) << "io_uring_setup failed: " << strerror(errno) << std::endl;
+                return false;
+            }
+            depth = (int) p.sq_entries;
+            sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap) {
+                sq_size = cq_size = std::max(sq_size, cq_size);
+            }
+            sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+            if (sq_ptr == MAP_FAILED) return false;
+            if (single_mmap) {
+                cq_ptr = sq_ptr;
+            } else {
+                cq_ptr = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+                if (cq_ptr == MAP_FAILED) return false;
+            }
+            sqes = (struct io_uring_sqe *) mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) return false;
+
+            sq_head = (unsigned *) ((char*)sq_ptr + p.sq_off.head);
+            sq_tail = (unsigned *) ((char*)sq_ptr + p.sq_off.tail);
+            sq_mask = (unsigned *) ((char*)sq_ptr + p.sq_off.ring_mask);
+            sq_array = (unsigned *) ((char*)sq_ptr + p.sq_off.array);
+            cq_head = (unsigned *) ((char*)cq_ptr + p.cq_off.head);
+            cq_tail = (unsigned *) ((char*)cq_ptr + p.cq_off.tail);
+            cq_mask = (unsigned *) ((char*)cq_ptr + p.cq_off.ring_mask);
+            cqes = (struct io_uring_cqe *) ((char*)cq_ptr + p.cq_off.cqes);
+            return true;
+        }
+
+        virtual std::string name() {
+            return "io_uring";
+        }
+
+        virtual int capacity() {
+            return depth;
+        }
+
+        virtual void submit(int fd, bool write, char * buf, size_t len, size_t off, void * cookie) {
+            unsigned tail = *sq_tail;
+            unsigned idx = tail & *sq_mask;
+            struct io_uring_sqe * sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = (write ? IORING_OP_WRITE : IORING_OP_READ);
+            sqe->fd = fd;
+            sqe->addr = (uint64_t) (uintptr_t) buf;
+            sqe->len = (uint32_t) std::min(len, (size_t) 1 << 30);
+            sqe->off = (uint64_t) off;
+            sqe->user_data = (uint64_t) (uintptr_t) cookie;
+            sq_array[idx] = idx;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            to_submit++;
+        }
+
+        virtual int reap(io_completion * out, int maxevents, bool block) {
+            if (to_submit > 0 || block) {
+                int ret;
+                do {
+                    ret = (int) syscall(__NR_io_uring_enter, ringfd, to_submit, (block ? 1 : 0),
+                                        (block ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+                } while (ret < 0 && errno == EINTR);
+                if (ret < 0) {
+                    logstream(LOG_ERROR) << "io_uring_enter failed: " << strerror(errno) << std::endl;
+                    assert(false);
+                }
+                to_submit -= ret;
+            }
+            int n = 0;
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            while(head != tail && n < maxevents) {
+                struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+                out[n].cookie = (void *) (uintptr_t) cqe->user_data;
+                out[n].result = cqe->res;
+                n++;
+                head++;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            return n;
+        }
+    };
+
+#endif
+
+#ifdef __linux__
+
+    /**
+     * Kernel AIO. Note: without O_DIRECT most file systems complete
+     * io_submit() synchronously, so io_uring should be preferred.
+     */
+    class linuxaio_backend : public iobackend {
+        aio_context_t ctx;
+        int depth;
+        std::vector<struct iocb> queued;
+        std::vector<struct iocb *> iocbptrs;
+        std::vector<struct io_event> events;
+
+    public:
+        linuxaio_backend() : ctx(0), depth(0) {}
+
+        virtual ~linuxaio_backend() {
+            if (ctx != 0) syscall(__NR_io_destroy, ctx);
+        }
+
+        /* Returns false if kernel AIO is not available */
+        bool init(int entries) {
+            if (syscall(__NR_io_setup, entries, &ctx) < 0) {
+                logstream(LOG_DEBUG) << "io_setup failed: " << strerror(errno) << std::endl;
+                ctx = 0;
+                return false;
+            }
+            depth = entries;
+            queued.reserve(entries);
+            iocbptrs.reserve(entries);
+            events.resize(entries);
+            return true;
+        }
+
+        virtual std::string name() {
+            return "aio";
+        }
+
+        virtual int capacity() {
+            return depth;
+        }
+
+        virtual void submit(int fd, bool write, char * buf, size_t len, size_t off, void * cookie) {
+            struct iocb cb;
+            memset(&cb, 0, sizeof(cb));
+            cb.aio_fildes = fd;
+            cb.aio_lio_opcode = (write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD);
+            cb.aio_buf = (uint64_t) (uintptr_t) buf;
+            cb.aio_nbytes = len;
+            cb.aio_offset = (int64_t) off;
+            cb.aio_data = (uint64_t) (uintptr_t) cookie;
+            queued.push_back(cb);
+        }
+
+        virtual int reap(io_completion * out, int maxevents, bool block) {
+            if (!queued.empty()) {
+                iocbptrs.clear();
+                for(int i=0; i < (int)queued.size(); i++) iocbptrs.push_back(&queued[i]);
+                int submitted = 0;
+                while(submitted < (int)iocbptrs.size()) {
+                    long ret = syscall(__NR_io_submit, ctx, (long) (iocbptrs.size() - submitted), &iocbptrs[submitted]);
+                    if (ret < 0 && errno == EINTR) continue;
+                    if (ret < 0) {
+                        logstream(LOG_ERROR) << "io_submit failed: " << strerror(errno) << std::endl;
+                        assert(false);
+                    }
+                    submitted += (int) ret;
+                }
+                queued.clear();
+            }
+            int maxn = std::min(maxevents, (int) events.size());
+            long n;
+            do {
+                n = syscall(__NR_io_getevents, ctx, (block ? 1 : 0), maxn, &events[0], NULL);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                logstream(LOG_ERROR) << "io_getevents failed: " << strerror(errno) << std::endl;
+                assert(false);
+            }
+            for(int i=0; i < (int)n; i++) {
+                out[i].cookie = (void *) (uintptr_t) events[i].data;
+                out[i].result = (ssize_t) events[i].res;
+            }
+            return (int) n;
+        }
+    };
+
+#endif
+
+    /**
+     * Creates a backend by name: "io_uring", "aio" or "auto" (io_uring, falling
+     * back to aio). Returns NULL for "pthreads" or if no asynchronous backend
+     * is available, in which case the I/O threads issue blocking calls.
+     */
+    static iobackend * VARIABLE_IS_NOT_USED create_iobackend(std::string backend_name, int queuedepth) {
+        if (backend_name == "pthreads") return NULL;
+#ifdef GRAPHCHI_HAVE_IO_URING
+        if (backend_name == "io_uring" || backend_name == "auto") {
+            uring_backend * uring = new uring_backend();
+            if (uring->init(queuedepth)) return uring;
+            delete uring;
+            logstream(LOG_WARNING) << "io_uring not available, falling back to kernel AIO." << std::endl;
+        }
+#endif
+#ifdef __linux__
+        if (backend_name == "io_uring" || backend_name == "aio" || backend_name == "auto") {
+            linuxaio_backend * aio = new linuxaio_backend();
+            if (aio->init(queuedepth)) return aio;
+            delete aio;
+        }
+#endif
+        logstream(LOG_WARNING) << "Asynchronous I/O backend '" << backend_name << "' not available, using blocking I/O threads." << std::endl;
+        return NULL;
+    }
+
+}
+
+#endif
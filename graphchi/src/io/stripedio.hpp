@@ -39,10 +39,14 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 //#include <omp.h>
 
+#include <sstream>
 #include <vector>
 
+#include "io/iobackend.hpp"
 #include "logger/logger.hpp"
 #include "metrics/metrics.hpp"
 #include "util/synchronized_queue.hpp"
@@ -109,15 +113,41 @@ namespace graphchi {
         synchronized_queue<iotask> * commitqueue;
         synchronized_queue<iotask> * prioqueue;
         
-        bool running;
+        volatile bool running;
         metrics * m;
+        metric_handle read_metric, commit_metric;
+        metric_handle read_dev_metric, commit_dev_metric; // Per multiplex device, -1 if not multiplexed
         volatile int pending_writes;
         volatile int pending_reads;
         int mplex;
+        iobackend * backend; // NULL if the thread issues blocking calls
+        
+        /* The I/O thread sleeps on this condition when its queues are empty */
+        mutex qlock;
+        conditional qcond;
+        
+        /* Records the latency of a finished task */
+        void record_latency(metrics_timer t, bool write) {
+            double secs = m->stop_timer(t, write ? commit_metric : read_metric);
+            int devmetric = (write ? commit_dev_metric : read_dev_metric);
+            if (devmetric >= 0) m->add(devmetric, secs);
+        }
+        
+        bool has_tasks() {
+            return readqueue->size() + prioqueue->size() + commitqueue->size() > 0;
+        }
+        
+        /* Called after a task has been pushed to one of the queues */
+        void wakeup() {
+            qlock.lock();
+            qcond.signal();
+            qlock.unlock();
+        }
     };
     
-    // Forward declaration
+    // Forward declarations
     static void * io_thread_loop(void * _info);
+    static void * io_thread_loop_async(void * _info);
     
     struct stripe_chunk {
         int mplex_thread;
@@ -133,8 +163,10 @@ namespace graphchi {
         size_t len;
         volatile size_t curpos;
         char ** buf;
-        streaming_task() {}
-        streaming_task(stripedio * iomgr, int session, size_t len, char ** buf) : iomgr(iomgr), session(session), len(len), curpos(0), buf(buf) {}
+        pthread_t thread;
+        bool running;  // Reader thread launched and not joined yet
+        streaming_task() : running(false) {}
+        streaming_task(stripedio * iomgr, int session, size_t len, char ** buf) : iomgr(iomgr), session(session), len(len), curpos(0), buf(buf), running(false) {}
     };
     
     struct pinned_file {
@@ -142,6 +174,8 @@ namespace graphchi {
         size_t length;
         uint8_t * data;
         bool touched;
+        bool mapped; // Memory mapping owned by the session, see stripedio::map_file()
+        pinned_file() : length(0), data(NULL), touched(false), mapped(false) {}
     };
     
     // Forward declaration
@@ -156,6 +190,7 @@ namespace graphchi {
         int multiplex;
         std::string multiplex_root;
         bool disable_preloading;
+        bool use_mmap;
         
         std::vector< synchronized_queue<iotask> > mplex_readtasks;
         std::vector< synchronized_queue<iotask> > mplex_writetasks;
@@ -163,6 +198,8 @@ namespace graphchi {
         std::vector< pthread_t > threads;
         std::vector< thrinfo * > thread_infos;
         metrics &m;
+        metric_handle preada_now_metric, pwritea_now_metric;
+        metric_handle wait_reads_metric, wait_writes_metric, wait_done_metric, wait_stream_metric;
         
         /* Memory-pinned files */
         std::vector<pinned_file *> preloaded_files;
@@ -173,6 +210,10 @@ namespace graphchi {
         
         int niothreads; // threads per mplex
         
+        /* Waiters for pending reads, writes and done-counters sleep on this condition */
+        mutex completion_lock;
+        conditional completion_cond;
+        
     public:
         stripedio( metrics &_m) : m(_m) {
             disable_preloading = false;
@@ -194,10 +235,33 @@ namespace graphchi {
             }
             m.set("stripesize", (size_t)stripesize);
             
+            /* Memory mapped sessions: pointers are handed out directly to the mapped files */
+            use_mmap = get_option_int("io.mmap", 0) != 0;
+            if (use_mmap && multiplex > 1) {
+                logstream(LOG_WARNING) << "io.mmap is not supported with multiplexing, disabled." << std::endl;
+                use_mmap = false;
+            }
+            m.set("io.mmap", (size_t)use_mmap);
+            
+            preada_now_metric = m.register_metric("preada_now", TIME);
+            pwritea_now_metric = m.register_metric("pwritea_now", TIME);
+            wait_reads_metric = m.register_metric("stripedio_wait_for_reads", TIME);
+            wait_writes_metric = m.register_metric("stripedio_wait_for_writes", TIME);
+            wait_done_metric = m.register_metric("stripedio_wait_for_done", TIME);
+            wait_stream_metric = m.register_metric("stripedio_wait_for_stream", TIME);
+            
+            /* Codec for compressed edge data blocks, see util/blockcodec.hpp */
+            set_default_block_codec(get_option_string("io.codec", "zlib"), get_option_int("io.codec.level", -1));
+            m.set("io.codec", std::string(block_codec_name(default_block_codec().codec)));
+            
             // Start threads (niothreads is now threads per multiplex)
             niothreads = get_option_int("niothreads", 1);
             m.set("niothreads", (size_t)niothreads);
             
+            /* Asynchronous backend: pthreads (blocking calls), io_uring, aio or auto */
+            std::string backend_name = get_option_string("io.backend", "pthreads");
+            int queuedepth = get_option_int("io.queuedepth", 128);
+            
             logstream(LOG_DEBUG) << "Start io-manager with " << niothreads << " threads." << std::endl;
             
             // Each multiplex partition has its own queues
@@ -219,10 +283,24 @@ namespace graphchi {
                     cthreadinfo->pending_reads = 0;
                     cthreadinfo->mplex = i;
                     cthreadinfo->m = &m;
+                    cthreadinfo->read_metric = m.register_metric("read_thr", TIME);
+                    cthreadinfo->commit_metric = m.register_metric("commit_thr", TIME);
+                    cthreadinfo->read_dev_metric = cthreadinfo->commit_dev_metric = -1;
+                    if (multiplex > 1) {
+                        std::stringstream dev;
+                        dev << ".mplex" << i;
+                        cthreadinfo->read_dev_metric = m.register_metric("read_thr" + dev.str(), TIME);
+                        cthreadinfo->commit_dev_metric = m.register_metric("commit_thr" + dev.str(), TIME);
+                    }
+                    cthreadinfo->backend = create_iobackend(backend_name, queuedepth);
                     thread_infos.push_back(cthreadinfo);
+                    if (k == 0) {
+                        m.set("io.backend", (cthreadinfo->backend == NULL ? std::string("pthreads") : cthreadinfo->backend->name()));
+                    }
                     
                     pthread_t iothread;
-                    int ret = pthread_create(&iothread, NULL, io_thread_loop, cthreadinfo);
+                    int ret = pthread_create(&iothread, NULL,
+                                             (cthreadinfo->backend == NULL ? io_thread_loop : io_thread_loop_async), cthreadinfo);
                     threads.push_back(iothread);
                     assert(ret>=0);
                     k++;
@@ -234,13 +312,17 @@ namespace graphchi {
             int mplex = (int) thread_infos.size();
             // Quit all threads
             for(int i=0; i<mplex; i++) {
+                thread_infos[i]->qlock.lock();
                 thread_infos[i]->running=false;
+                thread_infos[i]->qcond.signal();
+                thread_infos[i]->qlock.unlock();
             }
             size_t nthreads = threads.size();
             for(unsigned int i=0; i<nthreads; i++) {
                 pthread_join(threads[i], NULL);
             }
             for(int i=0; i<mplex; i++) {
+                if (thread_infos[i]->backend != NULL) delete thread_infos[i]->backend;
                 delete thread_infos[i];
             }
             
@@ -303,9 +385,17 @@ namespace graphchi {
             iodesc->compressed = compressed;
             iodesc->pinned_to_memory = is_preloaded(filename);
             iodesc->start_mplex = hash(filename) % multiplex;
+            iodesc->filename = filename;
             sessions.push_back(iodesc);
             mlock.unlock();
             
+            if (NULL == iodesc->pinned_to_memory && mappable(readonly, compressed)) {
+                iodesc->pinned_to_memory = map_file(filename, readonly, compressed);
+                if (NULL != iodesc->pinned_to_memory) {
+                    return session_id;
+                }
+            }
+            
             if (NULL != iodesc->pinned_to_memory) {
                 logstream(LOG_INFO) << "Opened preloaded session: " << filename << std::endl;
                 return session_id;
@@ -336,7 +426,6 @@ namespace graphchi {
                     }
                 }
             }
-            iodesc->filename = filename;
             if (iodesc->writedescs.size() > 0)  {
            //     logstream(LOG_INFO) << "Opened write-session: " << session_id << "(" << iodesc->writedescs[0] << ") for " << filename << std::endl;
             } else {
@@ -355,6 +444,11 @@ namespace graphchi {
             wasopen = iodesc->open;
             iodesc->open = false;
             mlock.unlock();
+            if (wasopen && iodesc->pinned_to_memory != NULL && iodesc->pinned_to_memory->mapped) {
+                unmap_file(iodesc->pinned_to_memory);
+                delete iodesc->pinned_to_memory;
+                iodesc->pinned_to_memory = NULL;
+            }
             if (wasopen) {
               //  std::cout << "Closing: " << iodesc->filename << " " << iodesc->readdescs[0] << std::endl;
                 for(std::vector<int>::iterator it=iodesc->readdescs.begin(); it!=iodesc->readdescs.end(); ++it) {
@@ -406,14 +500,27 @@ namespace graphchi {
                                      compressed_session(session));
                 task.doneptr = doneptr;
                 mplex_readtasks[chunk.mplex_thread].push(task);
+                thread_infos[chunk.mplex_thread]->wakeup();
             }
         }
         
         /* Used for pipelined read */
         void launch_stream_reader(streaming_task  * task) {
-            pthread_t t;
-            int ret = pthread_create(&t, NULL, stream_read_loop, (void*)task);
+            int ret = pthread_create(&task->thread, NULL, stream_read_loop, (void*)task);
             assert(ret>=0);
+            task->running = true;
+        }
+        
+        /**
+         * Waits for the reader thread of the task to exit. Must be called
+         * before the task or its buffer is released: the thread still reads
+         * the task after it has notified that all data has been read.
+         */
+        void join_stream_reader(streaming_task * task) {
+            if (task->running) {
+                pthread_join(task->thread, NULL);
+                task->running = false;
+            }
         }
         
         
@@ -429,6 +536,71 @@ namespace graphchi {
             return sessions[session]->compressed;
         }
         
+        /**
+         * Only shard files are mapped: the read-only adjacency files and the edge data
+         * blocks. The latter are mapped only if compression is disabled, in which case they are
+         * plain files read and written at offset zero. Vertex data files can change size, so
+         * they use the normal I/O path.
+         */
+        bool mappable(bool readonly, bool compressed) {
+#if defined(DYNAMICEDATA)
+            return false;  // Dynamic edge data blocks change size
+#elif defined(GRAPHCHI_DISABLE_COMPRESSION)
+            return use_mmap && (readonly || compressed);
+#else
+            return use_mmap && readonly && !compressed;
+#endif
+        }
+        
+        /**
+         * Maps the file to memory. Read-only sessions get a private mapping, others a
+         * shared one, so that modifications go directly to the file.
+         * Returns NULL if the file is empty or cannot be mapped.
+         */
+        pinned_file * map_file(std::string filename, bool readonly, bool compressed) {
+            int fd = open(filename.c_str(), (readonly ? O_RDONLY : O_RDWR));
+            if (fd < 0) return NULL;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return NULL;
+            }
+            size_t len = (size_t) st.st_size;
+            void * ptr = mmap(NULL, len, (readonly ? PROT_READ : PROT_READ | PROT_WRITE), (readonly ? MAP_PRIVATE : MAP_SHARED), fd, 0);
+            close(fd);
+            if (ptr == MAP_FAILED) {
+                logstream(LOG_WARNING) << "Could not map " << filename << ": " << strerror(errno) << std::endl;
+                return NULL;
+            }
+            /* Adjacency data is streamed, blocks are read as a whole */
+            madvise(ptr, len, (compressed ? MADV_WILLNEED : MADV_SEQUENTIAL));
+            
+            pinned_file * mfile = new pinned_file();
+            mfile->filename = filename;
+            mfile->length = len;
+            mfile->data = (uint8_t *) ptr;
+            mfile->mapped = true;
+            return mfile;
+        }
+        
+        void unmap_file(pinned_file * mfile) {
+            if (mfile->data != NULL) {
+                if (mfile->touched) msync(mfile->data, mfile->length, MS_ASYNC);
+                munmap(mfile->data, mfile->length);
+                mfile->data = NULL;
+            }
+        }
+        
+        /* Schedules write-back of a modified range of a mapped session */
+        void sync_mapped(int session, size_t nbytes, size_t off) {
+            pinned_file * mfile = sessions[session]->pinned_to_memory;
+            if (compressed_session(session)) off = 0;
+            size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+            size_t st = (off / pagesize) * pagesize;
+            size_t en = std::min(mfile->length, off + nbytes);
+            if (en > st) msync(mfile->data + st, en - st, MS_ASYNC);
+        }
+        
         /**
          * Call to allow files to be preloaded. Note: using this requires
          * that all files are accessed with same path. This is true if
@@ -516,17 +688,18 @@ namespace graphchi {
                 mplex_writetasks[chunk.mplex_thread].push(iotask(this, WRITE, sessions[session]->writedescs[chunk.mplex_thread], session,
                                                                  refptr, chunk.len, chunk.offset+off, chunk.offset, free_after, compressed_session(session),
                                                                         close_fd));
+                thread_infos[chunk.mplex_thread]->wakeup();
             }
         }
         
         template <typename T>
         void preada_now(int session,  T * tbuf, size_t nbytes, size_t off) {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
             if (compressed_session(session)) {
                 // Compressed sessions do not support multiplexing for now
                 assert(off == 0);
                 read_compressed(sessions[session]->readdescs[0], tbuf, nbytes);
-                m.stop_time(me, "preada_now", false);
+                m.stop_timer(me, preada_now_metric);
                 return;
             }
 
@@ -534,39 +707,40 @@ namespace graphchi {
                 std::vector<stripe_chunk> stripelist = stripe_offsets(session, nbytes, off);
                 size_t checklen=0;
                 refcountptr * refptr = new refcountptr((char*)tbuf, (int) stripelist.size());
-                refptr->count++; // Take a reference so we can spin on it
+                refptr->count++; // Take a reference so the I/O threads do not free it
+                volatile int remaining = (int) stripelist.size();
                 for(int i=0; i < (int)stripelist.size(); i++) {
                     stripe_chunk chunk = stripelist[i];
                     __sync_add_and_fetch(&thread_infos[chunk.mplex_thread]->pending_reads, 1);
                     
                     // Use prioritized task queue
-                    mplex_priotasks[chunk.mplex_thread].push(iotask(this, READ, sessions[session]->readdescs[chunk.mplex_thread], session,
-                                                                    refptr, chunk.len, chunk.offset+off, chunk.offset, false,
-                                                                        false));
+                    iotask task = iotask(this, READ, sessions[session]->readdescs[chunk.mplex_thread], session,
+                                         refptr, chunk.len, chunk.offset+off, chunk.offset, false,
+                                         false);
+                    task.doneptr = &remaining;
+                    mplex_priotasks[chunk.mplex_thread].push(task);
+                    thread_infos[chunk.mplex_thread]->wakeup();
                     checklen += chunk.len;
                 }
                 assert(checklen == nbytes);
                 
-                // Spin
-                while(refptr->count>1) {
-                    usleep(5000);
-                }
+                wait_for_done(&remaining);
                 delete refptr;
             } else {
                 preada(sessions[session]->readdescs[threads.size()], tbuf, nbytes, off);
             }
-            m.stop_time(me, "preada_now", false);
+            m.stop_timer(me, preada_now_metric);
         }
         
         template <typename T>
         void pwritea_now(int session, T * tbuf, size_t nbytes, size_t off) {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
 
             if (compressed_session(session)) {
                 // Compressed sessions do not support multiplexing for now
                 assert(off == 0);
                 write_compressed(sessions[session]->writedescs[0], tbuf, nbytes);
-                m.stop_time(me, "pwritea_now", false);
+                m.stop_timer(me, pwritea_now_metric);
 
                 return;
             }
@@ -579,7 +753,7 @@ namespace graphchi {
                 checklen += chunk.len;
             }
             assert(checklen == nbytes);
-            m.stop_time(me, "pwritea_now", false);
+            m.stop_timer(me, pwritea_now_metric);
             
         }
         
@@ -597,6 +771,10 @@ namespace graphchi {
             } else {
                 // Do nothing but mark the descriptor as 'dirty'
                 sessions[session]->pinned_to_memory->touched = true;
+                if (sessions[session]->pinned_to_memory->mapped) {
+                    sync_mapped(session, nbytes, off);
+                    if (close_fd) close_session(session);
+                }
             }
         }
         
@@ -617,6 +795,9 @@ namespace graphchi {
             } else {
                 // Do nothing but mark the descriptor as 'dirty'
                 sessions[session]->pinned_to_memory->touched = true;
+                if (sessions[session]->pinned_to_memory->mapped) {
+                    sync_mapped(session, nbytes, off);
+                }
             }
         }
         
@@ -628,6 +809,9 @@ namespace graphchi {
                 *tbuf = (T*) malloc(nbytes);
             } else {
                 io_descriptor * iodesc = sessions[session];
+                // Compressed files are always accessed from the beginning
+                if (compressed_session(session)) noff = 0;
+                assert(noff + nbytes <= iodesc->pinned_to_memory->length);
                 *tbuf = (T*) (iodesc->pinned_to_memory->data + noff);
             }
         }
@@ -644,7 +828,9 @@ namespace graphchi {
                 io_descriptor * iodesc = sessions[session];
                 *tbuf = (T*) (iodesc->pinned_to_memory->data + off);
                 if (doneptr != NULL) {
-                    __sync_sub_and_fetch(doneptr, 1);
+                    if (__sync_sub_and_fetch(doneptr, 1) == 0) {
+                        notify_completion();
+                    }
                 }
             }
         }
@@ -670,28 +856,71 @@ namespace graphchi {
             }
         }
         
+        /**
+         * Wakes up threads blocked in wait_for_reads(), wait_for_writes(),
+         * wait_for_done() or wait_for_stream(). Called by the I/O threads
+         * when a counter drops to zero or a stream makes progress.
+         */
+        void notify_completion() {
+            completion_lock.lock();
+            completion_cond.broadcast();
+            completion_lock.unlock();
+        }
+        
         void wait_for_reads() {
-            metrics_entry me = m.start_time();
-            int loops = 0;
+            metrics_timer me = m.start_timer();
             int mplex = (int) thread_infos.size();
+            completion_lock.lock();
             for(int i=0; i<mplex; i++) {
                 while(thread_infos[i]->pending_reads > 0) {
-                    usleep(10000);
-                    loops++;
+                    completion_cond.wait(completion_lock);
                 }
             }
-            m.stop_time(me, "stripedio_wait_for_reads", false);
+            completion_lock.unlock();
+            m.stop_timer(me, wait_reads_metric);
         }
         
         void wait_for_writes() {
-            metrics_entry me = m.start_time();
+            metrics_timer me = m.start_timer();
             int mplex = (int) thread_infos.size();
+            completion_lock.lock();
             for(int i=0; i<mplex; i++) {
-                while(thread_infos[i]->pending_writes>0) {
-                    usleep(10000);
+                while(thread_infos[i]->pending_writes > 0) {
+                    completion_cond.wait(completion_lock);
                 }
             }
-            m.stop_time(me, "stripedio_wait_for_writes", false);
+            completion_lock.unlock();
+            m.stop_timer(me, wait_writes_metric);
+        }
+        
+        /**
+         * Blocks until the done-counter passed to preada_async() or
+         * managed_preada_async() has been decremented to zero.
+         */
+        void wait_for_done(volatile int * doneptr) {
+            if (*doneptr == 0) return;
+            metrics_timer me = m.start_timer();
+            completion_lock.lock();
+            while(*doneptr != 0) {
+                completion_cond.wait(completion_lock);
+            }
+            completion_lock.unlock();
+            m.stop_timer(me, wait_done_metric);
+        }
+        
+        /**
+         * Blocks until a stream reader launched with launch_stream_reader()
+         * has read at least pos bytes (or the whole file).
+         */
+        void wait_for_stream(streaming_task * task, size_t pos) {
+            if (task->curpos >= std::min(pos, task->len)) return;
+            metrics_timer me = m.start_timer();
+            completion_lock.lock();
+            while(task->curpos < std::min(pos, task->len)) {
+                completion_cond.wait(completion_lock);
+            }
+            completion_lock.unlock();
+            m.stop_timer(me, wait_stream_metric);
         }
         
         
@@ -709,69 +938,186 @@ namespace graphchi {
     };
     
     
+    /**
+     * Pops the next task for an I/O thread. Reads are prioritized over writes.
+     */
+    static bool pop_iotask(thrinfo * info, iotask & task) {
+        if (info->pending_reads>0) {  // Prioritize read queue
+            if (info->prioqueue->safepop(&task)) return true;
+            if (info->readqueue->safepop(&task)) return true;
+            // Reads may be in flight on an asynchronous backend
+            if (info->backend == NULL) return false;
+        }
+        return info->commitqueue->safepop(&task);
+    }
+    
+    /**
+     * Executes the task with blocking calls.
+     */
+    static void execute_iotask(iotask & task) {
+        if (task.action == WRITE) {
+            if (task.compressed) {
+                assert(task.offset == 0);
+                write_compressed(task.fd, task.ptr->ptr, task.length);
+            } else {
+                pwritea(task.fd, task.ptr->ptr + task.ptroffset, task.length, task.offset);
+            }
+        } else {
+            if (task.compressed) {
+                assert(task.offset == 0);
+                read_compressed(task.fd, task.ptr->ptr, task.length);
+            } else {
+                preada(task.fd, task.ptr->ptr+task.ptroffset, task.length, task.offset);
+            }
+        }
+    }
+    
+    /**
+     * Releases the task's buffer reference and wakes up waiters if this task
+     * completed a done-counter or was the last pending task of the thread.
+     */
+    static void finish_iotask(iotask & task, thrinfo * info) {
+        if (task.action == WRITE) {
+            if (task.free_after) {
+                // Threead-safe method of memory managment - ugly!
+                if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
+                    free(task.ptr->ptr);
+                    delete task.ptr;
+                    if (task.closefd) {
+                        task.iomgr->close_session(task.session);
+                    }
+                }
+            }
+        } else {
+            if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
+                free(task.ptr);
+                if (task.closefd) {
+                    task.iomgr->close_session(task.session);
+                }
+            }
+        }
+        bool done = (task.doneptr != NULL && __sync_sub_and_fetch(task.doneptr, 1) == 0);
+        volatile int * pending = (task.action == WRITE ? &info->pending_writes : &info->pending_reads);
+        if (__sync_sub_and_fetch(pending, 1) == 0 || done) {
+            task.iomgr->notify_completion();
+        }
+    }
+    
+    /* Sleep until a new task is pushed to the thread's queues */
+    static void wait_for_iotasks(thrinfo * info) {
+        info->qlock.lock();
+        while(info->running && !info->has_tasks()) {
+            info->qcond.wait(info->qlock);
+        }
+        info->qlock.unlock();
+    }
+    
     static void * io_thread_loop(void * _info) {
         iotask task;
         thrinfo * info = (thrinfo*)_info;
         int ntasks = 0;
         // logstream(LOG_INFO) << "Thread for multiplex :" << info->mplex << " starting." << std::endl;
         while(info->running) {
-            bool success;
-            if (info->pending_reads>0) {  // Prioritize read queue
-                success = info->prioqueue->safepop(&task);
-                if (!success) {
-                    success = info->readqueue->safepop(&task);
-                }
+            if (pop_iotask(info, task)) {
+                metrics_timer t = info->m->start_timer();
+                ++ntasks;
+                execute_iotask(task);
+                info->record_latency(t, task.action == WRITE);
+                finish_iotask(task, info);
             } else {
-                success = info->commitqueue->safepop(&task);
+                wait_for_iotasks(info);
             }
-            if (success) {
-                ++ntasks;
-                if (task.action == WRITE) {  // Write
-                    metrics_entry me = info->m->start_time();
-                    
-                    if (task.compressed) {
-                        assert(task.offset == 0);
-                        write_compressed(task.fd, task.ptr->ptr, task.length);
-                    } else {
-                        pwritea(task.fd, task.ptr->ptr + task.ptroffset, task.length, task.offset);
-                    }
-                    if (task.free_after) {
-                        // Threead-safe method of memory managment - ugly!
-                        if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
-                            free(task.ptr->ptr);
-                            delete task.ptr;
-                            if (task.closefd) {
-                                task.iomgr->close_session(task.session);
-                            }
-                        }
-                    }
-                   
-                    __sync_sub_and_fetch(&info->pending_writes, 1);
-                    info->m->stop_time(me, "commit_thr");
-                } else {
-                    if (task.compressed) {
-                        assert(task.offset == 0);
-                        read_compressed(task.fd, task.ptr->ptr, task.length);
-
-                    } else {
-                        preada(task.fd, task.ptr->ptr+task.ptroffset, task.length, task.offset);
-                    }
-                    __sync_sub_and_fetch(&info->pending_reads, 1);
-                    if (__sync_sub_and_fetch(&task.ptr->count, 1) == 0) {
-                        free(task.ptr);
-                        if (task.closefd) {
-                            task.iomgr->close_session(task.session);
-                        }
-                    }
+        }
+        // logstream(LOG_INFO) << "I/O thread exists. Handled " << ntasks << " i/o tasks." << std::endl;
+        return NULL;
+    }
+    
+    /**
+     * A task submitted to an asynchronous backend. Chunks that complete
+     * partially are resubmitted from where they left off.
+     */
+    struct async_iotask {
+        iotask task;
+        size_t transferred;
+        metrics_timer timer;
+        async_iotask(iotask & task, metrics_timer timer) : task(task), transferred(0), timer(timer) {}
+        
+        char * bufptr() {
+            return task.ptr->ptr + (task.compressed ? 0 : task.ptroffset) + transferred;
+        }
+        size_t fileoffset() {
+            return task.offset + transferred;
+        }
+    };
+    
+    /**
+     * Compressed blocks must be read and written as a whole through the block codec,
+     * so only plain reads and writes go to the asynchronous backend.
+     */
+    static bool async_capable(iotask & task) {
+#ifdef GRAPHCHI_DISABLE_COMPRESSION
+        return !task.compressed || task.action == READ;
+#else
+        return !task.compressed;
+#endif
+    }
+    
+    /**
+     * I/O thread loop for asynchronous backends: keeps up to backend->capacity()
+     * requests in flight and completes them as the kernel reports them.
+     */
+    static void * io_thread_loop_async(void * _info) {
+        thrinfo * info = (thrinfo*)_info;
+        iobackend * backend = info->backend;
+        int capacity = backend->capacity();
+        int inflight = 0;
+        std::vector<io_completion> completions(capacity);
+        iotask task;
+        
+        while(info->running || inflight > 0) {
+            /* Fill the queue */
+            while(inflight < capacity && pop_iotask(info, task)) {
+                metrics_timer t = info->m->start_timer();
+                if (!async_capable(task)) {
+                    execute_iotask(task);
+                    info->record_latency(t, task.action == WRITE);
+                    finish_iotask(task, info);
+                    continue;
+                }
+                async_iotask * atask = new async_iotask(task, t);
+                backend->submit(task.fd, task.action == WRITE, atask->bufptr(), task.length, task.offset, atask);
+                inflight++;
+            }
+            if (inflight == 0) {
+                wait_for_iotasks(info);
+                continue;
+            }
+            
+            /* Block only if there is nothing more to submit */
+            bool block = (inflight == capacity || !info->has_tasks());
+            int n = backend->reap(&completions[0], capacity, block);
+            for(int i=0; i < n; i++) {
+                async_iotask * atask = (async_iotask *) completions[i].cookie;
+                ssize_t res = completions[i].result;
+                if (res <= 0) {
+                    logstream(LOG_ERROR) << "Asynchronous " << (atask->task.action == WRITE ? "write" : "read") << " failed: "
+                    << (res < 0 ? strerror((int) -res) : "unexpected end of file") << "; file-desc: " << atask->task.fd
+                    << " nbytes: " << atask->task.length << " off: " << atask->task.offset << std::endl;
+                    assert(false);
                 }
-                if (task.doneptr != NULL) {
-                    __sync_sub_and_fetch(task.doneptr, 1);
+                atask->transferred += res;
+                if (atask->transferred < atask->task.length) {
+                    // Partial transfer: continue
+                    backend->submit(atask->task.fd, atask->task.action == WRITE, atask->bufptr(),
+                                    atask->task.length - atask->transferred, atask->fileoffset(), atask);
+                    continue;
                 }
-            } else {
-                usleep(50000); // 50 ms
+                info->record_latency(atask->timer, atask->task.action == WRITE);
+                finish_iotask(atask->task, info);
+                delete atask;
+                inflight--;
             }
         }
-        // logstream(LOG_INFO) << "I/O thread exists. Handled " << ntasks << " i/o tasks." << std::endl;
         return NULL;
     }
     
@@ -790,6 +1136,7 @@ namespace graphchi {
          */
         if (task->iomgr->pinned_session(task->session)) {
             __sync_add_and_fetch(&task->curpos, task->len);
+            task->iomgr->notify_completion();
             return NULL;
         }
         tbuf = *task->buf;
@@ -797,6 +1144,7 @@ namespace graphchi {
             size_t toread = std::min((size_t)task->len - (size_t)task->curpos, (size_t)bufsize);
             task->iomgr->preada_now(task->session, tbuf + task->curpos, toread, task->curpos);
             __sync_add_and_fetch(&task->curpos, toread);
+            task->iomgr->notify_completion();
         }
         
         gettimeofday(&end, NULL);
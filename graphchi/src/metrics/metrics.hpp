@@ -35,7 +35,10 @@
 #include <vector>
 #include <limits>
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "util/pthread_tools.hpp"
 #include "util/cmdopts.hpp"
@@ -45,6 +48,37 @@ namespace graphchi {
      
   enum metrictype {REAL, INTEGER, TIME, STRING, VECTOR};
     
+  /**
+   * Histograms of the handle-based metrics are HDR-style: values below
+   * 2^(SUBBITS+1) have a bucket each, and each larger power of two is split
+   * to 2^SUBBITS linear buckets, so a bucket is at most 1/8 of its values wide.
+   * Values are counted as integers, timings in nanoseconds. Values of
+   * 2^MAXBITS and more go to the last bucket.
+   */
+#define GRAPHCHI_METRICS_HIST_SUBBITS 3
+#define GRAPHCHI_METRICS_HIST_MAXBITS 42
+#define GRAPHCHI_METRICS_HIST_BUCKETS ((2 << GRAPHCHI_METRICS_HIST_SUBBITS) + \
+    ((GRAPHCHI_METRICS_HIST_MAXBITS - GRAPHCHI_METRICS_HIST_SUBBITS - 1) << GRAPHCHI_METRICS_HIST_SUBBITS))
+    
+  static inline int metrics_hist_bucket(uint64_t u) {
+      if (u < (2ull << GRAPHCHI_METRICS_HIST_SUBBITS)) return (int) u;
+      int e = 63 - __builtin_clzll(u);
+      if (e >= GRAPHCHI_METRICS_HIST_MAXBITS) return GRAPHCHI_METRICS_HIST_BUCKETS - 1;
+      int sub = (int) (u >> (e - GRAPHCHI_METRICS_HIST_SUBBITS)) & ((1 << GRAPHCHI_METRICS_HIST_SUBBITS) - 1);
+      return (2 << GRAPHCHI_METRICS_HIST_SUBBITS) + ((e - GRAPHCHI_METRICS_HIST_SUBBITS - 1) << GRAPHCHI_METRICS_HIST_SUBBITS) + sub;
+  }
+    
+  /**
+   * Midpoint of a bucket.
+   */
+  static inline double metrics_hist_value(int b) {
+      if (b < (2 << GRAPHCHI_METRICS_HIST_SUBBITS)) return (double) b;
+      int k = b - (2 << GRAPHCHI_METRICS_HIST_SUBBITS);
+      int shift = (k >> GRAPHCHI_METRICS_HIST_SUBBITS) + 1;
+      uint64_t lower = (uint64_t) ((1 << GRAPHCHI_METRICS_HIST_SUBBITS) + (k & ((1 << GRAPHCHI_METRICS_HIST_SUBBITS) - 1))) << shift;
+      return (double) lower + (double) (1ull << shift) / 2.0;
+  }
+    
   // Data structure for storing metric entries
   // NOTE: This data structure is not very optimal, should
   // of course use inheritance. But for this purpose,
@@ -58,10 +92,12 @@ namespace graphchi {
     metrictype valtype;
     std::string stringval;
     std::vector<double> v;
+    std::vector<size_t> hist; // Histogram of handle-based metrics, see metrics_cell
+    double histunit;          // Value of one histogram unit
     timeval start_time;
       double lasttime;
         
-    metrics_entry() {} 
+    metrics_entry() : histunit(1.0) {} 
         
     inline metrics_entry(double firstvalue, metrictype _valtype) {
       minvalue = firstvalue;
@@ -69,16 +105,19 @@ namespace graphchi {
       value = firstvalue;
       valtype = _valtype;
       cumvalue = value;
+      histunit = 1.0;
       count = 1;
       if (valtype == VECTOR) v.push_back(firstvalue);
     };
     inline metrics_entry(std::string svalue) {
       valtype = STRING;
+      histunit = 1.0;
       stringval = svalue;
     }
     inline metrics_entry(metrictype _valtype) {
       valtype = _valtype;
       count = 0;
+      histunit = 1.0;
       cumvalue = 0;
       value = 0;
       minvalue = std::numeric_limits<double>::max();
@@ -139,6 +178,32 @@ namespace graphchi {
       }
     }
     
+    inline bool has_histogram() const {
+      return !hist.empty();
+    }
+      
+    /**
+     * Approximate q-quantile of the values, for example 0.99 for the 99th percentile.
+     * Only for entries with a histogram.
+     */
+    inline double percentile(double q) const {
+      size_t total = 0;
+      for(size_t b=0; b < hist.size(); b++) total += hist[b];
+      if (total == 0) return 0.0;
+      size_t rank = (size_t) (q * total);
+      if (rank < q * total) rank++;
+      if (rank < 1) rank = 1;
+      size_t acc = 0;
+      for(size_t b=0; b < hist.size(); b++) {
+        acc += hist[b];
+        if (acc >= rank) {
+          double v = metrics_hist_value((int) b) * histunit;
+          return std::max(minvalue, std::min(maxvalue, v));
+        }
+      }
+      return maxvalue;
+    }
+    
     inline void timer_start() {
         gettimeofday(&start_time, NULL);
 
@@ -151,6 +216,121 @@ namespace graphchi {
     }
   };
  
+  /**
+   * Handle of a pre-registered metric, see metrics::register_metric().
+   */
+  typedef int metric_handle;
+    
+#define GRAPHCHI_METRICS_MAX_HANDLES 128
+#define GRAPHCHI_METRICS_MAX_THREADS 256
+    
+  /**
+   * Accumulator of one handle for one thread. Only the owning thread writes to it,
+   * so no locking or atomic instructions are needed. Timings are also counted in
+   * a histogram of nanoseconds, see metrics_hist_bucket(), which is allocated
+   * on the first value.
+   */
+  struct metrics_cell {
+      size_t count;
+      double sum;
+      double minvalue;
+      double maxvalue;
+      uint32_t * hist;
+      
+      inline void record(double x, bool timing) {
+          if (count == 0 || x < minvalue) minvalue = x;
+          if (count == 0 || x > maxvalue) maxvalue = x;
+          sum += x;
+          count++;
+          if (timing) {
+              if (hist == NULL) hist = (uint32_t *) calloc(GRAPHCHI_METRICS_HIST_BUCKETS, sizeof(uint32_t));
+              hist[metrics_hist_bucket(x > 0 ? (uint64_t) (x * 1e9) : 0)]++;
+          }
+      }
+      
+      inline void reset() {
+          count = 0;
+          sum = minvalue = maxvalue = 0;
+          if (hist != NULL) memset(hist, 0, GRAPHCHI_METRICS_HIST_BUCKETS * sizeof(uint32_t));
+      }
+  };
+    
+  /**
+   * Cells of all handles for one thread slot. Allocated separately for each slot
+   * and aligned to cache lines, so threads do not share lines.
+   */
+  struct metrics_thread_block {
+      metrics_cell cells[GRAPHCHI_METRICS_MAX_HANDLES];
+      
+      void reset() {
+          for(int h=0; h < GRAPHCHI_METRICS_MAX_HANDLES; h++) cells[h].reset();
+      }
+      
+      void free_histograms() {
+          for(int h=0; h < GRAPHCHI_METRICS_MAX_HANDLES; h++) free(cells[h].hist);
+      }
+  };
+    
+  /**
+   * Slots of the exited threads. A new thread takes a free slot before a new one,
+   * and keeps adding to the cells of the previous owner, so threads started for
+   * each shard, such as the stream readers, do not use up the slots.
+   */
+  struct metrics_slot_pool {
+      mutex lock;
+      pthread_key_t key;
+      int nslots;
+      int nfree;
+      int free_slots[GRAPHCHI_METRICS_MAX_THREADS];
+      
+      metrics_slot_pool() : nslots(0), nfree(0) {
+          pthread_key_create(&key, release_slot);
+      }
+      
+      int take() {
+          lock.lock();
+          int slot = (nfree > 0 ? free_slots[--nfree] : nslots++);
+          lock.unlock();
+          pthread_setspecific(key, (void *) (intptr_t) (slot + 1));
+          return slot;
+      }
+      
+      static void release_slot(void * p);
+  };
+    
+  /**
+   * The pool is never deleted, as threads may exit after the static destructors.
+   */
+  inline metrics_slot_pool & metrics_slots() {
+      static metrics_slot_pool * pool = new metrics_slot_pool();
+      return *pool;
+  }
+    
+  inline void metrics_slot_pool::release_slot(void * p) {
+      int slot = (int) (intptr_t) p - 1;
+      if (slot >= GRAPHCHI_METRICS_MAX_THREADS) return; // Overflow slots are not reused
+      metrics_slot_pool & pool = metrics_slots();
+      pool.lock.lock();
+      pool.free_slots[pool.nfree++] = slot;
+      pool.lock.unlock();
+  }
+    
+  /**
+   * Index of the calling thread for the per-thread blocks.
+   */
+  inline int metrics_thread_slot() {
+      static __thread int slot = -1;
+      if (slot < 0) slot = metrics_slots().take();
+      return slot;
+  }
+    
+  /**
+   * Start time of a handle-based timing. Cheaper to take than a metrics_entry.
+   */
+  struct metrics_timer {
+      timespec start;
+  };
+    
   class imetrics_reporter {
         
     public:
@@ -167,16 +347,194 @@ namespace graphchi {
     std::string name, ident;
     std::map<std::string, metrics_entry> entries;
       mutex mlock;
+      
+      /* Handle-based metrics */
+      std::string handle_keys[GRAPHCHI_METRICS_MAX_HANDLES];
+      metrictype handle_types[GRAPHCHI_METRICS_MAX_HANDLES];
+      volatile int nhandles;
+      metrics_thread_block * volatile thread_blocks[GRAPHCHI_METRICS_MAX_THREADS];
+      metrics_thread_block overflow_block; // Threads beyond the maximum, guarded by mlock
+      
+      void init_handles() {
+          nhandles = 0;
+          memset((void*)thread_blocks, 0, sizeof(thread_blocks));
+          memset(&overflow_block, 0, sizeof(overflow_block));
+      }
+      
+      void copy_handles(const metrics & other) {
+          for(int h=0; h < other.nhandles; h++) {
+              handle_keys[h] = other.handle_keys[h];
+              handle_types[h] = other.handle_types[h];
+          }
+          nhandles = other.nhandles;
+      }
+      
+      metrics_thread_block * allocate_block(int slot) {
+          void * ptr = NULL;
+          int err = posix_memalign(&ptr, 64, sizeof(metrics_thread_block));
+          assert(err == 0);
+          memset(ptr, 0, sizeof(metrics_thread_block));
+          thread_blocks[slot] = (metrics_thread_block *) ptr;
+          return (metrics_thread_block *) ptr;
+      }
+      
+      static void merge_cell(metrics_entry & ent, metrics_cell & c) {
+          if (c.count == 0) return;
+          if (ent.count == 0) {
+              ent.minvalue = c.minvalue;
+              ent.maxvalue = c.maxvalue;
+          } else {
+              ent.minvalue = std::min(ent.minvalue, c.minvalue);
+              ent.maxvalue = std::max(ent.maxvalue, c.maxvalue);
+          }
+          ent.count += c.count;
+          ent.value += c.sum;
+          ent.cumvalue += c.sum;
+          if (c.hist == NULL) return;
+          ent.histunit = 1e-9;
+          if (ent.hist.size() < GRAPHCHI_METRICS_HIST_BUCKETS) ent.hist.resize(GRAPHCHI_METRICS_HIST_BUCKETS, 0);
+          for(int b=0; b < GRAPHCHI_METRICS_HIST_BUCKETS; b++) ent.hist[b] += c.hist[b];
+      }
         
   public: 
     inline metrics(std::string _name = "", std::string _id = "") : name(_name), ident (_id) {
+        init_handles();
         this->set("app", _name);
     }
+      
+      /* Copies the aggregated values and the registrations, but not the per-thread blocks */
+      metrics(const metrics & other) : name(other.name), ident(other.ident) {
+          init_handles();
+          copy_handles(other);
+          entries = const_cast<metrics &>(other).snapshot();
+      }
+      
+      metrics & operator=(const metrics & other) {
+          if (this != &other) {
+              std::map<std::string, metrics_entry> snap = const_cast<metrics &>(other).snapshot();
+              clear();
+              copy_handles(other);
+              name = other.name;
+              ident = other.ident;
+              entries = snap;
+          }
+          return *this;
+      }
+      
+      ~metrics() {
+          for(int i=0; i < GRAPHCHI_METRICS_MAX_THREADS; i++) {
+              if (thread_blocks[i] != NULL) {
+                  thread_blocks[i]->free_histograms();
+                  free(thread_blocks[i]);
+              }
+          }
+          overflow_block.free_histograms();
+      }
 
     inline void clear() {
+      mlock.lock();
       entries.clear();
+      for(int i=0; i < GRAPHCHI_METRICS_MAX_THREADS; i++) {
+          if (thread_blocks[i] != NULL) thread_blocks[i]->reset();
+      }
+      overflow_block.reset();
+      mlock.unlock();
     }
       
+      /**
+       * Registers a metric for the handle-based functions, which only touch
+       * the calling thread's counters. Values are aggregated when reported.
+       * Registering the same key again returns the same handle.
+       */
+      metric_handle register_metric(std::string key, metrictype type = REAL) {
+          assert(type == REAL || type == INTEGER || type == TIME);
+          mlock.lock();
+          for(int h=0; h < nhandles; h++) {
+              if (handle_keys[h] == key) {
+                  mlock.unlock();
+                  return h;
+              }
+          }
+          assert(nhandles < GRAPHCHI_METRICS_MAX_HANDLES);
+          int h = nhandles;
+          handle_keys[h] = key;
+          handle_types[h] = type;
+          __sync_synchronize();
+          nhandles = h + 1;
+          mlock.unlock();
+          return h;
+      }
+      
+      inline void add(metric_handle h, double value) {
+          assert(h >= 0 && h < nhandles);
+          int slot = metrics_thread_slot();
+          if (slot >= GRAPHCHI_METRICS_MAX_THREADS) {
+              mlock.lock();
+              overflow_block.cells[h].record(value, handle_types[h] == TIME);
+              mlock.unlock();
+              return;
+          }
+          metrics_thread_block * block = thread_blocks[slot];
+          if (block == NULL) block = allocate_block(slot);
+          block->cells[h].record(value, handle_types[h] == TIME);
+      }
+      
+      inline metrics_timer start_timer() {
+          metrics_timer t;
+          clock_gettime(CLOCK_MONOTONIC, &t.start);
+          return t;
+      }
+      
+      /**
+       * Seconds since start_timer().
+       */
+      inline double elapsed(metrics_timer t) {
+          timespec end;
+          clock_gettime(CLOCK_MONOTONIC, &end);
+          return (end.tv_sec - t.start.tv_sec) + (end.tv_nsec - t.start.tv_nsec) * 1e-9;
+      }
+      
+      /**
+       * Records the time since start_timer() in seconds, and returns it.
+       */
+      inline double stop_timer(metrics_timer t, metric_handle h) {
+          double secs = elapsed(t);
+          add(h, secs);
+          return secs;
+      }
+      
+      /**
+       * Entries of the string-keyed functions merged with the aggregated
+       * handle-based metrics.
+       */
+      std::map<std::string, metrics_entry> snapshot() {
+          mlock.lock();
+          std::map<std::string, metrics_entry> snap = entries;
+          for(int h=0; h < nhandles; h++) {
+              metrics_entry agg(handle_types[h]);
+              for(int i=0; i < GRAPHCHI_METRICS_MAX_THREADS; i++) {
+                  if (thread_blocks[i] != NULL) merge_cell(agg, thread_blocks[i]->cells[h]);
+              }
+              merge_cell(agg, overflow_block.cells[h]);
+              if (agg.count == 0) continue;
+              
+              if (snap.count(handle_keys[h]) == 0) {
+                  snap[handle_keys[h]] = agg;
+              } else {
+                  metrics_entry & ent = snap[handle_keys[h]];
+                  ent.minvalue = std::min(ent.minvalue, agg.minvalue);
+                  ent.maxvalue = std::max(ent.maxvalue, agg.maxvalue);
+                  ent.count += agg.count;
+                  ent.value += agg.value;
+                  ent.cumvalue += agg.cumvalue;
+                  ent.hist = agg.hist;  // Only the handle-based values are bucketed
+                  ent.histunit = agg.histunit;
+              }
+          }
+          mlock.unlock();
+          return snap;
+      }
+      
       
       inline std::string iterkey(std::string key, int iter) {
           char s[256];
@@ -206,10 +564,12 @@ namespace graphchi {
     }
 
     inline void add_vector_entry(std::string key, size_t idx, double value) {
+       mlock.lock();
        if (entries.count(key) == 0) {
          entries[key] = metrics_entry(VECTOR);
        }
        entries[key].add_vector_entry(idx, value);
+       mlock.unlock();
     }
     
     inline void set(std::string key, size_t value) {
@@ -324,13 +684,14 @@ namespace graphchi {
       }
         
     inline metrics_entry get(std::string key) {
-      return entries[key];
+      return snapshot()[key];
     }
       
       
     void report(imetrics_reporter & reporter) {
           if (name != "") {
-              reporter.do_report(name, ident, entries);
+              std::map<std::string, metrics_entry> snap = snapshot();
+              reporter.do_report(name, ident, snap);
           }
       }
       
@@ -85,7 +85,12 @@ namespace graphchi {
               if (ent.count>1) {
                 std::cout << ent.value << "s\t (count: " << ent.count << ", min: " << ent.minvalue <<
                   "s, " << "max: " << ent.maxvalue << ", avg: " 
-                          << ent.cumvalue/(double)ent.count << "s)" << std::endl;
+                          << ent.cumvalue/(double)ent.count << "s";
+                if (ent.has_histogram()) {
+                  std::cout << ", p50: " << ent.percentile(0.5) << "s, p99: " << ent.percentile(0.99)
+                            << "s, p99.9: " << ent.percentile(0.999) << "s";
+                }
+                std::cout << ")" << std::endl;
               } else {
                 std::cout << ent.value << " s" << std::endl;
               }
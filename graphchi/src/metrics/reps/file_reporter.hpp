@@ -56,6 +56,13 @@ namespace graphchi {
     }
       
       virtual ~file_reporter() {}
+      
+      void write_percentiles(std::string ident, std::string key, metrics_entry & ent) {
+          if (!ent.has_histogram()) return;
+          fprintf(f, "%s.%s.p50=%lf\n", ident.c_str(), key.c_str(), ent.percentile(0.5));
+          fprintf(f, "%s.%s.p99=%lf\n", ident.c_str(), key.c_str(), ent.percentile(0.99));
+          fprintf(f, "%s.%s.p999=%lf\n", ident.c_str(), key.c_str(), ent.percentile(0.999));
+      }
             
       virtual void do_report(std::string name, std::string ident, std::map<std::string, metrics_entry> & entries) {
           if (ident != name) {
@@ -75,6 +82,7 @@ namespace graphchi {
                       fprintf(f, "%s.%s.min=%ld\n", ident.c_str(), it->first.c_str(), (long int) (ent.minvalue));
                       fprintf(f, "%s.%s.max=%ld\n", ident.c_str(), it->first.c_str(), (long int) (ent.maxvalue));
                       fprintf(f, "%s.%s.avg=%lf\n", ident.c_str(), it->first.c_str(), ent.cumvalue/ent.count);
+                      write_percentiles(ident, it->first, ent);
                       break;
                   case REAL:
                   case TIME:
@@ -83,11 +91,15 @@ namespace graphchi {
                       fprintf(f, "%s.%s.min=%lf\n", ident.c_str(), it->first.c_str(),  (ent.minvalue));
                       fprintf(f, "%s.%s.max=%lf\n", ident.c_str(), it->first.c_str(),  (ent.maxvalue));
                       fprintf(f, "%s.%s.avg=%lf\n", ident.c_str(), it->first.c_str(), ent.cumvalue/ent.count);
+                      write_percentiles(ident, it->first, ent);
                       break;
                   case STRING:
                       fprintf(f, "%s.%s=%s\n", ident.c_str(), it->first.c_str(), it->second.stringval.c_str());                                
                       break;
                   case VECTOR:
+                      fprintf(f, "%s.%s.values=", ident.c_str(), it->first.c_str());
+                      for(size_t j=0; j < ent.v.size(); j++) fprintf(f, "%s%lf", (j > 0 ? "," : ""), ent.v[j]);
+                      fprintf(f, "\n");
                       break;
               }
           }
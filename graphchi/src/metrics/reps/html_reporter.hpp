@@ -66,6 +66,14 @@ namespace graphchi {
                 fclose(f);
             }
             
+            void write_percentiles(metrics_entry & ent) {
+                if (ent.has_histogram()) {
+                    fprintf(f, "<td>%.6lf</td>\n", ent.percentile(0.5));
+                    fprintf(f, "<td>%.6lf</td>\n", ent.percentile(0.99));
+                    fprintf(f, "<td>%.6lf</td>\n", ent.percentile(0.999));
+                } else fprintf(f, "<td colspan=3>&nbsp;</td>");
+            }
+            
             virtual void do_report(std::string name, std::string ident, std::map<std::string, metrics_entry> & entries) {
                 if (ident != name) {
                     fprintf(f, "<h3>%s:%s</h3>\n", name.c_str(), ident.c_str());
@@ -86,7 +94,7 @@ namespace graphchi {
                             case INTEGER:
                                 if (round == 0) {   
                                     if (c++ == 0)
-                                        fprintf(f, "<table><tr><th>Key</th><th>Value</th><th>Count</th><th>Min</th><th>Max</th><th>Average</th></tr>");
+                                        fprintf(f, "<table><tr><th>Key</th><th>Value</th><th>Count</th><th>Min</th><th>Max</th><th>Average</th><th>p50</th><th>p99</th><th>p99.9</th></tr>");
                                         
                                     fprintf(f, "<tr><td>%s</td>\n",  it->first.c_str());
                                     
@@ -97,18 +105,19 @@ namespace graphchi {
                                         fprintf(f, "<td>%ld</td>\n", (long int) ent.maxvalue);
                                         fprintf(f, "<td>%.3lf</td>\n",  ent.cumvalue/(double)ent.count);
                                      } else fprintf(f, "<td colspan=4>&nbsp;</td>");
+                                     write_percentiles(ent);
                                      fprintf(f, "</tr>");
                                 }
                                 break;
                             case REAL:
                                if (round == 0) {   
                                     if (c++ == 0)
-                                        fprintf(f, "<table><tr><th>Key</th><th>Value</th><th>Count</th><th>Min</th><th>Max</th><th>Average</th></tr>");
+                                        fprintf(f, "<table><tr><th>Key</th><th>Value</th><th>Count</th><th>Min</th><th>Max</th><th>Average</th><th>p50</th><th>p99</th><th>p99.9</th></tr>");
                                }
                             case TIME:
                                 if (ent.valtype == TIME && round == 1) {
                                     if (c++ == 0) 
-                                         fprintf(f, "<table><tr><th>Key</th><th>Value (sec)</th><th>Count</th><th>Min (sec)</th><th>Max (sec)</th><th>Average (sec)</th></tr>\n");
+                                         fprintf(f, "<table><tr><th>Key</th><th>Value (sec)</th><th>Count</th><th>Min (sec)</th><th>Max (sec)</th><th>Average (sec)</th><th>p50 (sec)</th><th>p99 (sec)</th><th>p99.9 (sec)</th></tr>\n");
                                 }
                                 if ((round == 0 && ent.valtype == REAL)||(round == 1 && ent.valtype == TIME)) {
                                     fprintf(f, "<tr><td>%s</td>\n",  it->first.c_str());
@@ -120,6 +129,7 @@ namespace graphchi {
                                         fprintf(f, "<td>%.3lf</td>\n",  ent.maxvalue);
                                         fprintf(f, "<td>%.3lf</td>\n",  ent.cumvalue/(double)ent.count);
                                     } else fprintf(f, "<td colspan=4>&nbsp;</td>");
+                                    write_percentiles(ent);
                                     fprintf(f, "</tr>");
                                 } 
                                 break;
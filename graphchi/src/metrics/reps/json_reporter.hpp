@@ -0,0 +1,140 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * JSON metrics reporter. Writes one object per report:
+ * {"name": ..., "ident": ..., "metrics": {key: {"type": ..., "value": ..., ...}}}
+ * Entries with a histogram also have p50, p99 and p999.
+ */
+
+#ifndef GRAPHCHI_JSON_REPORTER
+#define GRAPHCHI_JSON_REPORTER
+
+#include <cstdio>
+#include <cmath>
+
+#include "metrics/metrics.hpp"
+
+namespace graphchi {
+
+    class json_reporter : public imetrics_reporter {
+    private:
+        json_reporter() {}
+
+        std::string filename;
+        FILE * f;
+        int nreports;
+
+        void write_string(std::string s) {
+            fputc('"', f);
+            for(size_t i=0; i < s.size(); i++) {
+                unsigned char c = (unsigned char) s[i];
+                if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+                else if (c < 0x20) fprintf(f, "\\u%04x", c);
+                else fputc(c, f);
+            }
+            fputc('"', f);
+        }
+
+        /* JSON has no representation for NaN or infinity */
+        void write_number(double x) {
+            if (std::isfinite(x)) fprintf(f, "%.9g", x);
+            else fprintf(f, "null");
+        }
+
+        void write_field(const char * key, double x) {
+            fprintf(f, ", \"%s\": ", key);
+            write_number(x);
+        }
+
+    public:
+
+        json_reporter(std::string fname) : filename(fname), nreports(0) {
+            f = fopen(fname.c_str(), "w");
+            assert(f != NULL);
+            fprintf(f, "[\n");
+        }
+
+        virtual ~json_reporter() {
+            fprintf(f, "\n]\n");
+            fclose(f);
+        }
+
+        virtual void do_report(std::string name, std::string ident, std::map<std::string, metrics_entry> & entries) {
+            fprintf(f, "%s{\"name\": ", (nreports++ > 0 ? ",\n" : ""));
+            write_string(name);
+            fprintf(f, ", \"ident\": ");
+            write_string(ident);
+            fprintf(f, ", \"metrics\": {");
+
+            std::map<std::string, metrics_entry>::iterator it;
+            int c = 0;
+            for(it = entries.begin(); it != entries.end(); ++it) {
+                metrics_entry & ent = it->second;
+                fprintf(f, "%s\n  ", (c++ > 0 ? "," : ""));
+                write_string(it->first);
+                fprintf(f, ": {\"type\": ");
+                switch(ent.valtype) {
+                    case INTEGER:
+                    case REAL:
+                    case TIME:
+                        fprintf(f, "\"%s\", \"value\": ", (ent.valtype == INTEGER ? "integer" : (ent.valtype == REAL ? "real" : "time")));
+                        write_number(ent.value);
+                        fprintf(f, ", \"count\": %lu", (unsigned long) ent.count);
+                        if (ent.count > 0) {
+                            write_field("min", ent.minvalue);
+                            write_field("max", ent.maxvalue);
+                            write_field("avg", ent.cumvalue / ent.count);
+                        }
+                        if (ent.has_histogram()) {
+                            write_field("p50", ent.percentile(0.5));
+                            write_field("p99", ent.percentile(0.99));
+                            write_field("p999", ent.percentile(0.999));
+                        }
+                        break;
+                    case STRING:
+                        fprintf(f, "\"string\", \"value\": ");
+                        write_string(ent.stringval);
+                        break;
+                    case VECTOR:
+                        fprintf(f, "\"vector\", \"value\": ");
+                        write_number(ent.value);
+                        fprintf(f, ", \"values\": [");
+                        for(size_t j=0; j < ent.v.size(); j++) {
+                            if (j > 0) fprintf(f, ", ");
+                            write_number(ent.v[j]);
+                        }
+                        fprintf(f, "]");
+                        break;
+                }
+                fprintf(f, "}");
+            }
+            fprintf(f, "\n}}");
+            fflush(f);
+        }
+    };
+
+};
+
+
+#endif
@@ -41,8 +41,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <vector>
+#include <queue>
 #include <omp.h>
 #include <errno.h>
 #include <sstream>
@@ -58,6 +60,7 @@
 #include "metrics/reps/basic_reporter.hpp"
 #include "preprocessing/formats/binary_adjacency_list.hpp"
 #include "shards/memoryshard.hpp"
+#include "shards/shardindex.hpp"
 #include "shards/slidingshard.hpp"
 #include "util/ioutil.hpp"
 #include "util/qsort.hpp"
@@ -93,6 +96,16 @@ namespace graphchi {
         bool stopper() { return src == 0 && dst == 0; }
     };
     
+    /**
+     * Edge waiting in the k-way merge of shovel runs.
+     */
+    template <typename EdgeDataType>
+    struct merge_head {
+        edge_with_value<EdgeDataType> edge;
+        int run;
+        merge_head(edge_with_value<EdgeDataType> edge, int run) : edge(edge), run(run) {}
+    };
+    
     template <typename EdgeDataType>
     bool edge_t_src_less(const edge_with_value<EdgeDataType> &a, const edge_with_value<EdgeDataType> &b) {
         if (a.src == b.src) {
@@ -106,6 +119,16 @@ namespace graphchi {
         return a.src < b.src;
     }
     
+    /* Orders the priority queue of the k-way merge so that the smallest edge is on top */
+    template <typename EdgeDataType>
+    struct merge_head_greater {
+        bool operator()(const merge_head<EdgeDataType> &a, const merge_head<EdgeDataType> &b) const {
+            if (edge_t_src_less<EdgeDataType>(b.edge, a.edge)) return true;
+            if (edge_t_src_less<EdgeDataType>(a.edge, b.edge)) return false;
+            return a.run > b.run;
+        }
+    };
+    
     template <typename EdgeDataType>
     class sharder {
         
@@ -139,6 +162,14 @@ namespace graphchi {
         
         vid_t filter_max_vertex;
         
+        /* Edge data blocks waiting to be compressed, see edata_flush() */
+        struct edata_block {
+            char * data;
+            int len;
+            int blockid;
+        };
+        std::vector<edata_block> pending_edata_blocks;
+        
         bool no_edgevalues;
 #ifdef DYNAMICEDATA
         edge_t last_added_edge;
@@ -157,7 +188,7 @@ namespace graphchi {
             filter_max_vertex = 0;
             while (compressed_block_size % sizeof(EdgeDataType) != 0) compressed_block_size++;
             edges_per_block = compressed_block_size / sizeof(EdgeDataType);
-
+            set_default_block_codec(get_option_string("io.codec", "zlib"), get_option_int("io.codec.level", -1));
         }
         
         
@@ -269,27 +300,45 @@ namespace graphchi {
         
         int blockid;
         
+        /**
+         * Queues the block for compression. Blocks are compressed in parallel
+         * when there is one for each thread, or when the shard is finished.
+         */
         template <typename T>
         void edata_flush(char * buf, char * bufptr, std::string & shard_filename, size_t totbytes) {
-            int len = (int) (bufptr - buf);
+            edata_block block;
+            block.len = (int) (bufptr - buf);
+            block.data = (char *) malloc(block.len);
+            block.blockid = blockid;
+            memcpy(block.data, buf, block.len);
+            pending_edata_blocks.push_back(block);
             
+            if ((int)pending_edata_blocks.size() >= omp_get_max_threads()) {
+                compress_pending_edata(shard_filename);
+            }
+            blockid++;
+        }
+        
+        void compress_pending_edata(std::string & shard_filename) {
             m.start_time("edata_flush");
-            
-            std::string block_filename = filename_shard_edata_block(shard_filename, blockid, compressed_block_size);
-            int f = open(block_filename.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-            write_compressed(f, buf, len);
-            close(f);
-            
-            m.stop_time("edata_flush");
-
-            
+            int nblocks = (int) pending_edata_blocks.size();
+#pragma omp parallel for schedule(dynamic, 1)
+            for(int i=0; i < nblocks; i++) {
+                edata_block & block = pending_edata_blocks[i];
+                std::string block_filename = filename_shard_edata_block(shard_filename, block.blockid, compressed_block_size);
+                int f = open(block_filename.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                write_compressed(f, block.data, block.len);
+                close(f);
+                remove(filename_block_tombstones(block_filename).c_str()); // New block has no deleted edges
+                
 #ifdef DYNAMICEDATA
-            // Write block's uncompressed size
-            write_block_uncompressed_size(block_filename, len);
-            
+                // Write block's uncompressed size
+                write_block_uncompressed_size(block_filename, block.len);
 #endif
-            
-            blockid++;
+                free(block.data);
+            }
+            pending_edata_blocks.clear();
+            m.stop_time("edata_flush");
         }
         
         template <typename T>
@@ -549,6 +598,12 @@ namespace graphchi {
             if (!flush)
                 bufs[shard][bufptrs[shard]++] = et;
             if (flush || bufptrs[shard] * sizeof(edge_t) >= bufsize) {
+                /* Each shovel block is written as a sorted run, so that they can be merged
+                 if the whole shovel does not fit in memory. */
+                m.start_time("shovel_sort");
+                parallel_sort(bufs[shard], (size_t) bufptrs[shard], edge_t_src_less<EdgeDataType>);
+                m.stop_time("shovel_sort");
+                
                 m.start_time("shovel_flush");
                 std::stringstream ss;
                 ss << shovel_filename(shard) << "." << shovelblocksidxs[shard];
@@ -593,25 +648,22 @@ namespace graphchi {
                     break;
                 case SHOVEL:
                     bool found=false;
-                    for(int i=0; i < nshards; i++) {
-                        int shard = (lastpart + i) % nshards;
-                        if (to >= intervals[shard].first && to <= intervals[shard].second) {
-                            edge_t e(from, to, value);
+                    int shard = find_shard(to);
+                    if (shard >= 0) {
+                        edge_t e(from, to, value);
 #ifdef DYNAMICEDATA
-                            e.is_chivec_value = input_value;
-                            // Keep track of multiple values for same edge
-                            if (last_added_edge.src == e.src && last_added_edge.dst == to) {
-                                e.valindex = last_added_edge.valindex + 1;
-                            }
-                            
-                            last_added_edge = e;
-#endif
-                            
-                            swrite(shard, e);
-                            lastpart = shard;  // Small optimizations, which works if edges are in order for each vertex - not much though
-                            found = true;
-                            break;
+                        e.is_chivec_value = input_value;
+                        // Keep track of multiple values for same edge
+                        if (last_added_edge.src == e.src && last_added_edge.dst == to) {
+                            e.valindex = last_added_edge.valindex + 1;
                         }
+                        
+                        last_added_edge = e;
+#endif
+                        
+                        swrite(shard, e);
+                        lastpart = shard;  // Small optimizations, which works if edges are in order for each vertex - not much though
+                        found = true;
                     }
                     if(!found) {
                         logstream(LOG_ERROR) << "Shard not found for : " << to << std::endl;
@@ -621,6 +673,28 @@ namespace graphchi {
             }
         }
         
+        /**
+         * Finds the shard whose interval contains the vertex, or returns -1.
+         * Checks the previous shard first, and then does a binary search.
+         */
+        int find_shard(vid_t to) {
+            if (to >= intervals[lastpart].first && to <= intervals[lastpart].second) {
+                return lastpart;
+            }
+            int lo = 0, hi = nshards - 1;
+            while (lo <= hi) {
+                int mid = (lo + hi) / 2;
+                if (to < intervals[mid].first) {
+                    hi = mid - 1;
+                } else if (to > intervals[mid].second) {
+                    lo = mid + 1;
+                } else {
+                    return mid;
+                }
+            }
+            return -1;
+        }
+        
         size_t read_shovel(int shard, char ** data) {
             m.start_time("read_shovel");
             size_t sz = shovelsizes[shard];
@@ -651,6 +725,101 @@ namespace graphchi {
         }
         
         
+        /**
+         * Merges the sorted runs of a shovel that does not fit in memory into one
+         * sorted file, which is then memory mapped. Each run is read through a
+         * buffer of its share of the memory budget.
+         */
+        size_t merge_shovel(int shard, char ** data, size_t membudget) {
+            m.start_time("merge_shovel");
+            size_t sz = shovelsizes[shard];
+            std::vector<int> runfds;
+            std::vector<std::string> runnames;
+            while(true) {
+                std::stringstream ss;
+                ss << shovel_filename(shard) << "." << runfds.size();
+                int f = open(ss.str().c_str(), O_RDONLY);
+                if (f < 0) break;
+                runfds.push_back(f);
+                runnames.push_back(ss.str());
+            }
+            int nruns = (int) runfds.size();
+            
+            /* Buffers for each run and for the output */
+            size_t runbufedges = std::max((size_t)1024, membudget / (nruns + 1) / sizeof(edge_t));
+            std::vector<edge_t *> runbufs(nruns);
+            std::vector<size_t> runpos(nruns, 0), runlen(nruns, 0), runoffset(nruns, 0);
+            std::vector<size_t> runsizes(nruns);
+            for(int r=0; r < nruns; r++) {
+                runbufs[r] = (edge_t *) malloc(runbufedges * sizeof(edge_t));
+                runsizes[r] = get_filesize(runnames[r]);
+            }
+            edge_t * outbuf = (edge_t *) malloc(runbufedges * sizeof(edge_t));
+            size_t outpos = 0;
+            
+            std::string mergedname = shovel_filename(shard) + ".merged";
+            int outf = open(mergedname.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (outf < 0) {
+                logstream(LOG_ERROR) << "Could not open " << mergedname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(outf >= 0);
+            
+            std::priority_queue<merge_head<EdgeDataType>, std::vector<merge_head<EdgeDataType> >,
+                merge_head_greater<EdgeDataType> > heads;
+            
+            /* Fill the buffers and queue the first edge of each run */
+            for(int r=0; r < nruns; r++) {
+                size_t len = std::min(runbufedges * sizeof(edge_t), runsizes[r]);
+                preada(runfds[r], runbufs[r], len, 0);
+                runlen[r] = len / sizeof(edge_t);
+                runoffset[r] = len;
+                if (runlen[r] > 0) heads.push(merge_head<EdgeDataType>(runbufs[r][0], r));
+            }
+            while(!heads.empty()) {
+                merge_head<EdgeDataType> top = heads.top();
+                heads.pop();
+                outbuf[outpos++] = top.edge;
+                if (outpos == runbufedges) {
+                    writea(outf, outbuf, outpos * sizeof(edge_t));
+                    outpos = 0;
+                }
+                int r = top.run;
+                if (++runpos[r] == runlen[r]) {
+                    size_t len = std::min(runbufedges * sizeof(edge_t), runsizes[r] - runoffset[r]);
+                    if (len > 0) preada(runfds[r], runbufs[r], len, runoffset[r]);
+                    runoffset[r] += len;
+                    runlen[r] = len / sizeof(edge_t);
+                    runpos[r] = 0;
+                }
+                if (runpos[r] < runlen[r]) {
+                    heads.push(merge_head<EdgeDataType>(runbufs[r][runpos[r]], r));
+                }
+            }
+            writea(outf, outbuf, outpos * sizeof(edge_t));
+            free(outbuf);
+            for(int r=0; r < nruns; r++) {
+                free(runbufs[r]);
+                close(runfds[r]);
+                remove(runnames[r].c_str());
+            }
+            
+            /* Map the merged shovel. It is read sequentially, so the OS can page it in and out. */
+            *data = NULL;
+            if (sz > 0) {
+                void * ptr = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, outf, 0);
+                if (ptr == MAP_FAILED) {
+                    logstream(LOG_ERROR) << "Could not mmap " << mergedname << " error: " << strerror(errno) << std::endl;
+                    assert(false);
+                }
+                madvise(ptr, sz, MADV_SEQUENTIAL);
+                *data = (char *) ptr;
+            }
+            close(outf);
+            remove(mergedname.c_str());  // The mapping remains valid
+            m.stop_time("merge_shovel");
+            return sz;
+        }
+        
         /**
          * Write the shard by sorting the shovel file and compressing the
          * adjacency information.
@@ -694,13 +863,28 @@ namespace graphchi {
                     mkdir(edblockdirname.c_str(), 0777);
                 
                 edge_t * shovelbuf;
-                size_t shovelsize = read_shovel(shard, (char**) &shovelbuf);
+                size_t shovelsize;
+                
+                /* Sorting in memory requires twice the size of the shovel */
+                bool external_merge = 2 * shovelsizes[shard] > size_t(membudget_mb) * 1024 * 1024;
+                if (!external_merge) {
+                    shovelsize = read_shovel(shard, (char**) &shovelbuf);
+                    
+                    /* Shovel blocks are sorted runs of bufsize bytes (except the last) */
+                    std::vector<size_t> runbounds;
+                    for(size_t off=0; off < shovelsize; off += bufsize) runbounds.push_back(off / sizeof(edge_t));
+                    runbounds.push_back(shovelsize / sizeof(edge_t));
+                    m.start_time("shovel_merge");
+                    merge_sorted_runs(shovelbuf, runbounds, edge_t_src_less<EdgeDataType>);
+                    m.stop_time("shovel_merge");
+                } else {
+                    logstream(LOG_INFO) << "Shovel does not fit in memory, merging " << shovelblocksidxs[shard] << " sorted runs." << std::endl;
+                    shovelsize = merge_shovel(shard, (char**) &shovelbuf, size_t(membudget_mb) * 1024 * 1024);
+                }
                 size_t numedges = shovelsize / sizeof(edge_t);
                 
                 logstream(LOG_DEBUG) << "Shovel size:" << shovelsize << " edges: " << numedges << std::endl;
                 
-                quickSort(shovelbuf, (int)numedges, edge_t_src_less<EdgeDataType>);
-                
                 // Create the final file
                 int f = open(fname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
                 if (f < 0) {
@@ -718,6 +902,11 @@ namespace graphchi {
                 char * ebufptr = ebuf;
                 
                 vid_t curvid=0;
+#ifndef DYNAMICEDATA
+                shard_index index;
+                vid_t lastindexed = 0;
+                size_t lastindexededge = 0;
+#endif
 #ifdef DYNAMICEDATA
                 vid_t lastdst = 0xffffffff;
                 int jumpover = 0;
@@ -751,7 +940,7 @@ namespace graphchi {
                         if (edge.is_chivec_value) {
                             // Need to check how many values for this edge
                             int count = 1;
-                            while(shovelbuf[i + count].valindex == count) { count++; }
+                            while(i + count < numedges && shovelbuf[i + count].valindex == count) { count++; }
                            
                             assert(count < 32768);
                             
@@ -828,6 +1017,15 @@ namespace graphchi {
                                     nz -= tnz;
                                 } while (nz>0);
                             }
+#ifndef DYNAMICEDATA
+                            /* The record of edge.src starts here */
+                            if (edge.src - lastindexed >= SHARD_INDEX_VERTICES || i - lastindexededge >= SHARD_INDEX_EDGES) {
+                                size_t adjoffset = (size_t) lseek(f, 0, SEEK_CUR) + (bufptr - buf);
+                                index.add(edge.src, adjoffset, i * sizeof(EdgeDataType));
+                                lastindexed = edge.src;
+                                lastindexededge = i;
+                            }
+#endif
                         }
                         curvid = edge.src;
                     }
@@ -836,12 +1034,20 @@ namespace graphchi {
                 /* Flush buffers and free memory */
                 writea(f, buf, bufptr - buf);
                 free(buf);
-                free(shovelbuf);
+#ifndef DYNAMICEDATA
+                index.save(fname, (size_t) lseek(f, 0, SEEK_CUR), sizeof(EdgeDataType));
+#endif
+                if (!external_merge) {
+                    free(shovelbuf);
+                } else if (shovelbuf != NULL) {
+                    munmap(shovelbuf, shovelsize);
+                }
                 close(f);
                 
                 /* Write edata size file */
                 if (!no_edgevalues) {
                     edata_flush<EdgeDataType>(ebuf, ebufptr, edfname, tot_edatabytes);
+                    compress_pending_edata(edfname);
                     
                     std::string sizefilename = edfname + ".size";
                     std::ofstream ofs(sizefilename.c_str());
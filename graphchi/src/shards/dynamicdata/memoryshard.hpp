@@ -118,6 +118,7 @@ namespace graphchi {
             }
             dynamicblocks.clear();
             if (adj_session >= 0) {
+                iomgr->join_stream_reader(&adj_stream_session);
                 if (adjdata != NULL) iomgr->managed_release(adj_session, &adjdata);
                 iomgr->close_session(adj_session);
             }
@@ -186,6 +187,7 @@ namespace graphchi {
             }
             m.stop_time(cm, "memshard_commit");
             
+            iomgr->join_stream_reader(&adj_stream_session);
             iomgr->managed_release(adj_session, &adjdata);
             // FIXME: this is duplicated code from destructor
             for(int i=0; i < nblocks; i++) {
@@ -197,10 +199,33 @@ namespace graphchi {
             is_loaded = false;
         }
         
+#ifdef SUPPORT_DELETIONS
+        /* Edge deletions are not supported with dynamic edge data */
+        void resolve_deletions() {}
+#endif
+        
         bool loaded() {
             return is_loaded;
         }
         
+        /**
+         * Writes the edge data, keeping it loaded. Used for checkpoints of
+         * the in-memory mode.
+         */
+        void write_edata() {
+            if (!is_loaded || only_adjacency) return;
+            for(int i=0; i < (int) block_edatasessions.size(); i++) {
+                dynamicdata_block<ET> * dynblock = dynamicblocks[i];
+                if (dynblock == NULL) continue;
+                uint8_t * outdata;
+                int outsize;
+                dynblock->write(&outdata, outsize);
+                write_block_uncompressed_size(filename_shard_edata_block(filename_edata, i, blocksize), outsize);
+                iomgr->managed_pwritea_now(block_edatasessions[i], &outdata, outsize, 0);
+                free(outdata);
+            }
+        }
+        
     private:
         
         /* Dynamic edata */ 
@@ -263,11 +288,6 @@ namespace graphchi {
             adjfilesize = get_filesize(filename_adj);
             edatafilesize = get_shard_edata_filesize<ET>(filename_edata);            
             
-#ifdef SUPPORT_DELETIONS
-            async_inedgedata_loading = false;  // Currently we encode the deleted status of an edge into the edge value (should be changed!),
-            // so we need the edge data while loading
-#endif
-            
             //preada(adjf, adjdata, adjfilesize, 0);
             
             adj_session = iomgr->open_session(filename_adj, true);
@@ -284,12 +304,7 @@ namespace graphchi {
         
         /* Dynamic edata */ 
         inline void check_stream_progress(int toread, size_t pos) {
-            if (adj_stream_session.curpos == adjfilesize) return;
-            
-            while(adj_stream_session.curpos < toread+pos) {
-                usleep(20000);
-                if (adj_stream_session.curpos == adjfilesize) return;
-            }
+            iomgr->wait_for_stream(&adj_stream_session, toread+pos);
         }
         
         /* Dynamic edata */ 
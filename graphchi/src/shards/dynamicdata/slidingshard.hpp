@@ -48,6 +48,7 @@
 
 #include "api/dynamicdata/chivector.hpp"
 #include "shards/dynamicdata/dynamicblock.hpp"
+#include "shards/shardindex.hpp"
 
 
 namespace graphchi {
@@ -131,11 +132,6 @@ namespace graphchi {
     };
     
     
-    struct indexentry {
-        size_t adjoffset, edataoffset;
-        indexentry(size_t a, size_t e) : adjoffset(a), edataoffset(e) {}
-    };
-    
     /*
      * Graph shard that is streamed. I.e, it can only read in one direction, a chunk
      * a time.
@@ -162,7 +158,7 @@ namespace graphchi {
         sblock<ET> * curadjblock;
         metrics &m;
         
-        std::map<int, indexentry> sparse_index; // Sparse index that can be created in the fly
+        shard_index sparse_index; // Sparse index that is created on the fly
         bool disable_writes;
         bool async_edata_loading;
         // bool need_read_outedges; // Disabled - does not work with compressed data: whole block needs to be read.
@@ -203,7 +199,6 @@ namespace graphchi {
             }
             
             adjfile_session = iomgr->open_session(filename_adj, true);
-            save_offset();
             
             async_edata_loading = false; // With dynamic edge data size, do not load
 
@@ -236,37 +231,35 @@ namespace graphchi {
         size_t get_edataoffset() { return edataoffset; }
         
         void save_offset() {
-            // Note, so that we can use the lower bound operation in map, we need
-            // to insert indices in reverse order
-            sparse_index.insert(std::pair<int, indexentry>(-((int)curvid), indexentry(adjoffset, edataoffset)));
+            sparse_index.add(curvid, adjoffset, edataoffset);
         }
         
+    public:
+        /**
+         * Moves to the closest indexed vertex at or before v, if it is
+         * after the current vertex. Vertices before v can then be skipped without reading them.
+         */
         void move_close_to(vid_t v) {
             if (curvid >= v) return;
             
-            std::map<int,indexentry>::iterator lowerbd_iter = sparse_index.lower_bound(-((int)v));
-            int closest_vid = -((int)lowerbd_iter->first);
-            assert(closest_vid>=0);
-            indexentry closest_offset = lowerbd_iter->second;
-            assert(closest_vid <= (int)v);
-            if (closest_vid > (int)curvid) {   /* Note: this will fail if we have over 2B vertices! */
+            const shard_index_entry &closest = sparse_index.closest(v);
+            assert(closest.vid <= v);
+            if (closest.vid > curvid) {
                 logstream(LOG_DEBUG)
-                << "Sliding shard, start: " << range_st << " moved to: " << closest_vid << " " << closest_offset.adjoffset << ", asked for : " << v << " was in: curvid= " << curvid  << " " << adjoffset << std::endl;
+                << "Sliding shard, start: " << range_st << " moved to: " << closest.vid << " " << closest.adjoffset << ", asked for : " << v << " was in: curvid= " << curvid  << " " << adjoffset << std::endl;
                 if (curblock != NULL) // Move the pointer - this may invalidate the curblock, but it is being checked later
-                    curblock->ptr += closest_offset.edataoffset - edataoffset;
+                    curblock->ptr += closest.edataoffset - edataoffset;
                 if (curadjblock != NULL)
-                    curadjblock->ptr += closest_offset.adjoffset - adjoffset;
-                curvid = (vid_t)closest_vid;
-                adjoffset = closest_offset.adjoffset;
-                edataoffset = closest_offset.edataoffset;
-                return;
-            } else {
-                // Do nothing - just continue from current pos.
-                return;
+                    curadjblock->ptr += closest.adjoffset - adjoffset;
+                curvid = (vid_t)closest.vid;
+                adjoffset = closest.adjoffset;
+                edataoffset = closest.edataoffset;
             }
-            
+            // Otherwise just continue from current pos.
         }
         
+    protected:
+        
         inline void check_curblock(size_t toread) {
             if (curblock == NULL || curblock->end < edataoffset+toread) {
                 if (curblock != NULL) {
@@ -348,28 +341,49 @@ namespace graphchi {
     public:
         /**
          * Read out-edges for vertices.
+         * If keep_previous is true, the blocks of the previous window are not
+         * released, because its vertices may still be updated. Call
+         * release_prior_to_window() after they have finished.
          */
-        void read_next_vertices(int nvecs, vid_t start,  std::vector<svertex_t> & prealloc, bool record_index=false, bool disable_writes=false)  {
+        void read_next_vertices(int nvecs, vid_t start,  std::vector<svertex_t> & prealloc, bool record_index=false, bool disable_writes=false,
+                                bool keep_previous=false, const std::vector<vid_t> * scheduled=NULL)  {
             metrics_entry me = m.start_time();
             if (!record_index)
                 move_close_to(start);
             
             /* Release the blocks we do not need anymore */
             curblock = NULL;
-            release_prior_to_offset(false, disable_writes);
-            assert(activeblocks.size() <= 1);
+            if (!keep_previous) {
+                release_prior_to_offset(false, disable_writes);
+                assert(activeblocks.size() <= 1);
+            }
             
-            /* Read next */
+            /* Read next. The last block may be shared with the previous window. */
             if (!activeblocks.empty() && !only_adjacency) {
-                curblock = &activeblocks[0];
+                curblock = &activeblocks[activeblocks.size() - 1];
+                /* The shard may have been moved forward after the block was read */
+                curblock->ptr = curblock->data + (edataoffset - curblock->offset);
             }
             vid_t lastrec = start;
             window_start_edataoffset = edataoffset;
+            size_t nextsched = 0;
+            vid_t checked_target = 0;
             
             for(int i=((int)curvid) - ((int)start); i<nvecs; i++) {
                 if (adjoffset >= adjfilesize) break;
                 
-                // TODO: skip unscheduled vertices.
+                /* Seek over the unscheduled vertices, if the index has an entry
+                   after the current vertex and at or before the next scheduled one. */
+                if (scheduled != NULL && !record_index) {
+                    while (nextsched < scheduled->size() && (*scheduled)[nextsched] < curvid) nextsched++;
+                    vid_t target = (nextsched < scheduled->size() ? (*scheduled)[nextsched] : start + (vid_t)nvecs);
+                    if (target > curvid && target != checked_target) {
+                        checked_target = target;
+                        move_close_to(target);
+                        i = ((int)curvid) - ((int)start);
+                        if (i >= nvecs || adjoffset >= adjfilesize) break;
+                    }
+                }
                 
                 int n;
                 if (record_index && (size_t)(curvid - lastrec) >= (size_t) std::max((int)100000, nvecs/16)) {
@@ -472,15 +486,29 @@ namespace graphchi {
          * Release blocks that come prior to the current offset/
          */
         void release_prior_to_offset(bool all=false, bool disable_writes=false) { // disable writes is for the dynamic case
+            release_prior_to(edataoffset, all, disable_writes);
+        }
+        
+        /**
+         * Release blocks that come prior to the window read last. Used with
+         * read_next_vertices(..., keep_previous=true).
+         */
+        void release_prior_to_window(bool disable_writes=false) {
+            release_prior_to(window_start_edataoffset, false, disable_writes);
+        }
+        
+    protected:
+        void release_prior_to(size_t offset, bool all, bool disable_writes) {
             for(int i=(int)activeblocks.size() - 1; i >= 0; i--) {
                 sblock<ET> &b = activeblocks[i];
-                if (b.end <= edataoffset || all) {
+                if (b.end <= offset || all) {
                     commit(b, all, disable_writes);
                     activeblocks.erase(activeblocks.begin() + (unsigned int)i);
                 }
             }
         }
         
+    public:
         std::string get_info_json() {
             std::stringstream json;
             json << "\"size\": ";
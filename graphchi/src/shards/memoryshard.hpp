@@ -43,10 +43,16 @@
 #include <assert.h>
 #include <string>
 
+#include "api/csr_vertex.hpp"
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/shardindex.hpp"
+
+#ifdef SUPPORT_DELETIONS
+#include "shards/tombstones.hpp"
+#endif
 
 
 namespace graphchi {
@@ -85,6 +91,10 @@ namespace graphchi {
         bool is_loaded;
         size_t blocksize;
         metrics &m;
+        shard_index index;
+#ifdef SUPPORT_DELETIONS
+        edge_tombstones * tombstones;
+#endif
         
     public:
         bool only_adjacency;
@@ -106,12 +116,15 @@ namespace graphchi {
             doneptr = NULL;
             async_edata_loading = !svertex_t().computational_edges();
 #ifdef SUPPORT_DELETIONS
-            async_edata_loading = false; // See comment above for memshard, async_edata_loading = false;
+            tombstones = NULL;
 #endif
         }
         
         ~memory_shard() {
             int nblocks = (int) block_edatasessions.size();
+#ifdef SUPPORT_DELETIONS
+            if (nblocks > 0) resolve_deletions();
+#endif
             
             for(int i=0; i < nblocks; i++) {
                 if (edgedata[i] != NULL) {
@@ -120,6 +133,7 @@ namespace graphchi {
                 }
             }
             if (adj_session >= 0) {
+                iomgr->join_stream_reader(&adj_stream_session);
                 if (adjdata != NULL) iomgr->managed_release(adj_session, &adjdata);
                 iomgr->close_session(adj_session);
             }
@@ -143,6 +157,9 @@ namespace graphchi {
              * scattered all over the shard
              */
             int nblocks = (int) block_edatasessions.size();
+#ifdef SUPPORT_DELETIONS
+            resolve_deletions();
+#endif
             
             if (commit_inedges) {
                 int start_stream_block = (int) (range_start_edge_ptr / blocksize);
@@ -187,6 +204,7 @@ namespace graphchi {
             
             m.stop_time(cm, "memshard_commit");
             
+            iomgr->join_stream_reader(&adj_stream_session);
             iomgr->managed_release(adj_session, &adjdata);
             // FIXME: this is duplicated code from destructor
             for(int i=0; i < nblocks; i++) {
@@ -202,6 +220,37 @@ namespace graphchi {
             return is_loaded;
         }
         
+        /**
+         * Writes the edge data, keeping it loaded. Used for checkpoints of
+         * the in-memory mode.
+         */
+        void write_edata() {
+            if (!is_loaded || only_adjacency) return;
+#ifdef SUPPORT_DELETIONS
+            resolve_deletions();
+#endif
+            for(int i=0; i < (int) block_edatasessions.size(); i++) {
+                iomgr->managed_pwritea_now(block_edatasessions[i], &edgedata[i], blocksizes[i], 0);
+            }
+        }
+        
+#ifdef SUPPORT_DELETIONS
+        /**
+         * Marks the edges deleted by the updates so far, and saves the tombstones.
+         * Called before the blocks are released.
+         */
+        void resolve_deletions() {
+            if (edgedata == NULL) return;
+            for(int i=0; i < (int) block_edatasessions.size(); i++) {
+                if (edgedata[i] != NULL) {
+                    if (tombstones != NULL) tombstones->resolve_pending(i, edgedata[i], blocksizes[i]);
+                    assert_no_pending_deletions(edgedata[i], blocksizes[i]);
+                }
+            }
+            if (tombstones != NULL) tombstones->save();
+        }
+#endif
+        
     private:
         
         void load_edata() {
@@ -260,11 +309,6 @@ namespace graphchi {
             is_loaded = true;
             adjfilesize = get_filesize(filename_adj);
             
-#ifdef SUPPORT_DELETIONS
-            async_edata_loading = false;  // Currently we encode the deleted status of an edge into the edge value (should be changed!),
-            // so we need the edge data while loading
-#endif
-            
             //preada(adjf, adjdata, adjfilesize, 0);
             
             adj_session = iomgr->open_session(filename_adj, true);
@@ -272,22 +316,21 @@ namespace graphchi {
             adj_stream_session = streaming_task(iomgr, adj_session, adjfilesize, (char**) &adjdata);
             
             iomgr->launch_stream_reader(&adj_stream_session);
+            index.load(filename_adj, adjfilesize, sizeof(ET));
             /* Initialize edge data asynchonous reading */
             if (!only_adjacency) {
                 edatafilesize = get_shard_edata_filesize<ET>(filename_edata);
                 load_edata();
+#ifdef SUPPORT_DELETIONS
+                tombstones = get_edge_tombstones<ET>(filename_edata, blocksize);
+#endif
             }
         }
         
         
         
         inline void check_stream_progress(int toread, size_t pos) {
-            if (adj_stream_session.curpos == adjfilesize) return;
-            
-            while(adj_stream_session.curpos < toread+pos) {
-                usleep(20000);
-                if (adj_stream_session.curpos == adjfilesize) return;
-            }
+            iomgr->wait_for_stream(&adj_stream_session, toread+pos);
         }
         
         void load_vertices(vid_t window_st, vid_t window_en, std::vector<svertex_t> & prealloc, bool inedges=true, bool outedges=true) {
@@ -295,6 +338,9 @@ namespace graphchi {
             m.start_time("memoryshard_create_edges");
             
             assert(adjdata != NULL);
+#ifdef SUPPORT_DELETIONS
+            resolve_deletions();
+#endif
             
             // Now start creating vertices
             uint8_t * ptr = adjdata;
@@ -308,6 +354,14 @@ namespace graphchi {
             range_start_offset = adjfilesize;
             range_start_edge_ptr = edatafilesize;
             
+            /* Only out-edges: the vertices before the interval can be skipped */
+            if (!inedges) {
+                const shard_index_entry &closest = index.closest(range_st);
+                ptr += closest.adjoffset;
+                vid = (vid_t) closest.vid;
+                edgeptr = closest.edataoffset;
+            }
+            
             bool setoffset = false;
             bool setrangeoffset = false;
             while (ptr < end) {
@@ -319,6 +373,8 @@ namespace graphchi {
                     streaming_offset_vid = vid;
                     streaming_offset_edge_ptr = edgeptr;
                     setoffset = true;
+                    /* Only out-edges: nothing more to load */
+                    if (!inedges) break;
                 }
                 if (!setrangeoffset && vid>=range_st) {
                     range_start_offset = ptr-adjdata;
@@ -358,11 +414,19 @@ namespace graphchi {
                     int blockid = (int) (edgeptr / blocksize);
                     if (!async_edata_loading && !only_adjacency) {
                         /* Wait until blocks loaded (non-asynchronous version) */
-                        while(doneptr[edgeptr / blocksize] != 0) { usleep(10); }
+                        iomgr->wait_for_done((volatile int *)&doneptr[blockid]);
                     }
                     
                     vid_t target = *((vid_t*) ptr);
                     ptr += sizeof(vid_t);
+#ifdef SUPPORT_DELETIONS
+                    if (tombstones != NULL && tombstones->is_deleted(blockid, (edgeptr % blocksize) / sizeof(ET))) {
+                        if (vertex != NULL && outedges) __sync_add_and_fetch(&vertex->deleted_outc, 1);
+                        if (inedges && target >= window_st && target <= window_en) prealloc[target - window_st].deleted_inc++;
+                        edgeptr += sizeof(ET);
+                        continue;
+                    }
+#endif
                     if (vertex != NULL && outedges)
                     {
                         char * eptr = (only_adjacency ? NULL  : &(edgedata[blockid][edgeptr % blocksize]));
@@ -403,6 +467,148 @@ namespace graphchi {
             m.stop_time("memoryshard_create_edges", false);
         }
         
+        /**
+         * Decodes the edges of the window to the compact representation, see api/csr_vertex.hpp.
+         * Like load_vertices(), sets the offsets where the sliding shard continues.
+         * All vertices of the window are included. Waits until the edge data has been read.
+         */
+        void load_csr(vid_t window_st, vid_t window_en, csr_adjacency<ET> & csr, bool inedges=true, bool outedges=true) {
+            m.start_time("memoryshard_create_csr");
+            assert(adjdata != NULL);
+            check_stream_progress(0, adjfilesize);
+            if (!only_adjacency) {
+                iomgr->wait_for_reads();
+            }
+#ifdef SUPPORT_DELETIONS
+            resolve_deletions();
+            /* Out-edges are not consecutive if some were deleted */
+            bool out_index = (tombstones != NULL && tombstones->num_deleted() > 0);
+#else
+            bool out_index = false;
+#endif
+            
+            int nvertices = (int) (window_en - window_st + 1);
+            csr.window_st = window_st;
+            csr.window_en = window_en;
+            csr.in_offsets.assign(nvertices + 1, 0);
+            csr.out_offsets.assign(nvertices + 1, 0);
+            csr.out_first_edge.assign(nvertices, 0);
+            csr.values = edge_value_blocks<ET>(edgedata, blocksize);
+            assert(only_adjacency || edatafilesize / sizeof(ET) <= (size_t) 0xffffffffu);
+            
+            /* Two passes: count the edges of each vertex, then fill the arrays */
+            std::vector<size_t> cursor;
+            for(int pass=0; pass < 2; pass++) {
+                uint8_t * ptr = adjdata;
+                uint8_t * end = ptr + adjfilesize;
+                vid_t vid = 0;
+                edgeptr = 0;
+                
+                if (pass == 0) {
+                    streaming_offset = 0;
+                    streaming_offset_vid = 0;
+                    streaming_offset_edge_ptr = 0;
+                    range_start_offset = adjfilesize;
+                    range_start_edge_ptr = edatafilesize;
+                }
+                bool setoffset = false;
+                bool setrangeoffset = false;
+                
+                while (ptr < end) {
+                    if (pass == 0 && !setoffset && vid > range_end) {
+                        streaming_offset = ptr-adjdata;
+                        streaming_offset_vid = vid;
+                        streaming_offset_edge_ptr = edgeptr;
+                        setoffset = true;
+                    }
+                    if (pass == 0 && !setrangeoffset && vid>=range_st) {
+                        range_start_offset = ptr-adjdata;
+                        range_start_edge_ptr = edgeptr;
+                        setrangeoffset = true;
+                    }
+                    
+                    uint8_t ns = *ptr;
+                    int n;
+                    ptr += sizeof(uint8_t);
+                    
+                    if (ns == 0x00) {
+                        uint8_t nz = *ptr;
+                        ptr += sizeof(uint8_t);
+                        vid++;
+                        vid += nz;
+                        continue;
+                    }
+                    if (ns == 0xff) {
+                        n = *((uint32_t*)ptr);
+                        ptr += sizeof(uint32_t);
+                    } else {
+                        n = ns;
+                    }
+                    
+                    bool in_window = (vid >= window_st && vid <= window_en);
+                    int src = (int) (vid - window_st);
+                    size_t first = edgeptr / sizeof(ET);
+                    if (in_window && outedges) {
+                        if (pass == 0) {
+                            csr.out_offsets[src + 1] = n;
+                            csr.out_first_edge[src] = first;
+                        }
+                        size_t pos = csr.out_offsets[src];
+                        for(int j=0; j < n; j++) {
+                            if (out_index && is_deleted_edge(first + j)) {
+                                if (pass == 0) csr.out_offsets[src + 1]--;
+                                continue;
+                            }
+                            if (pass == 1) {
+                                csr.out_nbrs[pos] = ((vid_t *) ptr)[j];
+                                if (out_index) csr.out_edge_idx[pos] = (uint32_t) (first + j);
+                                pos++;
+                            }
+                        }
+                    }
+                    if (inedges) {
+                        for(int j=0; j < n; j++) {
+                            vid_t target = ((vid_t *) ptr)[j];
+                            if (target >= window_st && target <= window_en && !is_deleted_edge(first + j)) {
+                                int dst = (int) (target - window_st);
+                                if (pass == 0) {
+                                    csr.in_offsets[dst + 1]++;
+                                } else {
+                                    size_t pos = cursor[dst]++;
+                                    csr.in_nbrs[pos] = vid;
+                                    if (!only_adjacency) csr.in_edge_idx[pos] = (uint32_t) (first + j);
+                                }
+                            }
+                        }
+                    }
+                    ptr += sizeof(vid_t) * n;
+                    edgeptr += sizeof(ET) * n;
+                    vid++;
+                }
+                
+                if (pass == 0) {
+                    for(int i=0; i < nvertices; i++) {
+                        csr.in_offsets[i + 1] += csr.in_offsets[i];
+                        csr.out_offsets[i + 1] += csr.out_offsets[i];
+                    }
+                    csr.in_nbrs.resize(csr.in_offsets[nvertices]);
+                    csr.in_edge_idx.resize(only_adjacency ? 0 : csr.in_offsets[nvertices]);
+                    csr.out_nbrs.resize(csr.out_offsets[nvertices]);
+                    csr.out_edge_idx.resize(out_index ? csr.out_offsets[nvertices] : 0);
+                    cursor.assign(csr.in_offsets.begin(), csr.in_offsets.end() - 1);
+                }
+            }
+            m.stop_time("memoryshard_create_csr", false);
+        }
+        
+        inline bool is_deleted_edge(size_t edgeidx) {
+#ifdef SUPPORT_DELETIONS
+            return tombstones != NULL && tombstones->is_deleted(edgeidx);
+#else
+            return false;
+#endif
+        }
+        
         size_t offset_for_stream_cont() {
             return streaming_offset;
         }
@@ -0,0 +1,167 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Sparse index of a shard: for every SHARD_INDEX_VERTICES vertices (or
+ * SHARD_INDEX_EDGES edges), the offset of the vertex in the adjacency file
+ * and the offset of its first edge in the edge data. The edge data block of the
+ * vertex is the edge data offset divided by the block size. The sharder writes
+ * the index next to the adjacency file as "<adj>.index", so that the shards
+ * can seek to a vertex without decoding the vertices before it. All fields are
+ * 64-bit. The file records the size of the adjacency file it was built for,
+ * and is ignored if the adjacency has been rewritten since. It also records the
+ * size of the edge values, so that the shard can be read with another edge type.
+ */
+
+#ifndef DEF_GRAPHCHI_SHARDINDEX
+#define DEF_GRAPHCHI_SHARDINDEX
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graphchi_types.hpp"
+#include "api/chifilenames.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+#define SHARD_INDEX_VERTICES 4096
+#define SHARD_INDEX_EDGES 65536
+#define SHARD_INDEX_MAGIC 0x5844494443494843ULL  /* "CHICIDX" */
+
+namespace graphchi {
+
+    struct shard_index_entry {
+        uint64_t vid;
+        uint64_t adjoffset;
+        uint64_t edataoffset;
+        
+        shard_index_entry() : vid(0), adjoffset(0), edataoffset(0) {}
+        shard_index_entry(uint64_t vid, uint64_t adjoffset, uint64_t edataoffset) :
+            vid(vid), adjoffset(adjoffset), edataoffset(edataoffset) {}
+    };
+    
+    static inline bool shard_index_entry_vid_less(const shard_index_entry &a, const shard_index_entry &b) {
+        return a.vid < b.vid;
+    }
+    
+    class shard_index {
+        std::vector<shard_index_entry> entries;
+        bool persistent;
+        
+    public:
+        shard_index() : persistent(false) {
+            /* The beginning of the shard */
+            entries.push_back(shard_index_entry(0, 0, 0));
+        }
+        
+        /**
+         * Appends an entry. Entries must be added in increasing order of
+         * vertex id; vertices at or before the last entry are ignored.
+         */
+        void add(vid_t vid, size_t adjoffset, size_t edataoffset) {
+            if (vid <= entries.back().vid) return;
+            entries.push_back(shard_index_entry(vid, adjoffset, edataoffset));
+        }
+        
+        /**
+         * The last entry at or before vertex v.
+         */
+        const shard_index_entry & closest(vid_t v) const {
+            std::vector<shard_index_entry>::const_iterator it =
+                std::upper_bound(entries.begin(), entries.end(), shard_index_entry(v, 0, 0), shard_index_entry_vid_less);
+            assert(it != entries.begin());
+            return *(it - 1);
+        }
+        
+        size_t size() const {
+            return entries.size();
+        }
+        
+        /**
+         * True if the index was read from disk, so it covers the whole shard.
+         */
+        bool is_persistent() const {
+            return persistent;
+        }
+        
+        /**
+         * Reads the index of the adjacency file, if it exists and matches the file.
+         * @return false if there was no valid index
+         */
+        bool load(std::string adjfilename, size_t adjfilesize, size_t edgesize) {
+            std::string fname = filename_shard_index(adjfilename);
+            int f = open(fname.c_str(), O_RDONLY);
+            if (f < 0) return false;
+            uint64_t header[4];
+            size_t filesize = (size_t) lseek(f, 0, SEEK_END);
+            bool valid = filesize >= sizeof(header) && (filesize - sizeof(header)) % sizeof(shard_index_entry) == 0;
+            if (valid) {
+                preada(f, header, sizeof(header), 0);
+                valid = (header[0] == SHARD_INDEX_MAGIC && header[1] == (uint64_t)adjfilesize &&
+                         header[2] == (filesize - sizeof(header)) / sizeof(shard_index_entry) && header[3] > 0);
+            }
+            if (valid && header[2] > 0) {
+                entries.resize(header[2]);
+                preada(f, &entries[0], header[2] * sizeof(shard_index_entry), sizeof(header));
+                valid = (entries[0].vid == 0 && entries[0].adjoffset == 0);
+                if (header[3] != (uint64_t)edgesize) {
+                    for(size_t i=0; i < entries.size(); i++) {
+                        entries[i].edataoffset = entries[i].edataoffset / header[3] * edgesize;
+                    }
+                }
+            }
+            close(f);
+            if (!valid) {
+                logstream(LOG_WARNING) << "Ignoring stale or invalid shard index: " << fname << std::endl;
+                entries.assign(1, shard_index_entry(0, 0, 0));
+                return false;
+            }
+            persistent = true;
+            return true;
+        }
+        
+        void save(std::string adjfilename, size_t adjfilesize, size_t edgesize) {
+            std::string fname = filename_shard_index(adjfilename);
+            int f = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not write shard index " << fname << " error: " << strerror(errno) << std::endl;
+                return;
+            }
+            uint64_t header[4] = { SHARD_INDEX_MAGIC, (uint64_t)adjfilesize, (uint64_t)entries.size(), (uint64_t)edgesize };
+            writea(f, header, sizeof(header));
+            writea(f, &entries[0], entries.size() * sizeof(shard_index_entry));
+            close(f);
+        }
+    };
+
+}
+
+#endif
@@ -49,6 +49,11 @@
 #include "logger/logger.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/shardindex.hpp"
+
+#ifdef SUPPORT_DELETIONS
+#include "shards/tombstones.hpp"
+#endif
 
 
 namespace graphchi {
@@ -125,11 +130,6 @@ namespace graphchi {
     };
     
     
-    struct indexentry {
-        size_t adjoffset, edataoffset;
-        indexentry(size_t a, size_t e) : adjoffset(a), edataoffset(e) {}
-    };
-    
     /*
      * Graph shard that is streamed. I.e, it can only read in one direction, a chunk
      * a time.
@@ -154,10 +154,14 @@ namespace graphchi {
         sblock * curblock;
         sblock * curadjblock;
         metrics &m;
+        metric_handle read_next_metric;
         
-        std::map<int, indexentry> sparse_index; // Sparse index that can be created in the fly
+        shard_index sparse_index; // Read from disk, or created on the fly
         bool disable_writes;
         bool async_edata_loading;
+#ifdef SUPPORT_DELETIONS
+        edge_tombstones * tombstones;
+#endif
         // bool need_read_outedges; // Disabled - does not work with compressed data: whole block needs to be read.
         
         
@@ -197,11 +201,12 @@ namespace graphchi {
             }
             
             adjfile_session = iomgr->open_session(filename_adj, true);
-            save_offset();
+            sparse_index.load(filename_adj, adjfilesize, sizeof(ET));
+            read_next_metric = m.register_metric("read_next_vertices", TIME);
             
             async_edata_loading = !svertex_t().computational_edges();
 #ifdef SUPPORT_DELETIONS
-            async_edata_loading = false; // See comment above for memshard, async_edata_loading = false;
+            tombstones = (only_adjacency ? NULL : get_edge_tombstones<ET>(filename_edata, blocksize));
 #endif
         }
         
@@ -232,35 +237,33 @@ namespace graphchi {
         size_t get_edataoffset() { return edataoffset; }
         
         void save_offset() {
-            // Note, so that we can use the lower bound operation in map, we need
-            // to insert indices in reverse order
-            sparse_index.insert(std::pair<int, indexentry>(-((int)curvid), indexentry(adjoffset, edataoffset)));
+            sparse_index.add(curvid, adjoffset, edataoffset);
         }
         
+    public:
+        /**
+         * Moves to the closest indexed vertex at or before v, if it is
+         * after the current vertex. Vertices before v can then be skipped without reading them.
+         */
         void move_close_to(vid_t v) {
             if (curvid >= v) return;
             
-            std::map<int,indexentry>::iterator lowerbd_iter = sparse_index.lower_bound(-((int)v));
-            int closest_vid = -((int)lowerbd_iter->first);
-            assert(closest_vid>=0);
-            indexentry closest_offset = lowerbd_iter->second;
-            assert(closest_vid <= (int)v);
-            if (closest_vid > (int)curvid) {   /* Note: this will fail if we have over 2B vertices! */
+            const shard_index_entry &closest = sparse_index.closest(v);
+            assert(closest.vid <= v);
+            if (closest.vid > curvid) {
                 if (curblock != NULL) // Move the pointer - this may invalidate the curblock, but it is being checked later
-                    curblock->ptr += closest_offset.edataoffset - edataoffset;
+                    curblock->ptr += closest.edataoffset - edataoffset;
                 if (curadjblock != NULL)
-                    curadjblock->ptr += closest_offset.adjoffset - adjoffset;
-                curvid = (vid_t)closest_vid;
-                adjoffset = closest_offset.adjoffset;
-                edataoffset = closest_offset.edataoffset;
-                return;
-            } else {
-                // Do nothing - just continue from current pos.
-                return;
+                    curadjblock->ptr += closest.adjoffset - adjoffset;
+                curvid = (vid_t)closest.vid;
+                adjoffset = closest.adjoffset;
+                edataoffset = closest.edataoffset;
             }
-            
+            // Otherwise just continue from current pos.
         }
         
+    protected:
+        
         inline void check_curblock(size_t toread) {
             if (curblock == NULL || curblock->end < edataoffset+toread) {
                 if (curblock != NULL) {
@@ -339,31 +342,57 @@ namespace graphchi {
     public:
         /**
          * Read out-edges for vertices.
+         * If keep_previous is true, the blocks of the previous window are not
+         * released, because its vertices may still be updated. Call
+         * release_prior_to_window() after they have finished.
          */
-        void read_next_vertices(int nvecs, vid_t start,  std::vector<svertex_t> & prealloc, bool record_index=false, bool disable_writes=false)  {
-            metrics_entry me = m.start_time();
+        void read_next_vertices(int nvecs, vid_t start,  std::vector<svertex_t> & prealloc, bool record_index=false, bool disable_writes=false,
+                                bool keep_previous=false, const std::vector<vid_t> * scheduled=NULL)  {
+            metrics_timer me = m.start_timer();
             if (!record_index)
                 move_close_to(start);
             
             /* Release the blocks we do not need anymore */
             curblock = NULL;
-            release_prior_to_offset(false, disable_writes);
-            assert(activeblocks.size() <= 1);
+            if (!keep_previous) {
+                release_prior_to_offset(false, disable_writes);
+                assert(activeblocks.size() <= 1);
+            }
+#ifdef SUPPORT_DELETIONS
+            /* Deletions in the blocks kept from the previous window */
+            for(int j=0; j < (int) activeblocks.size(); j++) resolve_deletions(activeblocks[j]);
+            if (tombstones != NULL) tombstones->save();
+#endif
             
-            /* Read next */
+            /* Read next. The last block may be shared with the previous window. */
             if (!activeblocks.empty() && !only_adjacency) {
-                curblock = &activeblocks[0];
+                curblock = &activeblocks[activeblocks.size() - 1];
+                /* The shard may have been moved forward after the block was read */
+                curblock->ptr = curblock->data + (edataoffset - curblock->offset);
             }
             vid_t lastrec = start;
             window_start_edataoffset = edataoffset;
+            size_t nextsched = 0;
+            vid_t checked_target = 0;
             
             for(int i=((int)curvid) - ((int)start); i<nvecs; i++) {
                 if (adjoffset >= adjfilesize) break;
                 
-                // TODO: skip unscheduled vertices.
+                /* Seek over the unscheduled vertices, if the index has an entry
+                   after the current vertex and at or before the next scheduled one. */
+                if (scheduled != NULL && !record_index) {
+                    while (nextsched < scheduled->size() && (*scheduled)[nextsched] < curvid) nextsched++;
+                    vid_t target = (nextsched < scheduled->size() ? (*scheduled)[nextsched] : start + (vid_t)nvecs);
+                    if (target > curvid && target != checked_target) {
+                        checked_target = target;
+                        move_close_to(target);
+                        i = ((int)curvid) - ((int)start);
+                        if (i >= nvecs || adjoffset >= adjfilesize) break;
+                    }
+                }
                 
                 int n;
-                if (record_index && (size_t)(curvid - lastrec) >= (size_t) std::max((int)100000, nvecs/16)) {
+                if (record_index && !sparse_index.is_persistent() && (size_t)(curvid - lastrec) >= (size_t) std::max((int)100000, nvecs/16)) {
                     save_offset();
                     lastrec = curvid;
                 }
@@ -392,6 +421,14 @@ namespace graphchi {
                     if (vertex.scheduled) {
                         
                         while(--n >= 0) {
+#ifdef SUPPORT_DELETIONS
+                            if (tombstones != NULL && tombstones->num_deleted() > 0 && tombstones->is_deleted(edataoffset / sizeof(ET))) {
+                                read_val<vid_t>();
+                                skip(1, 0);
+                                __sync_add_and_fetch(&vertex.deleted_outc, 1);
+                                continue;
+                            }
+#endif
                             bool special_edge = false;
                             vid_t target = (sizeof(ET) == sizeof(ETspecial) ? read_val<vid_t>() : translate_edge(read_val<vid_t>(), special_edge));
                             ET * evalue = (special_edge ? (ET*)read_edgeptr<ETspecial>(): read_edgeptr<ET>());
@@ -423,7 +460,7 @@ namespace graphchi {
                 }
                 curvid++;
             }
-            m.stop_time(me, "read_next_vertices");
+            m.stop_timer(me, read_next_metric);
             curblock = NULL;
         }
         
@@ -432,6 +469,9 @@ namespace graphchi {
          * Commit modifications.
          */
         void commit(sblock &b, bool synchronously, bool disable_writes=false) {
+#ifdef SUPPORT_DELETIONS
+            if (b.active && b.data != NULL) assert_no_pending_deletions(b.data, b.end - b.offset);
+#endif
             if (synchronously) {
                 metrics_entry me = m.start_time();
                 if (!disable_writes) b.commit_now(iomgr);
@@ -473,15 +513,44 @@ namespace graphchi {
          * Release blocks that come prior to the current offset/
          */
         void release_prior_to_offset(bool all=false, bool disable_writes=false) { // disable writes is for the dynamic case
+            release_prior_to(edataoffset, all, disable_writes);
+        }
+        
+        /**
+         * Release blocks that come prior to the window read last. Used with
+         * read_next_vertices(..., keep_previous=true).
+         */
+        void release_prior_to_window(bool disable_writes=false) {
+            release_prior_to(window_start_edataoffset, false, disable_writes);
+        }
+        
+    protected:
+        void release_prior_to(size_t offset, bool all, bool disable_writes) {
             for(int i=(int)activeblocks.size() - 1; i >= 0; i--) {
                 sblock &b = activeblocks[i];
-                if (b.end <= edataoffset || all) {
+                if (b.end <= offset || all) {
+#ifdef SUPPORT_DELETIONS
+                    resolve_deletions(b);
+#endif
                     commit(b, all, disable_writes);
                     activeblocks.erase(activeblocks.begin() + (unsigned int)i);
                 }
             }
+#ifdef SUPPORT_DELETIONS
+            if (tombstones != NULL) tombstones->save();
+#endif
+        }
+        
+#ifdef SUPPORT_DELETIONS
+        /* Marks the edges of the block deleted by the updates */
+        void resolve_deletions(sblock &b) {
+            if (tombstones != NULL && b.active && b.data != NULL) {
+                tombstones->resolve_pending((int) (b.offset / blocksize), (char *) b.data, b.end - b.offset);
+            }
         }
+#endif
         
+    public:
         std::string get_info_json() {
             std::stringstream json;
             json << "\"size\": ";
@@ -0,0 +1,335 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Tombstones of deleted edges (with SUPPORT_DELETIONS). Each edge data block
+ * of a shard has a bitmap of its deleted edges, stored next to the block as
+ * "<block>.deleted" if the block has any deleted edges. The shards consult the
+ * bitmaps while decoding the adjacency, so deleted edges are skipped without
+ * reading their values, until compaction drops them from the shard.
+ *
+ * Update functions delete an edge by its value pointer. The pointers are logged,
+ * and turned to bits by the shard that owns the block when it commits or
+ * releases the block, see pending_edge_deletions(). The deletions of a block
+ * must be resolved before its buffer is released, as the address may be reused
+ * by another block, see assert_no_pending_deletions().
+ */
+
+#ifndef DEF_GRAPHCHI_TOMBSTONES
+#define DEF_GRAPHCHI_TOMBSTONES
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "api/chifilenames.hpp"
+#include "util/ioutil.hpp"
+#include "util/pthread_tools.hpp"
+
+namespace graphchi {
+
+    inline void delete_block_tombstones(std::string blockfilename) {
+        remove(filename_block_tombstones(blockfilename).c_str()); // Ok if did not exist
+    }
+
+    /**
+     * Deleted edges of one shard. Edges are identified by the block and the
+     * index of the edge in the block. Not thread-safe: the engine sets the bits
+     * between loading the vertices.
+     */
+    class edge_tombstones {
+        std::string filename_edata;
+        size_t blocksize;
+        size_t edges_per_block;
+        size_t nedges;
+        size_t ndeleted;
+
+        /* Empty for blocks without deleted edges */
+        std::vector<std::vector<uint64_t> > bitmaps;
+        std::vector<bool> dirty;
+
+        size_t block_edges(int blockid) {
+            return std::min(edges_per_block, nedges - blockid * edges_per_block);
+        }
+
+    public:
+        edge_tombstones(std::string filename_edata, size_t blocksize, size_t edgesize) :
+            filename_edata(filename_edata), blocksize(blocksize), ndeleted(0) {
+            assert(blocksize % edgesize == 0);
+            edges_per_block = blocksize / edgesize;
+            std::string sizefile = filename_edata + ".size";
+            nedges = 0;
+            if (file_exists(sizefile)) {
+                std::ifstream ifs(sizefile.c_str());
+                ifs >> nedges;
+                nedges /= edgesize;
+            }
+            int nblocks = (int) ((nedges + edges_per_block - 1) / edges_per_block);
+            bitmaps.resize(nblocks);
+            dirty.resize(nblocks, false);
+            for(int i=0; i < nblocks; i++) {
+                std::string fname = filename_block_tombstones(filename_shard_edata_block(filename_edata, i, blocksize));
+                if (!file_exists(fname)) continue;
+                bitmaps[i].resize((block_edges(i) + 63) / 64);
+                int f = open(fname.c_str(), O_RDONLY);
+                assert(f >= 0);
+                preada(f, &bitmaps[i][0], bitmaps[i].size() * sizeof(uint64_t), 0);
+                close(f);
+                for(size_t j=0; j < bitmaps[i].size(); j++) {
+                    ndeleted += __builtin_popcountll(bitmaps[i][j]);
+                }
+            }
+        }
+
+        inline bool block_has_deleted(int blockid) const {
+            return !bitmaps[blockid].empty();
+        }
+
+        /**
+         * @param i index of the edge in the block
+         */
+        inline bool is_deleted(int blockid, size_t i) const {
+            const std::vector<uint64_t> & bm = bitmaps[blockid];
+            return !bm.empty() && ((bm[i / 64] >> (i % 64)) & 1);
+        }
+
+        inline bool is_deleted(size_t edgeidx) const {
+            return is_deleted((int) (edgeidx / edges_per_block), edgeidx % edges_per_block);
+        }
+
+        void set_deleted(int blockid, size_t i) {
+            std::vector<uint64_t> & bm = bitmaps[blockid];
+            if (bm.empty()) bm.resize((block_edges(blockid) + 63) / 64, 0);
+            uint64_t bit = (uint64_t)1 << (i % 64);
+            if (!(bm[i / 64] & bit)) {
+                bm[i / 64] |= bit;
+                ndeleted++;
+                dirty[blockid] = true;
+            }
+        }
+
+        void set_deleted(size_t edgeidx) {
+            set_deleted((int) (edgeidx / edges_per_block), edgeidx % edges_per_block);
+        }
+
+        /**
+         * Sets the bits of the logged deletions that point to the given
+         * block buffer, see pending_edge_deletions().
+         */
+        void resolve_pending(int blockid, const char * data, size_t len);
+
+        size_t num_deleted() const {
+            return ndeleted;
+        }
+
+        size_t num_edges() const {
+            return nedges;
+        }
+
+        /**
+         * Appends the indices of the deleted edges to out, in increasing order.
+         */
+        void get_deleted(std::vector<size_t> & out) const {
+            for(int b=0; b < (int) bitmaps.size(); b++) {
+                for(size_t j=0; j < bitmaps[b].size(); j++) {
+                    uint64_t w = bitmaps[b][j];
+                    while(w != 0) {
+                        int k = __builtin_ctzll(w);
+                        out.push_back(b * edges_per_block + j * 64 + k);
+                        w &= w - 1;
+                    }
+                }
+            }
+        }
+
+        /**
+         * Writes the bitmaps of the blocks modified since the last save.
+         */
+        void save() {
+            for(int i=0; i < (int) bitmaps.size(); i++) {
+                if (!dirty[i]) continue;
+                std::string fname = filename_block_tombstones(filename_shard_edata_block(filename_edata, i, blocksize));
+                int f = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                assert(f >= 0);
+                writea(f, &bitmaps[i][0], bitmaps[i].size() * sizeof(uint64_t));
+                close(f);
+                dirty[i] = false;
+            }
+        }
+    };
+
+    /**
+     * Value pointers of edges deleted by the update functions, waiting
+     * to be resolved to tombstones. Thread-safe.
+     */
+    class deleted_edge_log {
+        mutex lock;
+        std::vector<const char *> ptrs;
+        size_t nsorted;
+        volatile size_t npending;  // Size of ptrs, written under the lock
+
+        /* Must hold the lock */
+        void sort_pending() {
+            if (nsorted < ptrs.size()) {
+                std::sort(ptrs.begin() + nsorted, ptrs.end());
+                std::inplace_merge(ptrs.begin(), ptrs.begin() + nsorted, ptrs.end());
+                nsorted = ptrs.size();
+            }
+        }
+
+    public:
+        deleted_edge_log() : nsorted(0), npending(0) {}
+
+        void add(const void * ptr) {
+            lock.lock();
+            ptrs.push_back((const char *) ptr);
+            npending = ptrs.size();
+            lock.unlock();
+        }
+
+        /**
+         * Removes the deletions pointing to [data, data + len), and appends
+         * their byte offsets from data to out.
+         */
+        void take(const char * data, size_t len, std::vector<size_t> & out) {
+            if (npending == 0) return;  // Unlocked check: deletions are logged before their block is resolved
+            lock.lock();
+            sort_pending();
+            std::vector<const char *>::iterator st = std::lower_bound(ptrs.begin(), ptrs.end(), data);
+            std::vector<const char *>::iterator en = std::lower_bound(st, ptrs.end(), data + len);
+            for(std::vector<const char *>::iterator it=st; it != en; ++it) {
+                out.push_back(*it - data);
+            }
+            ptrs.erase(st, en);
+            nsorted = npending = ptrs.size();
+            lock.unlock();
+        }
+
+        /**
+         * Whether any deletion points to [data, data + len).
+         */
+        bool has_pending(const char * data, size_t len) {
+            if (npending == 0) return false;
+            lock.lock();
+            sort_pending();
+            std::vector<const char *>::iterator it = std::lower_bound(ptrs.begin(), ptrs.end(), data);
+            bool found = (it != ptrs.end() && *it < data + len);
+            lock.unlock();
+            return found;
+        }
+
+        size_t size() {
+            return npending;
+        }
+
+        void clear() {
+            lock.lock();
+            ptrs.clear();
+            nsorted = npending = 0;
+            lock.unlock();
+        }
+    };
+
+    inline deleted_edge_log & pending_edge_deletions() {
+        static deleted_edge_log log;
+        return log;
+    }
+
+    /**
+     * Checks that the deletions of a block buffer have been resolved, before
+     * the buffer is released.
+     */
+    inline void assert_no_pending_deletions(const void * data, size_t len) {
+        assert(!pending_edge_deletions().has_pending((const char *) data, len));
+    }
+
+    inline void edge_tombstones::resolve_pending(int blockid, const char * data, size_t len) {
+        std::vector<size_t> offsets;
+        pending_edge_deletions().take(data, len, offsets);
+        size_t edgesize = blocksize / edges_per_block;
+        for(size_t j=0; j < offsets.size(); j++) {
+            set_deleted(blockid, offsets[j] / edgesize);
+        }
+    }
+
+    /**
+     * Tombstones of all shards, by edge data filename. Shards of the same
+     * file share the object, so the bits set by the memory shard are seen by the
+     * sliding shard.
+     */
+    class tombstone_registry {
+        mutex lock;
+        std::map<std::string, edge_tombstones *> shards;
+
+    public:
+        ~tombstone_registry() {
+            for(std::map<std::string, edge_tombstones *>::iterator it=shards.begin(); it != shards.end(); ++it) {
+                delete it->second;
+            }
+        }
+
+        edge_tombstones * get(std::string filename_edata, size_t blocksize, size_t edgesize) {
+            lock.lock();
+            edge_tombstones *& t = shards[filename_edata];
+            if (t == NULL) t = new edge_tombstones(filename_edata, blocksize, edgesize);
+            edge_tombstones * res = t;
+            lock.unlock();
+            return res;
+        }
+
+        /**
+         * Forgets the tombstones of a shard. Must be called when the shard files
+         * are removed or replaced, and no shard object uses them.
+         */
+        void release(std::string filename_edata) {
+            lock.lock();
+            std::map<std::string, edge_tombstones *>::iterator it = shards.find(filename_edata);
+            if (it != shards.end()) {
+                delete it->second;
+                shards.erase(it);
+            }
+            lock.unlock();
+        }
+    };
+
+    inline tombstone_registry & edge_tombstone_registry() {
+        static tombstone_registry registry;
+        return registry;
+    }
+
+    template <typename ET>
+    edge_tombstones * get_edge_tombstones(std::string filename_edata, size_t blocksize) {
+        return edge_tombstone_registry().get(filename_edata, blocksize, sizeof(ET));
+    }
+
+}
+
+#endif
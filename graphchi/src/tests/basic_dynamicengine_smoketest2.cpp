@@ -77,11 +77,9 @@ struct SmokeTestProgram2 : public GraphChiProgram<VertexDataType, EdgeDataType>
                 graphchi_edge<vid_t> * edge = vertex.outedge(i);
                 vid_t outedgedata = edge->get_data();
                 vid_t expected = edge->vertex_id() + gcontext.iteration - (edge->vertex_id() > vertex.id());
-                if (!is_deleted_edge_value(edge->get_data())) {
-                    if (outedgedata != expected) {
-                        logstream(LOG_ERROR) << outedgedata << " != " << expected << std::endl;
-                        assert(false);
-                    }
+                if (outedgedata != expected) {
+                    logstream(LOG_ERROR) << outedgedata << " != " << expected << std::endl;
+                    assert(false);
                 }
             }
             for(int i=0; i < vertex.num_inedges(); i++) {
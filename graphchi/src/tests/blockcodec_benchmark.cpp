@@ -0,0 +1,166 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Compares the edge data block codecs on a generated power-law graph.
+ * Edge values are laid out in shard order (sorted by source, then destination)
+ * and split into blocks of the engine's block size. For each kind of edge
+ * value and codec, reports the compression ratio and the compression and
+ * decompression throughput.
+ *
+ * Build with: make tests/blockcodec_benchmark
+ * (add -DGRAPHCHI_LZ4 -DGRAPHCHI_ZSTD and -llz4 -lzstd to include the optional codecs)
+ *
+ * Options: nvertices, nedges, blocksize, seed.
+ */
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "graphchi_basic_includes.hpp"
+#include "util/blockcodec.hpp"
+
+using namespace graphchi;
+
+struct gen_edge {
+    vid_t src, dst;
+};
+
+static bool edge_less(const gen_edge & a, const gen_edge & b) {
+    return a.src < b.src || (a.src == b.src && a.dst < b.dst);
+}
+
+static double now_secs() {
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/**
+ * Power-law graph: endpoints are drawn with probability proportional
+ * to 1 / (rank + 1).
+ */
+static void generate_graph(std::vector<gen_edge> & edges, vid_t nvertices, size_t nedges) {
+    edges.resize(nedges);
+    double logn = log((double) nvertices + 1);
+    for(size_t i=0; i < nedges; i++) {
+        edges[i].src = (vid_t) (exp(logn * (rand() / (RAND_MAX + 1.0))) - 1);
+        edges[i].dst = (vid_t) (exp(logn * (rand() / (RAND_MAX + 1.0))) - 1);
+    }
+    std::sort(edges.begin(), edges.end(), edge_less);
+}
+
+/* Edge values similar to those of the example applications */
+static void generate_edgedata(std::vector<gen_edge> & edges, std::string kind, std::vector<uint8_t> & data) {
+    size_t n = edges.size();
+    if (kind == "label") {
+        /* Connected components: smaller endpoint id */
+        data.resize(n * sizeof(vid_t));
+        vid_t * vals = (vid_t *) &data[0];
+        for(size_t i=0; i < n; i++) vals[i] = std::min(edges[i].src, edges[i].dst);
+    } else if (kind == "weight") {
+        /* Pagerank: source rank divided by its out-degree */
+        data.resize(n * sizeof(float));
+        float * vals = (float *) &data[0];
+        size_t st = 0;
+        while(st < n) {
+            size_t en = st;
+            while(en < n && edges[en].src == edges[st].src) en++;
+            float rank = 0.15f + 0.85f * (rand() / (float) RAND_MAX);
+            for(size_t i=st; i < en; i++) vals[i] = rank / (en - st);
+            st = en;
+        }
+    } else {
+        /* Small counters, as in triangle counting */
+        data.resize(n * sizeof(uint32_t));
+        uint32_t * vals = (uint32_t *) &data[0];
+        for(size_t i=0; i < n; i++) vals[i] = (uint32_t) (rand() % 16 == 0 ? rand() % 8 : 0);
+    }
+}
+
+static void run_codec(block_codec_t codec, std::vector<uint8_t> & data, size_t blocksize, std::string kind) {
+    block_codec_config cfg;
+    cfg.codec = codec;
+    cfg.level = block_codec_default_level(codec);
+
+    size_t nblocks = (data.size() + blocksize - 1) / blocksize;
+    std::vector<uint8_t *> compressed(nblocks);
+    std::vector<size_t> compressed_len(nblocks);
+    uint8_t * out = (uint8_t *) malloc(blocksize);
+
+    double t0 = now_secs();
+    size_t total = 0;
+    for(size_t b=0; b < nblocks; b++) {
+        size_t len = std::min(blocksize, data.size() - b * blocksize);
+        compressed[b] = (uint8_t *) malloc(block_compress_bound(codec, len));
+        compressed_len[b] = block_compress(cfg, &data[b * blocksize], len, compressed[b]);
+        total += compressed_len[b];
+    }
+    double t1 = now_secs();
+    for(size_t b=0; b < nblocks; b++) {
+        size_t len = std::min(blocksize, data.size() - b * blocksize);
+        size_t got = block_decompress(compressed[b], compressed_len[b], out, len);
+        assert(got == len);
+        assert(memcmp(out, &data[b * blocksize], len) == 0);
+    }
+    double t2 = now_secs();
+
+    double mb = data.size() / 1024.0 / 1024.0;
+    printf("%-8s %-6s %8.3f %12.1f %12.1f\n", kind.c_str(), block_codec_name(codec),
+           (double) data.size() / total, mb / (t1 - t0), mb / (t2 - t1));
+
+    for(size_t b=0; b < nblocks; b++) free(compressed[b]);
+    free(out);
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+
+    vid_t nvertices = (vid_t) get_option_int("nvertices", 1000000);
+    size_t nedges = (size_t) get_option_long("nedges", 20000000);
+    size_t blocksize = (size_t) get_option_long("blocksize", 4096 * 1024);
+    srand(get_option_int("seed", 1));
+
+    std::vector<gen_edge> edges;
+    generate_graph(edges, nvertices, nedges);
+    logstream(LOG_INFO) << "Generated graph with " << nvertices << " vertices and " << nedges << " edges." << std::endl;
+
+    block_codec_t codecs[4] = {CODEC_NONE, CODEC_ZLIB, CODEC_LZ4, CODEC_ZSTD};
+    const char * kinds[3] = {"label", "weight", "counter"};
+
+    printf("%-8s %-6s %8s %12s %12s\n", "edata", "codec", "ratio", "comp MB/s", "decomp MB/s");
+    for(int k=0; k < 3; k++) {
+        std::vector<uint8_t> data;
+        generate_edgedata(edges, kinds[k], data);
+        for(int c=0; c < 4; c++) {
+            if (block_codec_available(codecs[c])) {
+                run_codec(codecs[c], data, blocksize, kinds[k]);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for deterministic parallelism: runs a program whose result depends
+ * on the order of the updates with one and with four execution threads, and
+ * checks that the vertex values are the same.
+ */
+
+
+
+#include <string>
+#include <vector>
+
+#include "graphchi_basic_includes.hpp"
+
+using namespace graphchi;
+
+typedef unsigned int VertexDataType;
+typedef unsigned int EdgeDataType;
+
+/**
+ * Each vertex hashes the values of its edges and writes the hash to all of
+ * its edges, so every edge is written by both of its endpoints. The order of
+ * the edges of a vertex is not fixed, so the hash is a sum.
+ */
+struct DeterminismTestProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        if (gcontext.iteration == 0) {
+            /* Resets the edges written by the previous run */
+            for(int i=0; i < vertex.num_outedges(); i++) {
+                vertex.outedge(i)->set_data(vertex.id() * 2654435761u);
+            }
+            vertex.set_data(vertex.id());
+            return;
+        }
+        unsigned int h = vertex.id();
+        for(int i=0; i < vertex.num_edges(); i++) {
+            unsigned int x = vertex.edge(i)->get_data() * 2654435761u;
+            h += x ^ (x >> 15);
+        }
+        for(int i=0; i < vertex.num_edges(); i++) {
+            vertex.edge(i)->set_data(h + vertex.edge(i)->vertex_id());
+        }
+        vertex.set_data(h);
+    }
+};
+
+class VertexCollector : public VCallback<VertexDataType> {
+public:
+    std::vector<VertexDataType> values;
+
+    VertexCollector(size_t nvertices) : values(nvertices, 0) {}
+    void callback(vid_t vertex_id, VertexDataType &value) {
+        values[vertex_id] = value;
+    }
+};
+
+std::vector<VertexDataType> run_with_threads(std::string filename, int nshards, int niters, int nthreads) {
+    metrics m("deterministic-smoketest");
+    DeterminismTestProgram program;
+    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, false, m);
+    engine.set_exec_threads(nthreads);
+    engine.run(program, niters);
+
+    VertexCollector collector(engine.num_vertices());
+    foreach_vertices(filename, 0, engine.num_vertices(), collector);
+    return collector.values;
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+
+    std::string filename = get_option_string("file");
+    int niters           = get_option_int("niters", 4);
+    int nshards          = convert_if_notexists<EdgeDataType>(filename,
+                                                              get_option_string("nshards", "auto"));
+
+    std::vector<VertexDataType> sequential = run_with_threads(filename, nshards, niters, 1);
+    std::vector<VertexDataType> parallel = run_with_threads(filename, nshards, niters, 4);
+
+    assert(sequential.size() == parallel.size());
+    size_t ndiffer = 0;
+    for(size_t i=0; i < sequential.size(); i++) {
+        if (sequential[i] != parallel[i]) ndiffer++;
+    }
+    if (ndiffer > 0) {
+        logstream(LOG_FATAL) << ndiffer << " vertices differ between 1 and 4 execution threads." << std::endl;
+        assert(false);
+    }
+
+    logstream(LOG_INFO) << "Smoketest passed successfully! Your system is working!" << std::endl;
+    return 0;
+}
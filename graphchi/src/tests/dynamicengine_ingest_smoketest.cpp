@@ -0,0 +1,187 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for edge ingestion and shard compaction of the dynamic graph engine.
+ * Several threads add edges with add_edges() while the engine runs. The maximum
+ * shard size is small (dyngraph.maxshardsize_mb, 1 MB by default), so that
+ * the compaction splits shards. On the last iteration the vertices check that
+ * all edges are present and have the values they were added with.
+ */
+
+
+
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "graphchi_basic_includes.hpp"
+#include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef vid_t EdgeDataType;
+
+graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> * pengine = NULL;
+
+/**
+ * Value of each edge, so that the vertices can check their edges.
+ */
+static EdgeDataType edge_value(vid_t src, vid_t dst) {
+    return src * 31 + dst;
+}
+
+/**
+ * Adds edges in batches. Batch b is added during iteration
+ * b * spread_iters / nbatches, so that the edges arrive over several iterations,
+ * and the later iterations compact them.
+ */
+struct edge_producer {
+    pthread_t thread;
+    int id;
+    int nbatches;
+    int batchsize;
+    int spread_iters;
+    vid_t nvertices;
+    size_t nadded;
+
+    static volatile int current_iteration;
+
+    static void * run(void * _producer) {
+        edge_producer * producer = (edge_producer *) _producer;
+        unsigned int seed = 1 + producer->id;
+        std::vector<created_edge<EdgeDataType> > batch;
+        for(int b=0; b < producer->nbatches; b++) {
+            while(current_iteration < b * producer->spread_iters / producer->nbatches) {
+                usleep(1000);
+            }
+            batch.clear();
+            for(int i=0; i < producer->batchsize; i++) {
+                vid_t src = (vid_t) (rand_r(&seed) % producer->nvertices);
+                vid_t dst = (vid_t) (rand_r(&seed) % producer->nvertices);
+                if (src == dst) dst = (dst + 1) % producer->nvertices;
+                batch.push_back(created_edge<EdgeDataType>(src, dst, edge_value(src, dst)));
+            }
+            producer->nadded += pengine->add_edges(&batch[0], batch.size());
+        }
+        return NULL;
+    }
+};
+
+volatile int edge_producer::current_iteration = -1;
+
+struct IngestTestProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+
+    std::vector<edge_producer> * producers;
+    volatile size_t nedges;
+    volatile size_t nwrong;
+    int nshards_last;
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        size_t wrong = 0;
+        for(int i=0; i < vertex.num_inedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
+            EdgeDataType expected = edge_value(edge->vertex_id(), vertex.id());
+            if (gcontext.iteration == 0) {
+                /* Edges of the original graph */
+                edge->set_data(expected);
+            } else if (edge->get_data() != expected) {
+                wrong++;
+            }
+        }
+        if (gcontext.iteration == gcontext.num_iterations - 1) {
+            __sync_add_and_fetch(&nedges, (size_t) vertex.num_inedges());
+        }
+        if (wrong > 0) __sync_add_and_fetch(&nwrong, wrong);
+    }
+
+    void before_iteration(int iteration, graphchi_context &gcontext) {
+        nedges = 0;
+        nwrong = 0;
+        if (iteration == gcontext.num_iterations - 1) {
+            /* All edges are in the buffers or shards before the last iteration */
+            for(size_t i=0; i < producers->size(); i++) {
+                pthread_join((*producers)[i].thread, NULL);
+            }
+            nshards_last = pengine->get_nshards();
+        }
+        edge_producer::current_iteration = iteration;
+    }
+
+    void after_iteration(int iteration, graphchi_context &gcontext) {
+        if (nwrong > 0) {
+            logstream(LOG_FATAL) << nwrong << " edges have wrong values on iteration " << iteration << std::endl;
+            assert(false);
+        }
+    }
+};
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    metrics m("dynamicengine-ingest-smoketest");
+
+    std::string filename = get_option_string("file");
+    int niters           = get_option_int("niters", 8);
+    int nproducers       = get_option_int("producers", 4);
+    int nbatches         = get_option_int("batches", 20);
+    set_conf("dyngraph.maxshardsize_mb", "1");  // Small, to split the shards
+
+    int nshards          = convert_if_notexists<EdgeDataType>(filename, get_option_string("nshards", "auto"));
+    
+    /* By default, twice the edges of a full shard for each shard */
+    size_t maxshardedges = get_option_long("dyngraph.maxshardsize_mb", 1) * 1024 * 1024 / sizeof(EdgeDataType);
+    int batchsize        = get_option_int("batchsize", (int) (2 * nshards * maxshardedges / (nproducers * nbatches)));
+
+    graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> engine(filename, nshards, false, m);
+    pengine = &engine;
+
+    std::vector<edge_producer> producers(nproducers);
+    for(int i=0; i < nproducers; i++) {
+        edge_producer &p = producers[i];
+        p.id = i;
+        p.nbatches = nbatches;
+        p.batchsize = batchsize;
+        p.spread_iters = niters / 2;
+        p.nvertices = (vid_t) engine.num_vertices();
+        p.nadded = 0;
+        int ret = pthread_create(&p.thread, NULL, edge_producer::run, &p);
+        assert(ret == 0);
+    }
+
+    IngestTestProgram program;
+    program.producers = &producers;
+    engine.run(program, niters);
+
+    size_t nadded = 0;
+    for(int i=0; i < nproducers; i++) nadded += producers[i].nadded;
+    logstream(LOG_INFO) << "Added edges: " << nadded << ", edges on the last iteration: " << program.nedges
+        << ", shards: " << nshards << " -> " << program.nshards_last << std::endl;
+    assert(nadded == (size_t) nproducers * nbatches * batchsize);
+    assert(program.nedges == engine.num_edges_safe());
+    assert(program.nshards_last > nshards);
+
+    metrics_report(m);
+    logstream(LOG_INFO) << "Smoketest passed successfully! Your system is working!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoke test for the vectorized gather of the functional api (gather_op):
+ * runs a minimum label kernel with op_neighborval() and plus(), and with
+ * min_op as the gather_op, in the synchronous and semi-synchronous modes,
+ * and checks that the vertex values are the same.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "util/cmdopts.hpp"
+#include "api/graphchi_context.hpp"
+#include "api/graph_objects.hpp"
+#include "api/ischeduler.hpp"
+#include "api/vertex_aggregator.hpp"
+#include "api/functional/functional_api.hpp"
+#include "metrics/metrics.hpp"
+#include "metrics/reps/basic_reporter.hpp"
+
+using namespace graphchi;
+
+struct minlabel_program : public functional_kernel<unsigned int, unsigned int> {
+
+    /* Initial value - on first iteration */
+    unsigned int initial_value(graphchi_context &info, vertex_info& myvertex) {
+        return myvertex.vertexid;
+    }
+
+    /* Called before first "gather" */
+    unsigned int reset() {
+        return 0xffffffffu;
+    }
+
+    // "Gather"
+    unsigned int op_neighborval(graphchi_context &info, vertex_info& myvertex, vid_t nbid, unsigned int nbval) {
+        return nbval;
+    }
+
+    // "Sum"
+    unsigned int plus(unsigned int curval, unsigned int toadd) {
+        return std::min(curval, toadd);
+    }
+
+    // "Apply"
+    unsigned int compute_vertexvalue(graphchi_context &ginfo, vertex_info& myvertex, unsigned int nbvalsum) {
+        return std::min(nbvalsum, myvertex.vertexid);
+    }
+
+    // "Scatter
+    unsigned int value_to_neighbor(graphchi_context &info, vertex_info& myvertex, vid_t nbid, unsigned int myval) {
+        return myval;
+    }
+
+};
+
+/**
+ * Same kernel with the vectorized gather.
+ */
+struct minlabel_program_vectorized : public minlabel_program {
+    typedef min_op<unsigned int> gather_op;
+};
+
+class LabelCollector : public VCallback<unsigned int> {
+public:
+    std::vector<unsigned int> labels;
+
+    LabelCollector(size_t nvertices) : labels(nvertices, 0) {}
+    void callback(vid_t vertex_id, unsigned int &value) {
+        labels[vertex_id] = value;
+    }
+};
+
+template <class KERNEL>
+std::vector<unsigned int> run_and_collect(std::string filename, int niters, bool synchronous, metrics &m) {
+    if (synchronous) {
+        run_functional_unweighted_synchronous<KERNEL>(filename, niters, m);
+    } else {
+        run_functional_unweighted_semisynchronous<KERNEL>(filename, niters, m);
+    }
+    size_t nvertices = get_num_vertices(filename);
+    LabelCollector collector(nvertices);
+    foreach_vertices<unsigned int>(filename, 0, (vid_t) nvertices, collector);
+    return collector.labels;
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    metrics m("test-functional-gather");
+
+    std::string filename = get_option_string("file");
+    int niters = get_option_int("niters", 5);
+
+    for(int sync=0; sync < 2; sync++) {
+        const char * mode = (sync ? "synchronous" : "semi-synchronous");
+        logstream(LOG_INFO) << "Running gather test, " << mode << "." << std::endl;
+        std::vector<unsigned int> scalar = run_and_collect<minlabel_program>(filename, niters, sync == 1, m);
+        std::vector<unsigned int> vectorized = run_and_collect<minlabel_program_vectorized>(filename, niters, sync == 1, m);
+
+        assert(scalar.size() == vectorized.size());
+        size_t ndiffer = 0;
+        for(size_t i=0; i < scalar.size(); i++) {
+            assert(scalar[i] <= i);
+            if (scalar[i] != vectorized[i]) ndiffer++;
+        }
+        if (ndiffer > 0) {
+            logstream(LOG_FATAL) << ndiffer << " vertices differ between the scalar and the vectorized gather, "
+                << mode << "." << std::endl;
+            assert(false);
+        }
+    }
+
+    logstream(LOG_INFO) << "Smoketest passed successfully! Your system is working!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,300 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Codecs for the compressed edge data blocks. Each block file starts with
+ * a small header that records the codec and the uncompressed size of the block,
+ * so blocks written with different codecs can be mixed. Files without the header
+ * are plain zlib streams written by older versions.
+ *
+ * Zlib is always available. LZ4 and Zstd are compiled in by defining
+ * GRAPHCHI_LZ4 (link with -llz4) and GRAPHCHI_ZSTD (link with -lzstd).
+ */
+
+#ifndef DEF_GRAPHCHI_BLOCKCODEC
+#define DEF_GRAPHCHI_BLOCKCODEC
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <zlib.h>
+
+#ifdef GRAPHCHI_LZ4
+#include <lz4.h>
+#endif
+#ifdef GRAPHCHI_ZSTD
+#include <zstd.h>
+#endif
+
+#include "logger/logger.hpp"
+
+namespace graphchi {
+
+    enum block_codec_t {
+        CODEC_NONE = 0,  // Stored without compression
+        CODEC_ZLIB = 1,
+        CODEC_LZ4 = 2,
+        CODEC_ZSTD = 3
+    };
+
+    struct block_header {
+        char magic[3];
+        uint8_t codec;
+        int32_t level;
+        uint64_t uncompressed_size;
+    };
+
+    static const char BLOCK_MAGIC[3] = {'G', 'C', 'B'};
+
+    struct block_codec_config {
+        block_codec_t codec;
+        int level;
+    };
+
+    /**
+     * Codec used for writing blocks. Zlib at its fastest level by default, which
+     * matches the format of older versions.
+     */
+    inline block_codec_config & default_block_codec() {
+        static block_codec_config cfg = {CODEC_ZLIB, 1};
+        return cfg;
+    }
+
+    inline const char * block_codec_name(block_codec_t codec) {
+        switch(codec) {
+            case CODEC_NONE: return "none";
+            case CODEC_ZLIB: return "zlib";
+            case CODEC_LZ4: return "lz4";
+            case CODEC_ZSTD: return "zstd";
+        }
+        return "unknown";
+    }
+
+    inline bool block_codec_available(block_codec_t codec) {
+        switch(codec) {
+            case CODEC_NONE:
+            case CODEC_ZLIB:
+                return true;
+#ifdef GRAPHCHI_LZ4
+            case CODEC_LZ4:
+                return true;
+#endif
+#ifdef GRAPHCHI_ZSTD
+            case CODEC_ZSTD:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    inline int block_codec_default_level(block_codec_t codec) {
+        switch(codec) {
+            case CODEC_ZLIB: return Z_BEST_SPEED;
+            case CODEC_LZ4: return 1;  // Acceleration factor
+            case CODEC_ZSTD: return 1;
+            default: return 0;
+        }
+    }
+
+    /**
+     * Parses a codec name. Unknown codecs and codecs not compiled in
+     * fall back to zlib with a warning.
+     */
+    inline block_codec_t block_codec_by_name(std::string name) {
+        block_codec_t codecs[4] = {CODEC_NONE, CODEC_ZLIB, CODEC_LZ4, CODEC_ZSTD};
+        for(int i=0; i < 4; i++) {
+            if (name == block_codec_name(codecs[i])) {
+                if (!block_codec_available(codecs[i])) {
+                    logstream(LOG_WARNING) << "Codec " << name << " not compiled in, using zlib." << std::endl;
+                    return CODEC_ZLIB;
+                }
+                return codecs[i];
+            }
+        }
+        logstream(LOG_WARNING) << "Unknown codec " << name << ", using zlib." << std::endl;
+        return CODEC_ZLIB;
+    }
+
+    /**
+     * Sets the codec for writing blocks.
+     * @param level codec specific level, negative for the codec's default
+     */
+    inline void set_default_block_codec(std::string name, int level) {
+        block_codec_config & cfg = default_block_codec();
+        cfg.codec = block_codec_by_name(name);
+        cfg.level = (level < 0 ? block_codec_default_level(cfg.codec) : level);
+    }
+
+    /**
+     * Maximum size of a compressed block, including the header.
+     */
+    inline size_t block_compress_bound(block_codec_t codec, size_t nbytes) {
+        size_t bound = nbytes;
+        switch(codec) {
+            case CODEC_ZLIB: bound = compressBound((uLong) nbytes); break;
+#ifdef GRAPHCHI_LZ4
+            case CODEC_LZ4: bound = LZ4_compressBound((int) nbytes); break;
+#endif
+#ifdef GRAPHCHI_ZSTD
+            case CODEC_ZSTD: bound = ZSTD_compressBound(nbytes); break;
+#endif
+            default: break;
+        }
+        return sizeof(block_header) + bound;
+    }
+
+    /**
+     * Compresses a block, header included, to out which must hold
+     * block_compress_bound() bytes.
+     * @return size of the compressed block
+     */
+    inline size_t block_compress(block_codec_config cfg, const void * in, size_t nbytes, uint8_t * out) {
+        block_header hdr;
+        memcpy(hdr.magic, BLOCK_MAGIC, sizeof(hdr.magic));
+        hdr.codec = (uint8_t) cfg.codec;
+        hdr.level = cfg.level;
+        hdr.uncompressed_size = nbytes;
+        memcpy(out, &hdr, sizeof(hdr));
+
+        uint8_t * payload = out + sizeof(hdr);
+        size_t capacity = block_compress_bound(cfg.codec, nbytes) - sizeof(hdr);
+        size_t len = 0;
+        switch(cfg.codec) {
+            case CODEC_NONE:
+                memcpy(payload, in, nbytes);
+                len = nbytes;
+                break;
+            case CODEC_ZLIB: {
+                uLongf destlen = (uLongf) capacity;
+                int ret = compress2(payload, &destlen, (const Bytef *) in, (uLong) nbytes, cfg.level);
+                assert(ret == Z_OK);
+                len = destlen;
+                break;
+            }
+#ifdef GRAPHCHI_LZ4
+            case CODEC_LZ4: {
+                int ret = LZ4_compress_fast((const char *) in, (char *) payload, (int) nbytes, (int) capacity, cfg.level);
+                assert(ret > 0 || nbytes == 0);
+                len = (size_t) ret;
+                break;
+            }
+#endif
+#ifdef GRAPHCHI_ZSTD
+            case CODEC_ZSTD: {
+                size_t ret = ZSTD_compress(payload, capacity, in, nbytes, cfg.level);
+                if (ZSTD_isError(ret)) {
+                    logstream(LOG_FATAL) << "Zstd compression failed: " << ZSTD_getErrorName(ret) << std::endl;
+                    assert(false);
+                }
+                len = ret;
+                break;
+            }
+#endif
+            default:
+                logstream(LOG_FATAL) << "Codec not available: " << block_codec_name(cfg.codec) << std::endl;
+                assert(false);
+        }
+        return sizeof(hdr) + len;
+    }
+
+    /**
+     * Returns true if the buffer starts with a block header.
+     */
+    inline bool block_has_header(const uint8_t * in, size_t len) {
+        return len >= sizeof(block_header) && memcmp(in, BLOCK_MAGIC, sizeof(BLOCK_MAGIC)) == 0;
+    }
+
+    /**
+     * Decompresses a block to out, which holds nbytes.
+     * @return number of bytes decompressed
+     */
+    inline size_t block_decompress(const uint8_t * in, size_t len, void * out, size_t nbytes) {
+        if (!block_has_header(in, len)) {
+            /* Legacy block: plain zlib stream */
+            uLongf destlen = (uLongf) nbytes;
+            int ret = uncompress((Bytef *) out, &destlen, in, (uLong) len);
+            if (ret != Z_OK) {
+                logstream(LOG_FATAL) << "Could not decompress block, zlib error " << ret << std::endl;
+                assert(false);
+            }
+            return destlen;
+        }
+        block_header hdr;
+        memcpy(&hdr, in, sizeof(hdr));
+        const uint8_t * payload = in + sizeof(hdr);
+        size_t payloadlen = len - sizeof(hdr);
+        size_t outlen = (size_t) std::min((uint64_t) nbytes, hdr.uncompressed_size);
+
+        switch(hdr.codec) {
+            case CODEC_NONE:
+                assert(payloadlen == hdr.uncompressed_size);
+                memcpy(out, payload, outlen);
+                return outlen;
+            case CODEC_ZLIB: {
+                uLongf destlen = (uLongf) outlen;
+                int ret = uncompress((Bytef *) out, &destlen, payload, (uLong) payloadlen);
+                /* Z_BUF_ERROR if only part of the block was requested */
+                assert(ret == Z_OK || (ret == Z_BUF_ERROR && outlen < hdr.uncompressed_size));
+                return destlen;
+            }
+#ifdef GRAPHCHI_LZ4
+            case CODEC_LZ4: {
+                int ret = LZ4_decompress_safe_partial((const char *) payload, (char *) out, (int) payloadlen,
+                                                      (int) outlen, (int) outlen);
+                assert(ret >= 0);
+                return (size_t) ret;
+            }
+#endif
+#ifdef GRAPHCHI_ZSTD
+            case CODEC_ZSTD: {
+                if (outlen < hdr.uncompressed_size) {
+                    /* Zstd does not decompress partially to a buffer too small */
+                    uint8_t * tmp = (uint8_t *) malloc(hdr.uncompressed_size);
+                    size_t ret = ZSTD_decompress(tmp, hdr.uncompressed_size, payload, payloadlen);
+                    assert(!ZSTD_isError(ret));
+                    memcpy(out, tmp, outlen);
+                    free(tmp);
+                    return outlen;
+                }
+                size_t ret = ZSTD_decompress(out, outlen, payload, payloadlen);
+                if (ZSTD_isError(ret)) {
+                    logstream(LOG_FATAL) << "Zstd decompression failed: " << ZSTD_getErrorName(ret) << std::endl;
+                    assert(false);
+                }
+                return ret;
+            }
+#endif
+            default:
+                logstream(LOG_FATAL) << "Block was written with codec " << (int) hdr.codec
+                    << " which is not compiled in." << std::endl;
+                assert(false);
+        }
+        return 0;
+    }
+}
+
+#endif
@@ -6,15 +6,17 @@
 #include <cstdio>
 #include <cstdlib>
 #include <stdint.h>
+#include <cstring>
+#include <vector>
 
 namespace graphchi {
     class dense_bitset {
     public:
-        dense_bitset() : array(NULL), len(0) {
+        dense_bitset() : array(NULL), len(0), arrlen(0) {
             generate_bit_masks();
         }
         
-        dense_bitset(size_t size) : array(NULL), len(size) {
+        dense_bitset(size_t size) : array(NULL), len(size), arrlen(0) {
             resize(size);
             clear();
             generate_bit_masks();
@@ -26,8 +28,10 @@ namespace graphchi {
         void resize(size_t n) {
             len = n;
             //need len bits
+            size_t oldarrlen = arrlen;
             arrlen =  n / (8*sizeof(size_t)) + 1;
             array = (size_t*)realloc(array, sizeof(size_t) * arrlen);
+            for (size_t i = oldarrlen; i < arrlen; ++i) array[i] = 0;  // New bits are clear
         }
         
         void clear() {
@@ -95,6 +99,41 @@ namespace graphchi {
             return len;
         }
         
+        //! Number of set bits in [fromb, tob] (tob is inclusive)
+        size_t count_bits(uint32_t fromb, uint32_t tob) const {
+            const uint32_t bitsperword = 8 * sizeof(size_t);
+            uint32_t from_arrpos = fromb / bitsperword, to_arrpos = tob / bitsperword;
+            size_t count = 0;
+            for(uint32_t i = from_arrpos; i <= to_arrpos; ++i) {
+                count += __builtin_popcountl(array[i] & range_mask(i, fromb, tob));
+            }
+            return count;
+        }
+        
+        //! Appends the set bits in [fromb, tob] to out, in increasing order
+        void get_set_bits(uint32_t fromb, uint32_t tob, std::vector<uint32_t> &out) const {
+            const uint32_t bitsperword = 8 * sizeof(size_t);
+            uint32_t from_arrpos = fromb / bitsperword, to_arrpos = tob / bitsperword;
+            for(uint32_t i = from_arrpos; i <= to_arrpos; ++i) {
+                size_t w = array[i] & range_mask(i, fromb, tob);
+                while(w != 0) {
+                    out.push_back(i * bitsperword + __builtin_ctzl(w));
+                    w &= w - 1;
+                }
+            }
+        }
+        
+    private:
+        
+        //! Mask of the bits of word arrpos that are in [fromb, tob]
+        inline static size_t range_mask(uint32_t arrpos, uint32_t fromb, uint32_t tob) {
+            const uint32_t bitsperword = 8 * sizeof(size_t);
+            size_t mask = ~size_t(0);
+            if (arrpos == fromb / bitsperword) mask &= ~size_t(0) << (fromb % bitsperword);
+            if (arrpos == tob / bitsperword) mask &= ~size_t(0) >> (bitsperword - 1 - tob % bitsperword);
+            return mask;
+        }
+        
     private:
                 
         
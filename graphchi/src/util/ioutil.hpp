@@ -32,7 +32,9 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <zlib.h>
+#include <sys/stat.h>
+
+#include "util/blockcodec.hpp"
  
 
 // Reads given number of bytes to a buffer
@@ -140,56 +142,22 @@ void writea(int f, T * tbuf, size_t nbytes) {
 
 
 
+/**
+ * Writes a block compressed with the default codec, see util/blockcodec.hpp.
+ * @return number of bytes written
+ */
 template <typename T>
 size_t write_compressed(int f, T * tbuf, size_t nbytes) {
-    
 #ifndef GRAPHCHI_DISABLE_COMPRESSION
-    unsigned char * buf = (unsigned char*)tbuf;
-    int ret;
-    unsigned have;
-    z_stream strm;
-    int CHUNK = (int) std::max((size_t)4096 * 1024, nbytes);
-    unsigned char * out = (unsigned char *) malloc(CHUNK);
-    lseek(f, 0, SEEK_SET);
-
-    /* allocate deflate state */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    ret = deflateInit(&strm, Z_BEST_SPEED);
-    if (ret != Z_OK)
-        assert(false);
-    
-    /* compress until end of file */
-    strm.avail_in = (int) nbytes;
-    strm.next_in = buf;
+    graphchi::block_codec_config cfg = graphchi::default_block_codec();
+    uint8_t * out = (uint8_t *) malloc(graphchi::block_compress_bound(cfg.codec, nbytes));
+    size_t len = graphchi::block_compress(cfg, tbuf, nbytes, out);
     
     int trerr = ftruncate(f, 0);
     assert (trerr == 0);
-    size_t totwritten = 0;
-    
-   /* run deflate() on input until output buffer not full, finish
-     compression if all of source has been read in */
-    do {
-        strm.avail_out = CHUNK;
-        strm.next_out = out;
-        ret = deflate(&strm, Z_FINISH);    /* no bad return value */
-        assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-        have = CHUNK - strm.avail_out;
-        if (write(f, out, have) != have) {
-            (void)deflateEnd(&strm);
-            assert(false);
-        }
-        totwritten += have;
-    } while (strm.avail_out == 0);
-    assert(strm.avail_in == 0);     /* all input will be used */
-        
-    assert(ret == Z_STREAM_END);        /* stream will be complete */
-    
-    /* clean up and return */
-    (void)deflateEnd(&strm);
+    pwritea(f, out, len, 0);
     free(out);
-    return totwritten;
+    return len;
 #else
     writea(f, tbuf, nbytes);
     return nbytes;
@@ -197,66 +165,19 @@ size_t write_compressed(int f, T * tbuf, size_t nbytes) {
 
 }
 
-/* Zlib-inflated read. Assume tbuf is correctly sized memory block. */
+/* Reads and decompresses a block. Assume tbuf is correctly sized memory block. */
 template <typename T>
 void read_compressed(int f, T * tbuf, size_t nbytes) {
 #ifndef GRAPHCHI_DISABLE_COMPRESSION
-    unsigned char * buf = (unsigned char*)tbuf;
-    int ret;
-    unsigned have;
-    z_stream strm;
-    int CHUNK = (int) std::max((size_t)4096 * 1024, nbytes);
-
-    size_t fsize = lseek(f, 0, SEEK_END);
-    
-    unsigned char * in = (unsigned char *) malloc(fsize);
-    lseek(f, 0, SEEK_SET);
-
-    /* allocate inflate state */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    strm.avail_in = 0;
-    strm.next_in = Z_NULL;
-    ret = inflateInit(&strm);
-    if (ret != Z_OK)
-        assert(false);
+    struct stat st;
+    int err = fstat(f, &st);
+    assert(err == 0);
+    size_t fsize = (size_t) st.st_size;
+    if (fsize == 0) return;
     
-    /* decompress until deflate stream ends or end of file */
-    do {
-        ssize_t a = 0;
-        do {
-            a = read(f, in + strm.avail_in, fsize - strm.avail_in); //fread(in, 1, CHUNK, source);
-            strm.avail_in += (int) a;
-            assert(a != (ssize_t)(-1));
-        } while (a > 0);
-       
-        if (strm.avail_in == 0)
-            break;
-        strm.next_in = in;
-        
-        /* run inflate() on input until output buffer not full */
-        do {
-            strm.avail_out = CHUNK;
-            strm.next_out = buf;
-            ret = inflate(&strm, Z_NO_FLUSH);
-            assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-            switch (ret) {
-                case Z_NEED_DICT:
-                    ret = Z_DATA_ERROR;     /* and fall through */
-                case Z_DATA_ERROR:
-                case Z_MEM_ERROR:
-                    assert(false);
-            }
-            have = CHUNK - strm.avail_out;
-            buf += have;
-        } while (strm.avail_out == 0);
-        
-        /* done when inflate() says it's done */
-    } while (ret != Z_STREAM_END);
-   // std::cout << "Read: " << (buf - (unsigned char*)tbuf) << std::endl;
-    /* clean up and return */
-    (void)inflateEnd(&strm);
+    uint8_t * in = (uint8_t *) malloc(fsize);
+    preada(f, in, fsize, 0);
+    graphchi::block_decompress(in, fsize, tbuf, nbytes);
     free(in);
 #else
     preada(f, tbuf, nbytes, 0);
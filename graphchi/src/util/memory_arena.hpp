@@ -0,0 +1,131 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Bump allocator for buffers that are rebuilt for every sub-interval,
+ * such as the edge array. Memory is mapped once and reused after reset(),
+ * so the pages stay resident between sub-intervals. On Linux, transparent
+ * huge pages are requested for the region.
+ */
+
+#ifndef DEF_GRAPHCHI_MEMORY_ARENA
+#define DEF_GRAPHCHI_MEMORY_ARENA
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "logger/logger.hpp"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+namespace graphchi {
+
+    class memory_arena {
+
+        char * base;
+        size_t capacity;
+        size_t used;
+
+        /* Not copyable */
+        memory_arena(const memory_arena &);
+        memory_arena & operator=(const memory_arena &);
+
+        static size_t hugepage_size() {
+            return 2 * 1024 * 1024;
+        }
+
+        void unmap() {
+            if (base != NULL) {
+                munmap(base, capacity);
+                base = NULL;
+                capacity = 0;
+            }
+        }
+
+    public:
+        memory_arena() : base(NULL), capacity(0), used(0) {}
+
+        ~memory_arena() {
+            unmap();
+        }
+
+        /**
+         * Ensures the arena can hold nbytes. Existing allocations are
+         * invalidated if the arena needs to grow, so call this only after reset().
+         */
+        void reserve(size_t nbytes) {
+            if (nbytes <= capacity) return;
+            assert(used == 0);
+            unmap();
+
+            /* Round up to huge page size */
+            size_t hp = hugepage_size();
+            size_t len = ((nbytes + hp - 1) / hp) * hp;
+            void * ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED) {
+                logstream(LOG_FATAL) << "Could not allocate arena of " << len << " bytes: " << strerror(errno) << std::endl;
+                assert(false);
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+            base = (char *) ptr;
+            capacity = len;
+            logstream(LOG_DEBUG) << "Arena capacity now " << capacity << " bytes." << std::endl;
+        }
+
+        /**
+         * Allocates nbytes, aligned to 64 bytes. Grows the arena if it is empty
+         * and too small. Growing remaps the arena, so the arena must be reserved
+         * for all allocations made between resets.
+         */
+        void * allocate(size_t nbytes) {
+            size_t start = (used + 63) & ~((size_t)63);
+            if (start + nbytes > capacity) {
+                assert(used == 0);  // Would invalidate the earlier allocations
+                reserve(start + nbytes);
+            }
+            used = start + nbytes;
+            return base + start;
+        }
+
+        /**
+         * Releases all allocations. The memory remains mapped.
+         */
+        void reset() {
+            used = 0;
+        }
+
+        size_t get_capacity() {
+            return capacity;
+        }
+    };
+
+}
+
+#endif
@@ -25,8 +25,16 @@
 #ifndef DEF_MERGE
 #define DEF_MERGE
 
+#include <algorithm>
+#include <cstddef>
+
 template <class ET, class F> 
-void merge(ET* S1, int l1, ET* S2, int l2, ET* R, F f) {
+void merge(ET* S1, size_t l1, ET* S2, size_t l2, ET* R, F f) {
+    if (l1 == 0 || l2 == 0) {
+        std::copy(S1, S1+l1, R);
+        std::copy(S2, S2+l2, R+l1);
+        return;
+    }
     ET* pR = R; 
     ET* pS1 = S1; 
     ET* pS2 = S2;
@@ -26,10 +26,16 @@
 
 #include <algorithm>
 #include <vector>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "util/merge.hpp"
 
 template <class E, class BinPred>
-void insertionSort(E* A, int n, BinPred f) {
-    for (int i=0; i < n; i++) {
+void insertionSort(E* A, size_t n, BinPred f) {
+    for (size_t i=0; i < n; i++) {
         E v = A[i];
         E* B = A + i;
         while (--B >= A && f(v,*B)) *(B+1) = *B;
@@ -48,10 +54,11 @@ E median(E a, E b, E c, BinPred f) {
 
  // Partly copied from PBBS
 template <class E, class BinPred>
-void quickSort(E* A, int n, BinPred f) {
+void quickSort(E* A, size_t n, BinPred f) {
     if (n < ISORT) insertionSort(A, n, f);
     else {
-        E p = A[rand() % n]; // Random pivot
+        size_t r = ((size_t)rand() << 31) ^ (size_t)rand();
+        E p = A[r % n]; // Random pivot
         E* L = A;   // below L are less than pivot
         E* M = A;   // between L and M are equal to pivot
         E* R = A+n-1; // above R are greater than pivot
@@ -67,11 +74,60 @@ void quickSort(E* A, int n, BinPred f) {
             if (f(*M,p)) std::swap(*M,*(L++));
             M++;
         }
-        quickSort(A, (int) (L-A), f);
-        quickSort(M, (int) (A+n-M), f); // Exclude all elts that equal pivot
+        quickSort(A, (size_t) (L-A), f);
+        quickSort(M, (size_t) (A+n-M), f); // Exclude all elts that equal pivot
     }
 } 
 
+/**
+ * Merges sorted consecutive runs A[bounds[i]..bounds[i+1]) pairwise, in
+ * parallel. Requires a temporary buffer of n elements.
+ */
+template <class E, class BinPred>
+void merge_sorted_runs(E* A, std::vector<size_t> bounds, BinPred f) {
+    int nruns = (int)bounds.size() - 1;
+    if (nruns <= 1) return;
+    size_t n = bounds[nruns] - bounds[0];
+    E * tmp = (E *) malloc(n * sizeof(E));
+    assert(tmp != NULL);
+    E * src = A;
+    E * dst = tmp - bounds[0];
+    for(int width=1; width < nruns; width *= 2) {
+#pragma omp parallel for schedule(dynamic, 1)
+        for(int i=0; i < nruns; i += 2 * width) {
+            size_t st = bounds[i];
+            size_t mid = bounds[std::min(i + width, nruns)];
+            size_t en = bounds[std::min(i + 2 * width, nruns)];
+            merge(src + st, mid - st, src + mid, en - mid, dst + st, f);
+        }
+        std::swap(src, dst);
+    }
+    if (src != A) {
+        memcpy(A + bounds[0], src + bounds[0], n * sizeof(E));
+    }
+    free(tmp);
+}
+
+/**
+ * Sorts chunks of the array in parallel, and then merges them.
+ */
+template <class E, class BinPred>
+void parallel_sort(E* A, size_t n, BinPred f) {
+    int nchunks = omp_get_max_threads();
+    if (nchunks <= 1 || n < 65536) {
+        quickSort(A, n, f);
+        return;
+    }
+    std::vector<size_t> bounds(nchunks + 1);
+    for(int i=0; i <= nchunks; i++) bounds[i] = n * i / nchunks;
+    
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int i=0; i < nchunks; i++) {
+        quickSort(A + bounds[i], bounds[i+1] - bounds[i], f);
+    }
+    merge_sorted_runs(A, bounds, f);
+}
+
 
 #endif  
 
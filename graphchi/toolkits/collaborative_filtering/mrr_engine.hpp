@@ -29,8 +29,6 @@
 
 #include "climf.hpp"
 
-vec mrr_vec;                     // cumulative sum of MRR per thread
-vec users_vec;                   // user count per thread
 int num_threads = 1;
 int cur_iteration = 0;
 
@@ -40,6 +38,9 @@ int cur_iteration = 0;
  */
 struct ValidationMRRProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
 
+  sum_reducer<double> sum_mrr;   // cumulative sum of MRR
+  count_reducer users;           // user count
+
   /**
    *  compute MRR for a single user
    */
@@ -88,19 +89,16 @@ struct ValidationMRRProgram : public GraphChiProgram<VertexDataType, EdgeDataTyp
           }
         }
 
-        assert(mrr_vec.size() > omp_get_thread_num());
-        mrr_vec[omp_get_thread_num()] += MRR;
-
-        assert(users_vec.size() > omp_get_thread_num());
-        users_vec[omp_get_thread_num()]++;
+        sum_mrr.add(MRR);
+        users.inc();
       }
     }
   }
 
   void before_iteration(int iteration, graphchi_context & gcontext)
   {
-    users_vec = zeros(num_threads);
-    mrr_vec = zeros(num_threads);
+    gcontext.add_reducer(&users);
+    gcontext.add_reducer(&sum_mrr);
   }
 
   /**
@@ -108,7 +106,7 @@ struct ValidationMRRProgram : public GraphChiProgram<VertexDataType, EdgeDataTyp
    */
   void after_iteration(int iteration, graphchi_context &gcontext)
   {
-    double mrr = sum(mrr_vec) / sum(users_vec);
+    double mrr = sum_mrr.value() / users.value();
     std::cout<<"  Validation MRR:" << std::setw(10) << mrr << std::endl;
   }
 };
@@ -117,7 +115,6 @@ void reset_mrr(int exec_threads)
 {
   logstream(LOG_DEBUG)<<"Detected number of threads: " << exec_threads << std::endl;
   num_threads = exec_threads;
-  mrr_vec = zeros(num_threads);
 }
 
 template<typename VertexDataType, typename EdgeDataType>
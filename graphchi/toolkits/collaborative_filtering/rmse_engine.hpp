@@ -25,9 +25,6 @@
  */
 
 float (*pprediction_func)(const vertex_data&, const vertex_data&, const float, double &, void *) = NULL;
-vec validation_rmse_vec;
-vec users_vec;
-vec sum_ap_vec;
 bool user_nodes = true;
 int num_threads = 1;
 bool converged_engine = false;
@@ -38,6 +35,9 @@ int cur_iteration = 0;
  */
 struct ValidationAPProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
 
+  sum_reducer<double> sum_ap;
+  count_reducer users;
+
   /**
    *  compute validaton AP for a single user
    */
@@ -51,7 +51,7 @@ struct ValidationAPProgram : public GraphChiProgram<VertexDataType, EdgeDataType
     vec ratings = zeros(vertex.num_outedges());
     vec real_vals = zeros(vertex.num_outedges());
     if (ratings.size() > 0){
-      users_vec[omp_get_thread_num()]++;
+      users.inc();
       int j=0;
       int real_click_count = 0;
       for(int e=0; e < vertex.num_outedges(); e++) {
@@ -75,20 +75,20 @@ struct ValidationAPProgram : public GraphChiProgram<VertexDataType, EdgeDataType
       if (real_click_count > 0 )
         ap /= real_click_count;
       else ap = 0;
-      sum_ap_vec[omp_get_thread_num()] += ap;
+      sum_ap.add(ap);
     }
   }
   void before_iteration(int iteration, graphchi_context & gcontext){
     last_validation_rmse = dvalidation_rmse;
-    users_vec = zeros(num_threads);
-    sum_ap_vec = zeros(num_threads);
+    gcontext.add_reducer(&users);
+    gcontext.add_reducer(&sum_ap);
   }
   /**
    * Called after an iteration has finished.
    */
   void after_iteration(int iteration, graphchi_context &gcontext) {
     assert(Le > 0);
-    dvalidation_rmse = finalize_rmse(sum(sum_ap_vec) , (double)sum(users_vec));
+    dvalidation_rmse = finalize_rmse(sum_ap.value() , (double)users.value());
     std::cout<<"  Validation  " << error_names[loss_type] << ":" << std::setw(10) << dvalidation_rmse << std::endl;
     if (halt_on_rmse_increase > 0 && halt_on_rmse_increase < cur_iteration && dvalidation_rmse > last_validation_rmse){
       logstream(LOG_WARNING)<<"Stopping engine because of validation " << error_names[loss_type] <<  " increase" << std::endl;
@@ -106,6 +106,8 @@ struct ValidationAPProgram : public GraphChiProgram<VertexDataType, EdgeDataType
  */
 struct ValidationRMSEProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
 
+  sum_reducer<double> validation_rmse;
+
   /**
    *  compute validaton RMSE for a single user
    */
@@ -121,21 +123,20 @@ struct ValidationRMSEProgram : public GraphChiProgram<VertexDataType, EdgeDataTy
       double prediction;
       double rmse = (*pprediction_func)(vdata, nbr_latent, observation, prediction, NULL);
       assert(rmse <= pow(maxval - minval, 2));
-      assert(validation_rmse_vec.size() > omp_get_thread_num());
-      validation_rmse_vec[omp_get_thread_num()] += rmse;
+      validation_rmse.add(rmse);
     }
   }
 
   void before_iteration(int iteration, graphchi_context & gcontext){
     last_validation_rmse = dvalidation_rmse;
-    validation_rmse_vec = zeros(num_threads);
+    gcontext.add_reducer(&validation_rmse);
   }
   /**
    * Called after an iteration has finished.
    */
   void after_iteration(int iteration, graphchi_context &gcontext) {
     assert(Le > 0);
-    dvalidation_rmse = finalize_rmse(sum(validation_rmse_vec) , (double)Le);
+    dvalidation_rmse = finalize_rmse(validation_rmse.value() , (double)Le);
     std::cout<<"  Validation  " << error_names[loss_type] << ":" << std::setw(10) << dvalidation_rmse << std::endl;
     if (halt_on_rmse_increase > 0 && halt_on_rmse_increase < cur_iteration && dvalidation_rmse > last_validation_rmse){
       logstream(LOG_WARNING)<<"Stopping engine because of validation RMSE increase" << std::endl;
@@ -25,7 +25,6 @@
  */
 
 float (*pprediction_func)(const vertex_data&, const vertex_data&, const float, double &, void *) = NULL;
-vec validation_rmse_vec;
 bool user_nodes = true;
 int counter = 0;
 bool time_weighting = false;
@@ -40,6 +39,8 @@ int cur_iteration = 0;
  */
 struct ValidationRMSEProgram4 : public GraphChiProgram<VertexDataType, EdgeDataType> {
 
+  sum_reducer<double> validation_rmse;
+
   /**
    *  compute validaton RMSE for a single user
    */
@@ -63,21 +64,20 @@ struct ValidationRMSEProgram4 : public GraphChiProgram<VertexDataType, EdgeDataT
       assert(rmse <= pow(maxval - minval, 2));
       if (time_weighting)
         rmse *= vertex.edge(e)->get_data().time;
-      assert(validation_rmse_vec.size() > omp_get_thread_num());
-      validation_rmse_vec[omp_get_thread_num()] += rmse;
+      validation_rmse.add(rmse);
     }
   }
 
   void before_iteration(int iteration, graphchi_context & gcontext){
     last_validation_rmse = dvalidation_rmse;
-    validation_rmse_vec = zeros(num_threads);
+    gcontext.add_reducer(&validation_rmse);
   }
   /**
    * Called after an iteration has finished.
    */
   void after_iteration(int iteration, graphchi_context &gcontext) {
     assert(Le > 0);
-    dvalidation_rmse = finalize_rmse(sum(validation_rmse_vec) , (double)Le);
+    dvalidation_rmse = finalize_rmse(validation_rmse.value() , (double)Le);
     std::cout<<"  Validation  " << error_names[loss_type] << ":" << std::setw(10) << dvalidation_rmse << std::endl;
   if (halt_on_rmse_increase > 0 && halt_on_rmse_increase < cur_iteration && dvalidation_rmse > last_validation_rmse){
     logstream(LOG_WARNING)<<"Stopping engine because of validation RMSE increase" << std::endl;
@@ -40,6 +40,9 @@
  * overwrite each others value. However, because they will be never run in parallel
  * (due to deterministic parallellism of graphchi), this does not compromise correctness.
  *
+ * With --priority=1, the neighbors are scheduled with the decrease of their label
+ * as the priority, so the vertices receiving the largest changes are run first.
+ *
  * @author Aapo Kyrola
  */
 
@@ -106,10 +109,12 @@ struct ConnectedComponentsProgram : public GraphChiProgram<VertexDataType, EdgeD
         
         if (gcontext.iteration > 0) {
             for(int i=0; i < vertex.num_edges(); i++) {
-                if (label < vertex.edge(i)->get_data()) {
+                vid_t oldlabel = vertex.edge(i)->get_data();
+                if (label < oldlabel) {
                     vertex.edge(i)->set_data(label);
-                    /* Schedule neighbor for update */
-                    gcontext.scheduler->add_task(vertex.edge(i)->vertex_id()); 
+                    /* Schedule neighbor for update, with the decrease of the label as
+                       the priority (used with --priority=1) */
+                    gcontext.scheduler->add_task(vertex.edge(i)->vertex_id(), (float) (oldlabel - label)); 
                 }
             }
         } else if (gcontext.iteration == 0) {
@@ -155,6 +160,7 @@ int main(int argc, const char ** argv) {
         ConnectedComponentsProgram program;
         graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, scheduler, m); 
         engine.run(program, niters);
+        logstream(LOG_INFO) << "Updates: " << engine.num_updates() << std::endl;
 
          /* optional: output labels for each node to file */
         if (output_labels){